@@ -0,0 +1,69 @@
+// Lexer-only throughput benchmark
+//
+// $ make bench
+// $ ./bench/lexer [-n ITERATIONS] FILE...
+#include <time.h>
+
+#include "lexer.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = 10;
+    if (argc > 2 && !strcmp(argv[1], "-n")) {
+        iterations = strtoul(argv[2], NULL, 10);
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s [-n ITERATIONS] FILE...\n", argv[0]);
+        exit(1);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        Lexer l = {0};
+        if (!lexer_open(&l, argv[i])) {
+            fprintf(stderr, "ERROR: Could not read file '%s'\n", argv[i]);
+            exit(1);
+        }
+
+        const Lexer origin = l;
+        const SV    sv = l.sv;
+        size_t      tokens = 0;
+
+        const double start = now();
+        for (size_t j = 0; j < iterations; j++) {
+            const ArenaMark temp = temp_save();
+
+            l = origin;
+            while (lexer_next(&l).kind != TOKEN_EOF) {
+                tokens++;
+            }
+
+            if (l.error) {
+                fprintf(stderr, PosFmt "ERROR: %s\n", PosArg(source_pos(l.error_offset)), l.error);
+                exit(1);
+            }
+
+            temp_restore(temp);
+        }
+        const double elapsed = now() - start;
+
+        const double mb = (double) sv.count / 1e6;
+        printf(
+            "%s: %.2f MB, %zu tokens, %zu iterations in %.3fs (%.1f MB/s)\n",
+            argv[i],
+            mb,
+            iterations ? tokens / iterations : 0,
+            iterations,
+            elapsed,
+            elapsed > 0 ? mb * iterations / elapsed : 0);
+    }
+
+    return 0;
+}
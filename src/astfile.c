@@ -0,0 +1,688 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "astfile.h"
+
+#define ASTFILE_MAGIC   "GLOSAST"
+#define ASTFILE_VERSION 3
+#define ASTFILE_ENDIAN  0x01020304
+#define ASTFILE_ALIGN   16
+
+typedef struct {
+    Symbol name;
+    NodeId node;
+} GlobalRecord;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t args; // Index of the first argument in the argument section
+    uint32_t arity;
+    Type     ret;
+} TypeRecord;
+
+typedef struct {
+    uint32_t offset; // Into the symbol bytes section
+    uint32_t count;
+} SymbolRecord;
+
+typedef enum {
+    SECTION_NODES,
+    SECTION_LISTS,
+    SECTION_PAYLOADS,
+    SECTION_GLOBALS = SECTION_PAYLOADS + COUNT_NODES,
+    SECTION_TYPES,
+    SECTION_TYPE_ARGS,
+    SECTION_SYMBOLS,
+    SECTION_SYMBOL_BYTES,
+    COUNT_SECTIONS
+} SectionKind;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t count;
+} Section;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t layout;
+    uint64_t compiler; // compiler_identity(), zero if it was unknown
+
+    uint64_t source_hash;
+    uint64_t source_size;
+
+    Section sections[COUNT_SECTIONS];
+} Header;
+
+typedef struct {
+    void  **data;
+    size_t *count;
+    size_t *capacity;
+} Array;
+
+#define ARRAY_OF(a) ((Array) {(void **) &(a).data, &(a).count, &(a).capacity})
+
+static_assert(COUNT_NODES == 10, "");
+static const size_t section_sizes[COUNT_SECTIONS] = {
+    [SECTION_NODES] = sizeof(Node),
+    [SECTION_LISTS] = sizeof(NodeId),
+    [SECTION_PAYLOADS + NODE_ATOM] = sizeof(NodeAtom),
+    [SECTION_PAYLOADS + NODE_CALL] = sizeof(NodeCall),
+    [SECTION_PAYLOADS + NODE_UNARY] = sizeof(NodeUnary),
+    [SECTION_PAYLOADS + NODE_BINARY] = sizeof(NodeBinary),
+    [SECTION_PAYLOADS + NODE_IF] = sizeof(NodeIf),
+    [SECTION_PAYLOADS + NODE_BLOCK] = sizeof(NodeBlock),
+    [SECTION_PAYLOADS + NODE_RETURN] = sizeof(NodeReturn),
+    [SECTION_PAYLOADS + NODE_FN] = sizeof(NodeFn),
+    [SECTION_PAYLOADS + NODE_VAR] = sizeof(NodeVar),
+    [SECTION_PAYLOADS + NODE_PRINT] = sizeof(NodePrint),
+    [SECTION_GLOBALS] = sizeof(GlobalRecord),
+    [SECTION_TYPES] = sizeof(TypeRecord),
+    [SECTION_TYPE_ARGS] = sizeof(Type),
+    [SECTION_SYMBOLS] = sizeof(SymbolRecord),
+    [SECTION_SYMBOL_BYTES] = 1,
+};
+
+// The tree is stored in the native layout, so anything which changes it makes older files unreadable
+static uint64_t astfile_layout(void) {
+    const uint64_t layout[] = {
+        COUNT_NODES,
+        COUNT_TOKENS,
+        COUNT_TYPES,
+        COUNT_BUILTIN_TYPES,
+        COUNT_BUILTIN_SYMBOLS,
+        sizeof(Header),
+        hash_bytes(section_sizes, sizeof(section_sizes)),
+    };
+    return hash_bytes(layout, sizeof(layout));
+}
+
+// The node and list arrays, followed by one array per payload kind
+static void ast_arrays(Ast *ast, Array *out) {
+    out[SECTION_NODES] = ARRAY_OF(ast->nodes);
+    out[SECTION_LISTS] = ARRAY_OF(ast->lists);
+    out[SECTION_PAYLOADS + NODE_ATOM] = ARRAY_OF(ast->atoms);
+    out[SECTION_PAYLOADS + NODE_CALL] = ARRAY_OF(ast->calls);
+    out[SECTION_PAYLOADS + NODE_UNARY] = ARRAY_OF(ast->unaries);
+    out[SECTION_PAYLOADS + NODE_BINARY] = ARRAY_OF(ast->binaries);
+    out[SECTION_PAYLOADS + NODE_IF] = ARRAY_OF(ast->ifs);
+    out[SECTION_PAYLOADS + NODE_BLOCK] = ARRAY_OF(ast->blocks);
+    out[SECTION_PAYLOADS + NODE_RETURN] = ARRAY_OF(ast->returns);
+    out[SECTION_PAYLOADS + NODE_FN] = ARRAY_OF(ast->fns);
+    out[SECTION_PAYLOADS + NODE_VAR] = ARRAY_OF(ast->vars);
+    out[SECTION_PAYLOADS + NODE_PRINT] = ARRAY_OF(ast->prints);
+}
+
+static size_t align_up(size_t n) {
+    return (n + ASTFILE_ALIGN - 1) & ~(size_t) (ASTFILE_ALIGN - 1);
+}
+
+static void shift_offsets(Ast *ast, uint32_t shift) {
+    for (size_t i = 0; i < ast->nodes.count; i++) {
+        ast->nodes.data[i].offset += shift;
+    }
+}
+
+bool astfile_write(const char *path, Context *c, SV source, uint32_t base) {
+    Ast *ast = c->ast;
+
+    // Lowered nodes belong to the process which made them
+    for (size_t i = 0; i < ast->fns.count; i++) {
+        ast->fns.data[i].qbe = NULL;
+    }
+
+    for (size_t i = 0; i < ast->vars.count; i++) {
+        ast->vars.data[i].qbe = NULL;
+    }
+
+    const ArenaMark temp = temp_save();
+    const void     *data[COUNT_SECTIONS] = {0};
+
+    uint64_t compiler = 0;
+    compiler_identity(&compiler);
+
+    Header h = {
+        .magic = ASTFILE_MAGIC,
+        .version = ASTFILE_VERSION,
+        .endian = ASTFILE_ENDIAN,
+        .layout = astfile_layout(),
+        .compiler = compiler,
+        .source_hash = hash_bytes(source.data, source.count),
+        .source_size = source.count,
+    };
+
+    Array arrays[SECTION_GLOBALS];
+    ast_arrays(ast, arrays);
+    for (size_t i = 0; i < SECTION_GLOBALS; i++) {
+        data[i] = *arrays[i].data;
+        h.sections[i].count = *arrays[i].count;
+    }
+
+    GlobalRecord *globals = temp_alloc(c->globals.count * sizeof(*globals));
+    for (size_t i = 0; i < c->globals.count; i++) {
+        globals[i] = (GlobalRecord) {.name = c->globals.data[i].name, .node = c->globals.data[i].node};
+    }
+    data[SECTION_GLOBALS] = globals;
+    h.sections[SECTION_GLOBALS].count = c->globals.count;
+
+    const size_t type_total = type_count();
+    TypeRecord  *types = temp_alloc(type_total * sizeof(*types));
+    struct {
+        Type  *data;
+        size_t count;
+        size_t capacity;
+    } type_args = {0};
+
+    for (Type t = 0; t < type_total; t++) {
+        types[t] = (TypeRecord) {.kind = type_kind(t), .args = type_args.count};
+        if (types[t].kind == TYPE_FN) {
+            types[t].arity = type_arity(t);
+            types[t].ret = type_ret(t);
+            for (size_t i = 0; i < types[t].arity; i++) {
+                da_push(&type_args, type_arg(t, i));
+            }
+        }
+    }
+    data[SECTION_TYPES] = types;
+    data[SECTION_TYPE_ARGS] = type_args.data;
+    h.sections[SECTION_TYPES].count = type_total;
+    h.sections[SECTION_TYPE_ARGS].count = type_args.count;
+
+    const size_t  symbol_total = symbol_count();
+    SymbolRecord *symbols = temp_alloc(symbol_total * sizeof(*symbols));
+    struct {
+        char  *data;
+        size_t count;
+        size_t capacity;
+    } bytes = {0};
+
+    for (Symbol s = 0; s < symbol_total; s++) {
+        const SV sv = symbol_sv(s);
+        symbols[s] = (SymbolRecord) {.offset = bytes.count, .count = sv.count};
+        if (sv.count) {
+            da_push_many(&bytes, sv.data, sv.count);
+        }
+    }
+    data[SECTION_SYMBOLS] = symbols;
+    data[SECTION_SYMBOL_BYTES] = bytes.data;
+    h.sections[SECTION_SYMBOLS].count = symbol_total;
+    h.sections[SECTION_SYMBOL_BYTES].count = bytes.count;
+
+    size_t cursor = align_up(sizeof(h));
+    for (size_t i = 0; i < COUNT_SECTIONS; i++) {
+        h.sections[i].offset = cursor;
+        cursor = align_up(cursor + h.sections[i].count * section_sizes[i]);
+    }
+
+    // Published with a rename, so a reader never maps a file which is still being written. Every writer gets a
+    // temporary file of its own, as modules shared by several programs can be written by more than one at a time.
+    char     *temp_path = temp_sprintf("%s.XXXXXX", path);
+    const int fd = mkstemp(temp_path);
+    FILE     *f = fd >= 0 && !fchmod(fd, 0644) ? fdopen(fd, "wb") : NULL;
+    bool      ok = f && fwrite(&h, sizeof(h), 1, f) == 1;
+    if (fd >= 0 && !f) {
+        close(fd);
+    }
+
+    shift_offsets(ast, -base);
+    for (size_t i = 0; ok && i < COUNT_SECTIONS; i++) {
+        const size_t size = h.sections[i].count * section_sizes[i];
+        ok = !fseek(f, h.sections[i].offset, SEEK_SET) && (!size || fwrite(data[i], size, 1, f) == 1);
+    }
+    shift_offsets(ast, base);
+
+    // Pad the last section, so every one of them can be mapped whole
+    ok = ok && !fseek(f, cursor - 1, SEEK_SET) && fputc(0, f) != EOF;
+
+    if (f && fclose(f)) {
+        ok = false;
+    }
+
+    if (ok && rename(temp_path, path) < 0) {
+        ok = false;
+    }
+
+    if (!ok && fd >= 0) {
+        remove(temp_path);
+    }
+
+    da_free(&type_args);
+    da_free(&bytes);
+    temp_restore(temp);
+    return ok;
+}
+
+// A file written by another build of the compiler, or by one which could not tell, may mean something else
+static bool header_valid(const Header *h, size_t size, SV source) {
+    if (memcmp(h->magic, ASTFILE_MAGIC, sizeof(h->magic)) || h->version != ASTFILE_VERSION ||
+        h->endian != ASTFILE_ENDIAN || h->layout != astfile_layout()) {
+        return false;
+    }
+
+    uint64_t compiler = 0;
+    if (!compiler_identity(&compiler) || !h->compiler || h->compiler != compiler) {
+        return false;
+    }
+
+    if (h->source_size != source.count || h->source_hash != hash_bytes(source.data, source.count)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < COUNT_SECTIONS; i++) {
+        const Section *s = &h->sections[i];
+        if (s->offset % ASTFILE_ALIGN || s->offset > size || s->count > (size - s->offset) / section_sizes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define SECTION(f, h, kind) ((void *) ((char *) (f)->data + (h)->sections[kind].offset))
+
+// Interning in the order they were written hands out the same IDs again, unless this process got to some first.
+// Both return whether the records were valid, and set 'same' if every ID came back unchanged.
+static bool types_read(const AstFile *f, const Header *h, Type *map, bool *same) {
+    const TypeRecord *types = SECTION(f, h, SECTION_TYPES);
+    const Type       *args = SECTION(f, h, SECTION_TYPE_ARGS);
+    const size_t      count = h->sections[SECTION_TYPES].count;
+    const size_t      args_count = h->sections[SECTION_TYPE_ARGS].count;
+
+    if (count < COUNT_BUILTIN_TYPES) {
+        return false;
+    }
+
+    *same = true;
+    for (Type t = 0; t < count; t++) {
+        const TypeRecord *it = &types[t];
+        if (t < COUNT_BUILTIN_TYPES) {
+            map[t] = t;
+            continue;
+        }
+
+        if (it->kind != TYPE_FN || it->ret >= t || it->args > args_count || it->arity > args_count - it->args) {
+            return false;
+        }
+
+        const ArenaMark temp = temp_save();
+        Type           *mapped = temp_alloc(it->arity * sizeof(*mapped));
+
+        bool valid = true;
+        for (size_t i = 0; i < it->arity && valid; i++) {
+            valid = args[it->args + i] < t;
+            mapped[i] = valid ? map[args[it->args + i]] : 0;
+        }
+
+        if (valid) {
+            map[t] = type_fn(mapped, it->arity, map[it->ret]);
+            *same = *same && map[t] == t;
+        }
+
+        temp_restore(temp);
+        if (!valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool symbols_read(const AstFile *f, const Header *h, Symbol *map, bool *same) {
+    const SymbolRecord *symbols = SECTION(f, h, SECTION_SYMBOLS);
+    const char         *bytes = SECTION(f, h, SECTION_SYMBOL_BYTES);
+    const size_t        count = h->sections[SECTION_SYMBOLS].count;
+    const size_t        bytes_count = h->sections[SECTION_SYMBOL_BYTES].count;
+
+    if (count < COUNT_BUILTIN_SYMBOLS) {
+        return false;
+    }
+
+    *same = true;
+    for (Symbol s = 0; s < count; s++) {
+        const SymbolRecord *it = &symbols[s];
+        if (s < COUNT_BUILTIN_SYMBOLS) {
+            map[s] = s;
+            continue;
+        }
+
+        if (it->offset > bytes_count || it->count > bytes_count - it->offset) {
+            return false;
+        }
+
+        map[s] = symbol_intern((SV) {bytes + it->offset, it->count});
+        *same = *same && map[s] == s;
+    }
+    return true;
+}
+
+static bool globals_valid(const AstFile *f, const Header *h, const Ast *ast) {
+    const GlobalRecord *globals = SECTION(f, h, SECTION_GLOBALS);
+    for (size_t i = 0; i < h->sections[SECTION_GLOBALS].count; i++) {
+        if (globals[i].name >= h->sections[SECTION_SYMBOLS].count || !globals[i].node ||
+            globals[i].node >= ast->nodes.count) {
+            return false;
+        }
+
+        const NodeKind kind = ast->nodes.data[globals[i].node].kind;
+        if (kind != NODE_FN && kind != NODE_VAR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const Ast *ast;
+    NodeId     node;       // Whose children are being validated
+    NodeId    *parents;    // Zero for nodes no other node names as a child
+    bool      *type_names; // Nodes which spell a type, the only identifiers with no definition
+    bool       valid;
+} Validate;
+
+static bool node_is(const Validate *v, NodeId id, NodeKind kind) {
+    return id && id < v->ast->nodes.count && v->ast->nodes.data[id].kind == kind;
+}
+
+static void validate_child(Validate *v, NodeId id, bool optional) {
+    if (!id) {
+        v->valid = v->valid && optional;
+    } else if (id >= v->ast->nodes.count || v->parents[id]) {
+        v->valid = false;
+    } else {
+        v->parents[id] = v->node;
+    }
+}
+
+static void validate_type(Validate *v, NodeId id) {
+    validate_child(v, id, true);
+    if (id && v->valid) {
+        v->valid = node_is(v, id, NODE_ATOM) || node_is(v, id, NODE_FN);
+        v->type_names[id] = true;
+    }
+}
+
+static void validate_list(Validate *v, NodeList list, NodeKind kind) {
+    if ((size_t) list.first + list.count > v->ast->lists.count) {
+        v->valid = false;
+        return;
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        const NodeId id = v->ast->lists.data[list.first + i];
+        validate_child(v, id, false);
+        v->valid = v->valid && (kind == COUNT_NODES || node_is(v, id, kind));
+    }
+}
+
+// Lowering switches over the operators of these, and the rest keep the token they were parsed from
+static_assert(COUNT_TOKENS == 22, "");
+static bool token_valid(NodeKind kind, TokenKind token) {
+    switch (kind) {
+    case NODE_ATOM:
+        return token == TOKEN_INT || token == TOKEN_BOOL || token == TOKEN_IDENT;
+
+    case NODE_UNARY:
+        return token == TOKEN_SUB;
+
+    case NODE_BINARY:
+        return token == TOKEN_ADD || token == TOKEN_SUB || token == TOKEN_MUL || token == TOKEN_DIV ||
+               token == TOKEN_SET;
+
+    default:
+        return token < COUNT_TOKENS;
+    }
+}
+
+// Every index in the file is checked before anything follows one, the IDs against the sections they were written
+// with. Nodes must form a tree, which is what lets lowering recurse through them.
+static_assert(COUNT_NODES == 10, "");
+static bool ast_valid(const Ast *ast, const Header *h, const Type *types) {
+    const size_t type_total = h->sections[SECTION_TYPES].count;
+    const size_t symbols = h->sections[SECTION_SYMBOLS].count;
+
+    Validate v = {
+        .ast = ast,
+        .parents = calloc(ast->nodes.count + 1, sizeof(*v.parents)),
+        .type_names = calloc(ast->nodes.count + 1, sizeof(*v.type_names)),
+        .valid = true,
+    };
+    assert(v.parents && v.type_names);
+
+    const size_t payloads[COUNT_NODES] = {
+        [NODE_ATOM] = ast->atoms.count,
+        [NODE_CALL] = ast->calls.count,
+        [NODE_UNARY] = ast->unaries.count,
+        [NODE_BINARY] = ast->binaries.count,
+        [NODE_IF] = ast->ifs.count,
+        [NODE_BLOCK] = ast->blocks.count,
+        [NODE_RETURN] = ast->returns.count,
+        [NODE_FN] = ast->fns.count,
+        [NODE_VAR] = ast->vars.count,
+        [NODE_PRINT] = ast->prints.count,
+    };
+
+    for (NodeId id = 0; id < ast->nodes.count && v.valid; id++) {
+        const Node *n = &ast->nodes.data[id];
+        v.valid = n->type < type_total;
+        if (!id || !v.valid) {
+            continue;
+        }
+
+        v.valid = n->kind < COUNT_NODES && token_valid(n->kind, n->token) && n->offset <= h->source_size &&
+                  n->data < payloads[n->kind];
+    }
+
+    for (NodeId id = 1; id < ast->nodes.count && v.valid; id++) {
+        const Node *n = &ast->nodes.data[id];
+        v.node = id;
+        switch (n->kind) {
+        case NODE_ATOM: {
+            const NodeAtom *atom = &ast->atoms.data[n->data];
+            if (n->token == TOKEN_IDENT) {
+                v.valid = atom->as.symbol < symbols && (!atom->definition || node_is(&v, atom->definition, NODE_FN) ||
+                                                        node_is(&v, atom->definition, NODE_VAR));
+            } else if (n->token == TOKEN_BOOL) {
+                uint8_t byte;
+                memcpy(&byte, &atom->as.boolean, sizeof(byte));
+                v.valid = byte <= 1;
+            }
+        } break;
+
+        case NODE_CALL: {
+            const NodeCall *call = &ast->calls.data[n->data];
+            validate_child(&v, call->fn, false);
+            validate_list(&v, call->args, COUNT_NODES);
+            v.valid = v.valid && type_kind(types[ast->nodes.data[call->fn].type]) == TYPE_FN;
+        } break;
+
+        case NODE_UNARY:
+            validate_child(&v, ast->unaries.data[n->data].operand, false);
+            break;
+
+        case NODE_BINARY:
+            validate_child(&v, ast->binaries.data[n->data].lhs, false);
+            validate_child(&v, ast->binaries.data[n->data].rhs, false);
+            break;
+
+        case NODE_IF:
+            validate_child(&v, ast->ifs.data[n->data].condition, false);
+            validate_child(&v, ast->ifs.data[n->data].consequence, false);
+            validate_child(&v, ast->ifs.data[n->data].antecedence, true);
+            break;
+
+        case NODE_BLOCK:
+            validate_list(&v, ast->blocks.data[n->data].body, COUNT_NODES);
+            break;
+
+        case NODE_RETURN:
+            validate_child(&v, ast->returns.data[n->data].value, true);
+            break;
+
+        case NODE_FN: {
+            const NodeFn *fn = &ast->fns.data[n->data];
+            validate_list(&v, fn->args, NODE_VAR);
+            validate_type(&v, fn->ret);
+            validate_child(&v, fn->body, true);
+            v.valid = v.valid && (!fn->body || node_is(&v, fn->body, NODE_BLOCK)) &&
+                      type_kind(types[n->type]) == TYPE_FN;
+        } break;
+
+        case NODE_VAR: {
+            const NodeVar *var = &ast->vars.data[n->data];
+            validate_child(&v, var->expr, true);
+            validate_type(&v, var->type);
+            v.valid = v.valid && var->kind <= NODE_VAR_ARG;
+        } break;
+
+        case NODE_PRINT:
+            validate_child(&v, ast->prints.data[n->data].operand, false);
+            break;
+
+        default:
+            unreachable();
+        }
+    }
+
+    // With one parent each, nodes can still form a loop, which following the parents up from it never leaves. Chains
+    // already followed to a root are marked as done.
+    bool *done = calloc(ast->nodes.count + 1, sizeof(*done));
+    assert(done);
+    for (NodeId id = 1; id < ast->nodes.count && v.valid; id++) {
+        size_t steps = 0;
+        for (NodeId it = id; it && !done[it] && v.valid; it = v.parents[it]) {
+            v.valid = ++steps < ast->nodes.count;
+        }
+
+        for (NodeId it = id; it && !done[it] && v.valid; it = v.parents[it]) {
+            done[it] = true;
+        }
+    }
+    free(done);
+
+    for (NodeId id = 1; id < ast->nodes.count && v.valid; id++) {
+        const Node *n = &ast->nodes.data[id];
+        if (n->kind == NODE_ATOM && n->token == TOKEN_IDENT && !v.type_names[id]) {
+            v.valid = ast->atoms.data[n->data].definition;
+        }
+    }
+
+    // Names are translated for every payload, and lowered nodes never survive a write
+    for (size_t i = 0; i < ast->fns.count && v.valid; i++) {
+        const NodeFn *it = &ast->fns.data[i];
+        v.valid = it->name < symbols && it->module < symbols && !it->qbe;
+    }
+
+    for (size_t i = 0; i < ast->vars.count && v.valid; i++) {
+        const NodeVar *it = &ast->vars.data[i];
+        v.valid = it->name < symbols && it->module < symbols && !it->qbe;
+    }
+
+    const bool valid = v.valid;
+    free(v.parents);
+    free(v.type_names);
+    return valid;
+}
+
+static void ast_translate(Ast *ast, const Type *types, const Symbol *symbols) {
+    for (size_t i = 0; i < ast->nodes.count; i++) {
+        ast->nodes.data[i].type = types[ast->nodes.data[i].type];
+    }
+
+    for (NodeId id = 1; id < ast->nodes.count; id++) {
+        const Node *n = ast_node(ast, id);
+        if (n->kind == NODE_ATOM && n->token == TOKEN_IDENT) {
+            NodeAtom *atom = ast_atom(ast, id);
+            atom->as.symbol = symbols[atom->as.symbol];
+        }
+    }
+
+    for (size_t i = 0; i < ast->fns.count; i++) {
+        ast->fns.data[i].name = symbols[ast->fns.data[i].name];
+        ast->fns.data[i].module = symbols[ast->fns.data[i].module];
+    }
+
+    for (size_t i = 0; i < ast->vars.count; i++) {
+        ast->vars.data[i].name = symbols[ast->vars.data[i].name];
+        ast->vars.data[i].module = symbols[ast->vars.data[i].module];
+    }
+}
+
+bool astfile_read(AstFile *f, const char *path, Context *c, SV source, uint32_t base) {
+    memset(f, 0, sizeof(*f));
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    f->data = data;
+    f->size = st.st_size;
+
+    const Header *h = data;
+    if (!header_valid(h, f->size, source)) {
+        astfile_free(f);
+        return false;
+    }
+
+    const ArenaMark temp = temp_save();
+    Type           *types = temp_alloc(h->sections[SECTION_TYPES].count * sizeof(*types));
+    Symbol         *symbols = temp_alloc(h->sections[SECTION_SYMBOLS].count * sizeof(*symbols));
+
+    Ast   view = {0};
+    Array arrays[SECTION_GLOBALS];
+    ast_arrays(&view, arrays);
+    for (size_t i = 0; i < SECTION_GLOBALS; i++) {
+        *arrays[i].data = SECTION(f, h, i);
+        *arrays[i].count = h->sections[i].count;
+        *arrays[i].capacity = h->sections[i].count;
+    }
+
+    // Checked before anything is translated, so a bad file is rejected without touching the tree
+    bool types_same = false;
+    bool symbols_same = false;
+    if (!types_read(f, h, types, &types_same) || !symbols_read(f, h, symbols, &symbols_same) ||
+        !ast_valid(&view, h, types) || !globals_valid(f, h, &view)) {
+        temp_restore(temp);
+        astfile_free(f);
+        return false;
+    }
+
+    Ast *ast = c->ast;
+    *ast = view;
+
+    if (!types_same || !symbols_same) {
+        ast_translate(ast, types, symbols);
+    }
+
+    if (base) {
+        shift_offsets(ast, base);
+    }
+
+    const GlobalRecord *globals = SECTION(f, h, SECTION_GLOBALS);
+    for (size_t i = 0; i < h->sections[SECTION_GLOBALS].count; i++) {
+        scope_push(&c->globals, symbols[globals[i].name], globals[i].node);
+    }
+
+    temp_restore(temp);
+    return true;
+}
+
+void astfile_free(AstFile *f) {
+    if (f->data) {
+        munmap(f->data, f->size);
+    }
+    memset(f, 0, sizeof(*f));
+}
@@ -0,0 +1,26 @@
+#ifndef ASTFILE_H
+#define ASTFILE_H
+
+#include "context.h"
+
+// A checked tree written out as it sits in memory. Nodes refer to each other by ID and offsets are relative to the
+// source, so reading one back is a single mapping, with the arrays of the tree pointing straight into it.
+typedef struct {
+    void  *data;
+    size_t size;
+} AstFile;
+
+// Writes the tree and global scope of the context, checked from 'source' registered at 'base'
+bool astfile_write(const char *path, Context *c, SV source, uint32_t base);
+
+// Fails if the file is missing, was written by another build of the compiler or for other source text, or any index
+// in it is out of range or the nodes do not form a tree. Types and symbols come back under the IDs they were written
+// with, and offsets need no shifting when the source is registered first, which is what a fresh process does. Anything
+// else costs one pass to translate IDs.
+//
+// The mapping is private, so lowering can still fill in nodes, but the tree must not grow. It is released by
+// astfile_free(), never ast_free().
+bool astfile_read(AstFile *f, const char *path, Context *c, SV source, uint32_t base);
+void astfile_free(AstFile *f);
+
+#endif // ASTFILE_H
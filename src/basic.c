@@ -1,9 +1,19 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "basic.h"
 
+#ifdef __APPLE__
+#    include <mach-o/dyld.h>
+#endif
+
 #define return_defer(value)                                                                                            \
     do {                                                                                                               \
         result = (value);                                                                                              \
@@ -34,15 +44,182 @@ SV sv_strip_suffix(SV a, SV b) {
     return a;
 }
 
+// Hash
+uint64_t hash_bytes(const void *data, size_t count) {
+    // FNV-1a
+    const unsigned char *bytes = data;
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < count; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// Arena Allocator
+#define ARENA_MINIMUM_CAPACITY (64 * 1024)
+#define ARENA_MAXIMUM_CAPACITY (64 * 1024 * 1024)
+#define ARENA_HUGE_PAGE_SIZE   (2 * 1024 * 1024)
+
+struct ArenaRegion {
+    ArenaRegion *next;
+    size_t       count;
+    size_t       capacity;
+    char         data[];
+};
+
+static void region_unmap(ArenaRegion *r) {
+    munmap(r, sizeof(ArenaRegion) + r->capacity);
+}
+
+static void region_list_unmap(ArenaRegion *it) {
+    while (it) {
+        ArenaRegion *next = it->next;
+        region_unmap(it);
+        it = next;
+    }
+}
+
+void arena_free(Arena *a) {
+    region_list_unmap(a->head);
+    region_list_unmap(a->large);
+    region_list_unmap(a->spare);
+    memset(a, 0, sizeof(*a));
+}
+
+// Anonymous mappings are zero-filled by the kernel, so allocations never have to clear memory themselves
+static ArenaRegion *region_map(Arena *a, size_t capacity) {
+    const size_t size = sizeof(ArenaRegion) + capacity;
+
+    ArenaRegion *r = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Could not map %zu bytes: %s\n", size, strerror(errno));
+        exit(1);
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (a->huge && size >= ARENA_HUGE_PAGE_SIZE) {
+        madvise(r, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    r->capacity = capacity;
+    a->stats.reserved += size;
+    a->stats.regions++;
+    return r;
+}
+
+static ArenaRegion *region_take(Arena *a, size_t capacity, size_t size) {
+    for (ArenaRegion **it = &a->spare; *it; it = &(*it)->next) {
+        ArenaRegion *r = *it;
+        if (r->capacity >= size) {
+            *it = r->next;
+            return r;
+        }
+    }
+
+    return region_map(a, capacity);
+}
+
+static void *arena_alloc_slow(Arena *a, size_t size) {
+    if (!a->next) {
+        a->next = ARENA_MINIMUM_CAPACITY;
+    }
+
+    // Oversized requests get a region of their own, so the head keeps bumping into what it has left
+    if (size > a->next / 2 && a->head) {
+        ArenaRegion *r = region_take(a, size, size);
+        r->count = size;
+        r->next = a->large;
+        a->large = r;
+        return r->data;
+    }
+
+    size_t capacity = a->next;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    if (a->next < ARENA_MAXIMUM_CAPACITY) {
+        a->next *= 2;
+    }
+
+    if (a->head) {
+        a->stats.waste += a->head->capacity - a->head->count;
+    }
+
+    ArenaRegion *r = region_take(a, capacity, size);
+    r->count = size;
+    r->next = a->head;
+    a->head = r;
+    return r->data;
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+    a->stats.requested += size;
+    size = (size + 7) & -8; // Alignment
+
+    ArenaRegion *r = a->head;
+    if (!r || r->capacity - r->count < size) {
+        return arena_alloc_slow(a, size);
+    }
+
+    void *ptr = &r->data[r->count];
+    r->count += size;
+    return ptr;
+}
+
+ArenaMark arena_mark(const Arena *a) {
+    return (ArenaMark) {
+        .head = a->head,
+        .large = a->large,
+        .count = a->head ? a->head->count : 0,
+    };
+}
+
+// Memory is cleared when it is given back rather than when it is handed out, which keeps allocation free of memset
+static void region_release(Arena *a, ArenaRegion *r) {
+    memset(r->data, 0, r->count);
+    r->count = 0;
+    r->next = a->spare;
+    a->spare = r;
+}
+
+void arena_rewind(Arena *a, ArenaMark m) {
+    while (a->large != m.large) {
+        assert(a->large);
+        ArenaRegion *r = a->large;
+        a->large = r->next;
+        region_release(a, r);
+    }
+
+    while (a->head != m.head) {
+        assert(a->head);
+        ArenaRegion *r = a->head;
+        a->head = r->next;
+        if (a->head) {
+            a->stats.waste -= a->head->capacity - a->head->count; // Back in use
+        }
+        region_release(a, r);
+    }
+
+    if (a->head) {
+        assert(m.count <= a->head->count);
+        memset(&a->head->data[m.count], 0, a->head->count - m.count);
+        a->head->count = m.count;
+    }
+}
+
+void arena_reset(Arena *a) {
+    arena_rewind(a, (ArenaMark) {0});
+}
+
 // Temporary Allocator
-static char   temp_data[16 * 1000 * 1000];
-static size_t temp_count;
+static _Thread_local Arena temp_arena;
 
 void *temp_alloc(size_t n) {
-    assert(temp_count + n <= len(temp_data));
-    char *result = &temp_data[temp_count];
-    temp_count += n;
-    return result;
+    return arena_alloc(&temp_arena, n);
 }
 
 char *temp_sprintf(const char *fmt, ...) {
@@ -67,104 +244,192 @@ char *temp_sv_to_cstr(SV sv) {
     return p;
 }
 
-void temp_remove_null(void) {
-    if (temp_count && temp_data[temp_count - 1] == '\0') {
-        temp_count--;
-    }
+ArenaMark temp_save(void) {
+    return arena_mark(&temp_arena);
 }
 
-// Arena Allocator
-#define ARENA_MINIMUM_CAPACITY 16000
-
-struct ArenaRegion {
-    ArenaRegion *next;
-    size_t       count;
-    size_t       capacity;
-    char         data[];
-};
+void temp_restore(ArenaMark m) {
+    arena_rewind(&temp_arena, m);
+}
 
-void arena_free(Arena *a) {
-    ArenaRegion *it = a->head;
-    while (it) {
-        ArenaRegion *next = it->next;
-        free(it);
-        it = next;
-    }
+void temp_free(void) {
+    arena_free(&temp_arena);
 }
 
-void *arena_alloc(Arena *a, size_t size) {
-    ArenaRegion *region = NULL;
-    for (ArenaRegion *it = a->head; it; it = it->next) {
-        if (it->count + size <= it->capacity) {
-            region = it;
+// OS
+static bool read_fd(File *out, int fd) {
+    struct {
+        char  *data;
+        size_t count;
+        size_t capacity;
+    } buffer = {0};
+
+    while (true) {
+        da_grow(&buffer, 4096);
+
+        const ssize_t n = read(fd, buffer.data + buffer.count, buffer.capacity - buffer.count);
+        if (n < 0) {
+            free(buffer.data);
+            return false;
+        }
+
+        if (!n) {
             break;
         }
+        buffer.count += n;
     }
 
-    size = (size + 7) & -8; // Alignment
-    if (!region) {
-        size_t capacity = size;
-        if (capacity < ARENA_MINIMUM_CAPACITY) {
-            capacity = ARENA_MINIMUM_CAPACITY;
-        }
+    out->sv = (SV) {.data = buffer.data, .count = buffer.count};
+    out->mapped = false;
+    return true;
+}
 
-        region = malloc(sizeof(ArenaRegion) + capacity);
-        region->next = a->head;
-        region->count = 0;
-        region->capacity = capacity;
-        a->head = region;
+bool read_file(File *out, const char *path) {
+    if (!strcmp(path, "-")) {
+        return read_fd(out, STDIN_FILENO);
     }
 
-    void *ptr = &region->data[region->count];
-    memset(ptr, 0, size);
-    region->count += size;
-    return ptr;
-}
+    bool result = true;
 
-// OS
-bool read_file(SV *out, const char *path) {
-    char *data = NULL;
-    bool  result = true;
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
 
-    FILE *f = fopen(path, "r");
-    if (!f) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
         return_defer(false);
     }
 
-    if (fseek(f, 0, SEEK_END)) {
-        return_defer(false);
+    // Mapping an empty file fails, so those go through the streaming path as well
+    if (!S_ISREG(st.st_mode) || !st.st_size) {
+        return_defer(read_fd(out, fd));
     }
 
-    const long count = ftell(f);
-    if (count < 0) {
-        return_defer(false);
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return_defer(read_fd(out, fd));
     }
-    rewind(f);
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
 
-    data = malloc(count);
-    if (!data) {
-        return_defer(false);
+    out->sv = (SV) {.data = data, .count = st.st_size};
+    out->mapped = true;
+
+defer:
+    close(fd);
+    return result;
+}
+
+void free_file(File *f) {
+    if (f->mapped) {
+        munmap((void *) f->sv.data, f->sv.count);
+    } else {
+        free((void *) f->sv.data);
+    }
+    memset(f, 0, sizeof(*f));
+}
+
+bool copy_fd(int from, const char *to) {
+    bool result = true;
+    int  out = -1;
+
+    struct stat st;
+    if (fstat(from, &st) < 0) {
+        return false;
     }
 
-    if (fread(data, 1, count, f) != (size_t) count) {
+    unlink(to);
+    out = open(to, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (out < 0) {
         return_defer(false);
     }
 
-    out->data = data;
-    out->count = count;
+    char buffer[64 * 1024];
+    while (true) {
+        const ssize_t n = read(from, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            return_defer(false);
+        }
+
+        if (!n) {
+            break;
+        }
+
+        for (ssize_t written = 0; written < n;) {
+            const ssize_t m = write(out, buffer + written, n - written);
+            if (m < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (m < 0) {
+                return_defer(false);
+            }
+            written += m;
+        }
+    }
 
 defer:
-    if (f) {
-        fclose(f);
+    if (out >= 0 && close(out) < 0) {
+        result = false;
     }
+    return result;
+}
 
-    if (!result) {
-        free(data);
+bool copy_file(const char *from, const char *to) {
+    const int in = open(from, O_RDONLY);
+    if (in < 0) {
+        return false;
     }
 
+    const bool result = copy_fd(in, to);
+    close(in);
     return result;
 }
 
+static bool executable_stat(struct stat *st) {
+#ifdef __APPLE__
+    char     path[PATH_MAX];
+    uint32_t size = sizeof(path);
+    return !_NSGetExecutablePath(path, &size) && !stat(path, st);
+#else
+    return !stat("/proc/self/exe", st);
+#endif
+}
+
+// Rebuilding the compiler changes its executable, which is cheaper to stat than to hash
+bool compiler_identity(uint64_t *out) {
+    struct {
+        dev_t           dev;
+        ino_t           ino;
+        off_t           size;
+        struct timespec mtime;
+        char            machine[sizeof(((struct utsname *) 0)->machine)];
+    } id;
+    memset(&id, 0, sizeof(id));
+
+    struct stat st;
+    if (!executable_stat(&st)) {
+        return false;
+    }
+
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = st.st_size;
+    id.mtime = stat_mtime(&st);
+
+    struct utsname u;
+    if (!uname(&u)) {
+        memcpy(id.machine, u.machine, sizeof(id.machine));
+    }
+
+    *out = hash_bytes(&id, sizeof(id));
+    return true;
+}
+
 int cmd_run(Cmd *c) {
     pid_t pid = fork();
     if (pid < 0) {
@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -74,24 +75,77 @@ bool sv_has_suffix(SV a, SV b);
 SV sv_from_cstr(const char *cstr);
 SV sv_strip_suffix(SV a, SV b);
 
-// Temporary Allocator
-void *temp_alloc(size_t n);
-char *temp_sprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
-char *temp_sv_to_cstr(SV sv);
-void  temp_remove_null(void);
+// Hash
+uint64_t hash_bytes(const void *data, size_t count);
 
 // Arena Allocator
 typedef struct ArenaRegion ArenaRegion;
 
 typedef struct {
-    ArenaRegion *head;
+    size_t requested; // Bytes asked for by callers
+    size_t reserved;  // Bytes mapped for regions, headers included
+    size_t regions;
+    size_t waste; // Bytes left unused at the end of regions that were retired
+} ArenaStats;
+
+typedef struct {
+    ArenaRegion *head;  // Allocations bump into the head, the rest are full
+    ArenaRegion *large; // Oversized allocations, one region each
+    ArenaRegion *spare; // Zeroed regions left over from a rewind, reused before mapping new ones
+
+    size_t next; // Capacity of the next region, doubled on every growth
+    bool   huge; // Ask for huge pages on regions large enough to use them
+
+    ArenaStats stats;
 } Arena;
 
+typedef struct {
+    ArenaRegion *head;
+    ArenaRegion *large;
+    size_t       count;
+} ArenaMark;
+
 void  arena_free(Arena *a);
 void *arena_alloc(Arena *a, size_t size);
 
+ArenaMark arena_mark(const Arena *a);
+void      arena_rewind(Arena *a, ArenaMark m);
+void      arena_reset(Arena *a);
+
+// Temporary Allocator
+// Every thread has its own scratch arena. Phases release what they allocated by restoring a mark taken on entry.
+void *temp_alloc(size_t n);
+char *temp_sprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+char *temp_sv_to_cstr(SV sv);
+
+ArenaMark temp_save(void);
+void      temp_restore(ArenaMark m);
+void      temp_free(void);
+
 // OS
-bool read_file(SV *out, const char *path);
+typedef struct {
+    SV   sv;
+    bool mapped;
+} File;
+
+// Regular files are mapped read-only, anything else (pipes, terminals, "-" for stdin) is read into memory
+bool read_file(File *out, const char *path);
+void free_file(File *f);
+
+// Replaces 'to' with a new file, so anything still running the old one is left alone
+bool copy_file(const char *from, const char *to);
+bool copy_fd(int from, const char *to);
+
+// Modification time of a 'struct stat' as a 'struct timespec', which macOS names differently
+#ifdef __APPLE__
+#    define stat_mtime(st) ((st)->st_mtimespec)
+#else
+#    define stat_mtime(st) ((st)->st_mtim)
+#endif
+
+// Hash of the running compiler and the machine it targets, which decides what a source compiles to along with the
+// source itself. Fails if the executable cannot be found, since other builds of the compiler would then look the same.
+bool compiler_identity(uint64_t *out);
 
 typedef struct {
     const char **data;
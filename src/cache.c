@@ -0,0 +1,241 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define CACHE_DEFAULT_SIZE_MB 512
+
+static const char *cache_dir(void) {
+    const char *dir = getenv("XDG_CACHE_HOME");
+    if (dir && *dir) {
+        return temp_sprintf("%s/glos", dir);
+    }
+
+    const char *home = getenv("HOME");
+    if (home && *home) {
+        return temp_sprintf("%s/.cache/glos", home);
+    }
+    return NULL;
+}
+
+static bool make_dirs(const char *path) {
+    char *copy = temp_sprintf("%s", path);
+    for (char *it = copy + 1; *it; it++) {
+        if (*it == '/') {
+            *it = '\0';
+            mkdir(copy, 0755);
+            *it = '/';
+        }
+    }
+
+    struct stat st;
+    return (!mkdir(copy, 0755) || errno == EEXIST) && !stat(copy, &st) && S_ISDIR(st.st_mode);
+}
+
+static size_t cache_limit(void) {
+    const char *size = getenv("GLOS_CACHE_SIZE");
+    if (size) {
+        char         *end = NULL;
+        const size_t mb = strtoul(size, &end, 10);
+        if (*size && !*end) {
+            return mb * 1024 * 1024;
+        }
+    }
+    return (size_t) CACHE_DEFAULT_SIZE_MB * 1024 * 1024;
+}
+
+// The name is part of the key, as it ends up in the debug info of the program
+bool cache_open(Cache *c, const char *name, SV source) {
+    uint64_t identity = 0;
+    if (!compiler_identity(&identity)) {
+        return false;
+    }
+
+    c->dir = cache_dir();
+    if (!c->dir || !make_dirs(c->dir)) {
+        return false;
+    }
+
+    const uint64_t meta[] = {hash_bytes(name, strlen(name)), identity};
+    c->path = temp_sprintf("%s/%016llx%016llx-%zx", c->dir, (unsigned long long) hash_bytes(source.data, source.count),
+                           (unsigned long long) hash_bytes(meta, sizeof(meta)), source.count);
+    return true;
+}
+
+bool cache_fetch(const Cache *c, const char *output) {
+    const int fd = open(c->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    futimens(fd, NULL);
+    const bool ok = copy_fd(fd, output);
+    close(fd);
+    return ok;
+}
+
+typedef struct {
+    char           *path;
+    off_t           size;
+    struct timespec used;
+} Entry;
+
+typedef struct {
+    Entry *data;
+    size_t count;
+    size_t capacity;
+
+    size_t size;
+} Entries;
+
+// Stores still being written by another process are left alone until they are this old, after which they are taken
+// for what a crashed process left behind
+#define CACHE_STORE_TIMEOUT_S 600
+
+// Everything but the lock and the stores in flight counts
+static void entries_collect(Entries *es, const char *dir) {
+    const time_t now = time(NULL);
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        return;
+    }
+
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..") || !strcmp(e->d_name, "lock")) {
+            continue;
+        }
+
+        const char *path = temp_sprintf("%s/%s", dir, e->d_name);
+
+        struct stat st;
+        if (lstat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        if (!strncmp(e->d_name, "tmp-", 4) && now - stat_mtime(&st).tv_sec < CACHE_STORE_TIMEOUT_S) {
+            continue;
+        }
+
+        const Entry entry = {.path = (char *) path, .size = st.st_size, .used = stat_mtime(&st)};
+        da_push(es, entry);
+        es->size += st.st_size;
+    }
+    closedir(d);
+}
+
+static int entry_compare(const void *a, const void *b) {
+    const struct timespec *x = &((const Entry *) a)->used;
+    const struct timespec *y = &((const Entry *) b)->used;
+    if (x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+// Only one process scans the cache at a time. Those which cannot get the lock at once skip eviction, as the holder
+// is doing it for them.
+static int cache_lock(const char *dir, bool wait) {
+    const int fd = open(temp_sprintf("%s/lock", dir), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0 && flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void cache_evict(const char *dir) {
+    const int lock = cache_lock(dir, false);
+    if (lock < 0) {
+        return;
+    }
+
+    Entries es = {0};
+    entries_collect(&es, dir);
+
+    const size_t limit = cache_limit();
+    if (es.size > limit) {
+        qsort(es.data, es.count, sizeof(*es.data), entry_compare);
+        for (size_t i = 0; i < es.count && es.size > limit; i++) {
+            if (!unlink(es.data[i].path)) {
+                es.size -= es.data[i].size;
+            }
+        }
+    }
+
+    da_free(&es);
+    close(lock);
+}
+
+void cache_store(const Cache *c, const char *program) {
+    char     *temp = temp_sprintf("%s/tmp-XXXXXX", c->dir);
+    const int fd = mkstemp(temp);
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+
+    if (!copy_file(program, temp) || rename(temp, c->path) < 0) {
+        unlink(temp);
+        return;
+    }
+    cache_evict(c->dir);
+}
+
+static void cache_stats(const char *dir) {
+    Entries es = {0};
+    entries_collect(&es, dir);
+
+    printf("Directory: %s\n", dir);
+    printf("Entries:   %zu\n", es.count);
+    printf("Size:      %.1f of %.1f MiB\n", es.size / 1048576.0, cache_limit() / 1048576.0);
+    da_free(&es);
+}
+
+static int cache_clear(const char *dir) {
+    const int lock = cache_lock(dir, true);
+    if (lock < 0) {
+        fprintf(stderr, "ERROR: Could not lock the cache in '%s'\n", dir);
+        return 1;
+    }
+
+    Entries es = {0};
+    entries_collect(&es, dir);
+
+    size_t cleared = 0;
+    for (size_t i = 0; i < es.count; i++) {
+        cleared += !unlink(es.data[i].path);
+    }
+    printf("Cleared %zu entries\n", cleared);
+
+    const bool ok = cleared == es.count;
+    da_free(&es);
+    close(lock);
+    return ok ? 0 : 1;
+}
+
+int cache_command(const char *action) {
+    const char *dir = cache_dir();
+    if (!dir || !make_dirs(dir)) {
+        fprintf(stderr, "ERROR: No cache directory, set $XDG_CACHE_HOME or $HOME\n");
+        return 1;
+    }
+
+    if (!strcmp(action, "stats")) {
+        cache_stats(dir);
+        return 0;
+    }
+
+    if (!strcmp(action, "clear")) {
+        return cache_clear(dir);
+    }
+
+    fprintf(stderr, "ERROR: Invalid cache action '%s', expected 'stats' or 'clear'\n", action);
+    return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "basic.h"
+
+// Built programs are kept in $XDG_CACHE_HOME/glos, named by a hash of their source, its name and the compiler. Entries
+// are published with a rename and touched on every hit, so any number of processes can share the cache, and the
+// least recently used ones go once it grows past $GLOS_CACHE_SIZE MiB.
+typedef struct {
+    const char *dir;
+    const char *path; // Entry of the program
+} Cache;
+
+// Returns false if there is no usable cache, or the running compiler cannot be told apart from other builds of it
+bool cache_open(Cache *c, const char *name, SV source);
+
+// Copies the entry to 'output' if it exists, in which case it becomes the most recently used. The entry is read
+// through one open descriptor, so another process evicting it meanwhile does not get in the way.
+bool cache_fetch(const Cache *c, const char *output);
+
+// Copies a freshly built program into the cache, evicting whatever no longer fits
+void cache_store(const Cache *c, const char *program);
+
+// Handles 'glos cache stats' and 'glos cache clear'
+int cache_command(const char *action);
+
+#endif // CACHE_H
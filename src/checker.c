@@ -1,110 +1,109 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
 #include "checker.h"
 
-static Type type_assert(Node *n, Type expected) {
-    if (type_eq(n->type, expected)) {
+static Type type_assert(Context *c, NodeId id, Type expected) {
+    const Node *n = ast_node(c->ast, id);
+    if (n->type == expected) {
         return n->type;
     }
 
-    fprintf(
-        stderr,
-        PosFmt "ERROR: Expected type '%s', got '%s'\n",
-        PosArg(n->token.pos),
-        type_to_cstr(expected),
-        type_to_cstr(n->type));
-
-    exit(1);
+    context_fail(c, n->offset, "Expected type '%s', got '%s'", type_to_cstr(expected), type_to_cstr(n->type));
 }
 
-static Type type_assert_node(Node *a, Node *b) {
-    if (type_eq(a->type, b->type)) {
-        return a->type;
-    }
-
-    fprintf(
-        stderr,
-        PosFmt "ERROR: Expected type '%s', got '%s'\n",
-        PosArg(a->token.pos),
-        type_to_cstr(b->type),
-        type_to_cstr(a->type));
-
-    exit(1);
+static Type type_assert_node(Context *c, NodeId a, NodeId b) {
+    return type_assert(c, a, ast_node(c->ast, b)->type);
 }
 
-static Type type_assert_arith(const Node *n) {
+static Type type_assert_arith(Context *c, NodeId id) {
+    const Node *n = ast_node(c->ast, id);
     if (type_is_integer(n->type)) {
         return n->type;
     }
 
-    fprintf(stderr, PosFmt "ERROR: Expected arithmetic type, got '%s'\n", PosArg(n->token.pos), type_to_cstr(n->type));
-    exit(1);
+    context_fail(c, n->offset, "Expected arithmetic type, got '%s'", type_to_cstr(n->type));
 }
 
-static Type type_assert_scalar(const Node *n) {
+static Type type_assert_scalar(Context *c, NodeId id) {
+    const Node *n = ast_node(c->ast, id);
     if (type_is_integer(n->type)) {
         return n->type;
     }
 
-    if (type_eq(n->type, (Type) {.kind = TYPE_BOOL})) {
+    if (n->type == TYPE_ID_BOOL) {
         return n->type;
     }
 
-    fprintf(stderr, PosFmt "ERROR: Expected scalar type, got '%s'\n", PosArg(n->token.pos), type_to_cstr(n->type));
-    exit(1);
+    context_fail(c, n->offset, "Expected scalar type, got '%s'", type_to_cstr(n->type));
 }
 
-static void error_undefined(const Node *n, const char *label) {
-    fprintf(stderr, PosFmt "ERROR: Undefined %s '" SVFmt "'\n", PosArg(n->token.pos), label, SVArg(n->token.sv));
-    exit(1);
+static void error_undefined(Context *c, const Node *n, Symbol name, const char *label) {
+    context_fail(c, n->offset, "Undefined %s '" SVFmt "'", label, SVArg(symbol_sv(name)));
 }
 
-static Node *ident_find(Context *c, SV name) {
+static NodeId ident_find(Context *c, Symbol name) {
     if (c->fn.fn) {
-        Node *n = context_fn_find(c->fn, c->locals, name);
+        const NodeId n = context_fn_find(c->fn, &c->locals, name);
         if (n) {
             return n;
         }
     }
 
-    return scope_find(c->globals, name);
+    return context_global_find(c, name);
 }
 
-static Node *nodes_find(Nodes ns, SV name, Node *until) {
-    for (Node *it = ns.head; it && it != until; it = it->next) {
-        if (sv_eq(it->token.sv, name)) {
-            return it;
-        }
+// The signature of a function whose arguments and return type have been checked
+static Type fn_signature(Context *c, const NodeFn *fn) {
+    const ArenaMark temp = temp_save();
+
+    Type         *args = temp_alloc(fn->args.count * sizeof(*args));
+    const NodeId *ids = ast_list(c->ast, fn->args);
+    for (size_t i = 0; i < fn->args.count; i++) {
+        args[i] = ast_node(c->ast, ids[i])->type;
     }
 
-    return NULL;
+    Type ret = TYPE_ID_UNIT;
+    if (fn->ret) {
+        ret = ast_node(c->ast, fn->ret)->type;
+    }
+
+    const Type type = type_fn(args, fn->args.count, ret);
+    temp_restore(temp);
+    return type;
 }
 
 static_assert(COUNT_NODES == 10, "");
-static void check_type(Node *n) {
-    if (!n) {
+static void check_type(Context *c, NodeId id) {
+    if (!id) {
         return;
     }
 
+    Node *n = ast_node(c->ast, id);
     switch (n->kind) {
-    case NODE_ATOM:
-        if (sv_match(n->token.sv, "bool")) {
-            n->type = (Type) {.kind = TYPE_BOOL};
-        } else if (sv_match(n->token.sv, "i64")) {
-            n->type = (Type) {.kind = TYPE_I64};
+    case NODE_ATOM: {
+        const Symbol name = ast_atom(c->ast, id)->as.symbol;
+        if (name == SYMBOL_BOOL) {
+            n->type = TYPE_ID_BOOL;
+        } else if (name == SYMBOL_I64) {
+            n->type = TYPE_ID_I64;
         } else {
-            error_undefined(n, "type");
+            error_undefined(c, n, name, "type");
         }
-        break;
+    } break;
 
     case NODE_FN: {
-        NodeFn *spec = (NodeFn *) n;
-        for (Node *it = spec->args.head; it; it = it->next) {
-            NodeVar *arg = (NodeVar *) it;
-            check_type(arg->type);
-            it->type = arg->type->type;
+        const NodeFn *spec = ast_fn(c->ast, id);
+        const NodeId *args = ast_list(c->ast, spec->args);
+        for (size_t i = 0; i < spec->args.count; i++) {
+            const NodeId type = ast_var(c->ast, args[i])->type;
+            check_type(c, type);
+            ast_node(c->ast, args[i])->type = ast_node(c->ast, type)->type;
         }
 
-        check_type(spec->ret);
-        n->type = (Type) {.kind = TYPE_FN, .spec = n};
+        check_type(c, spec->ret);
+        n->type = fn_signature(c, spec);
     } break;
 
     default:
@@ -112,45 +111,87 @@ static void check_type(Node *n) {
     }
 }
 
-static void check_fn(Context *c, Node *n);
+static void check_fn(Context *c, NodeId id);
+static void check_expr(Context *c, NodeId id, bool ref);
+
+static_assert(COUNT_TOKENS == 22, "");
+static bool is_arith(const Ast *ast, NodeId id) {
+    const Node *n = ast_node(ast, id);
+    if (n->kind != NODE_BINARY) {
+        return false;
+    }
+
+    switch (n->token) {
+    case TOKEN_ADD:
+    case TOKEN_SUB:
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Chains like 'a + b + c' nest to the left, so their left spine is walked with an explicit stack and only the right
+// operands are recursed into. Checks still happen in the same order as a recursive walk would do them.
+static void check_arith(Context *c, NodeId id) {
+    const size_t base = c->spine.count;
+    for (NodeId it = id; is_arith(c->ast, it); it = ast_binary(c->ast, it)->lhs) {
+        da_push(&c->spine, it);
+    }
+
+    check_expr(c, ast_binary(c->ast, c->spine.data[c->spine.count - 1])->lhs, false);
+    while (c->spine.count > base) {
+        const NodeId      it = c->spine.data[--c->spine.count];
+        const NodeBinary *binary = ast_binary(c->ast, it);
+
+        check_expr(c, binary->rhs, false);
+        type_assert_arith(c, binary->lhs);
+        ast_node(c->ast, it)->type = type_assert_node(c, binary->rhs, binary->lhs);
+    }
+}
 
 static_assert(COUNT_NODES == 10, "");
-static void check_expr(Context *c, Node *n, bool ref) {
-    if (!n) {
+static void check_expr(Context *c, NodeId id, bool ref) {
+    if (!id) {
         return;
     }
 
+    Node *n = ast_node(c->ast, id);
+
     bool allow_ref = false;
     switch (n->kind) {
     case NODE_ATOM: {
-        NodeAtom *atom = (NodeAtom *) n;
+        NodeAtom *atom = ast_atom(c->ast, id);
 
-        static_assert(COUNT_TOKENS == 21, "");
-        switch (n->token.kind) {
+        static_assert(COUNT_TOKENS == 22, "");
+        switch (n->token) {
         case TOKEN_INT:
-            n->type = (Type) {.kind = TYPE_I64};
+            n->type = TYPE_ID_I64;
             break;
 
         case TOKEN_BOOL:
-            n->type = (Type) {.kind = TYPE_BOOL};
+            n->type = TYPE_ID_BOOL;
             break;
 
-        case TOKEN_IDENT:
-            atom->definition = ident_find(c, n->token.sv);
+        case TOKEN_IDENT: {
+            atom->definition = ident_find(c, atom->as.symbol);
             if (!atom->definition) {
-                error_undefined(n, "identifier");
+                error_undefined(c, n, atom->as.symbol, "identifier");
             }
 
-            allow_ref = atom->definition->kind == NODE_VAR;
+            const Node *definition = ast_node(c->ast, atom->definition);
+            allow_ref = definition->kind == NODE_VAR;
             if (allow_ref && ref) {
-                NodeVar *var = (NodeVar *) atom->definition;
+                NodeVar *var = ast_var(c->ast, atom->definition);
                 if (var->kind == NODE_VAR_ARG) {
                     var->kind = NODE_VAR_LOCAL;
                 }
             }
 
-            n->type = atom->definition->type;
-            break;
+            n->type = definition->type;
+        } break;
 
         default:
             unreachable();
@@ -158,45 +199,42 @@ static void check_expr(Context *c, Node *n, bool ref) {
     } break;
 
     case NODE_CALL: {
-        NodeCall *call = (NodeCall *) n;
+        const NodeCall *call = ast_call(c->ast, id);
         check_expr(c, call->fn, false);
 
-        const Type fn_type = call->fn->type;
-        if (fn_type.kind != TYPE_FN) {
-            fprintf(
-                stderr, PosFmt "ERROR: Cannot call type '%s'\n", PosArg(call->fn->token.pos), type_to_cstr(fn_type));
-            exit(1);
+        const Type fn_type = ast_node(c->ast, call->fn)->type;
+        if (type_kind(fn_type) != TYPE_FN) {
+            context_fail(c, ast_node(c->ast, call->fn)->offset, "Cannot call type '%s'", type_to_cstr(fn_type));
         }
 
-        const NodeFn *expected = (const NodeFn *) fn_type.spec;
-        if (call->arity != expected->arity) {
-            fprintf(
-                stderr,
-                PosFmt "ERROR: Expected %zu argument%s, got %zu\n",
-                PosArg(n->token.pos),
-                expected->arity,
-                expected->arity == 1 ? "" : "s",
-                call->arity);
-
-            exit(1);
+        const size_t arity = type_arity(fn_type);
+        if (call->args.count != arity) {
+            context_fail(
+                c,
+                n->offset,
+                "Expected %zu argument%s, got %u",
+                arity,
+                arity == 1 ? "" : "s",
+                call->args.count);
         }
 
-        for (Node *a = call->args.head, *e = expected->args.head; a; a = a->next, e = e->next) {
-            check_expr(c, a, false);
-            type_assert_node(a, e);
+        const NodeId *args = ast_list(c->ast, call->args);
+        for (size_t i = 0; i < call->args.count; i++) {
+            check_expr(c, args[i], false);
+            type_assert(c, args[i], type_arg(fn_type, i));
         }
 
-        n->type = node_fn_return_type(expected);
+        n->type = type_ret(fn_type);
     } break;
 
     case NODE_UNARY: {
-        NodeUnary *unary = (NodeUnary *) n;
+        const NodeUnary *unary = ast_unary(c->ast, id);
 
-        static_assert(COUNT_TOKENS == 21, "");
-        switch (n->token.kind) {
+        static_assert(COUNT_TOKENS == 22, "");
+        switch (n->token) {
         case TOKEN_SUB:
             check_expr(c, unary->operand, false);
-            n->type = type_assert_arith(unary->operand);
+            n->type = type_assert_arith(c, unary->operand);
             break;
 
         default:
@@ -205,25 +243,22 @@ static void check_expr(Context *c, Node *n, bool ref) {
     } break;
 
     case NODE_BINARY: {
-        NodeBinary *binary = (NodeBinary *) n;
+        const NodeBinary *binary = ast_binary(c->ast, id);
 
-        static_assert(COUNT_TOKENS == 21, "");
-        switch (n->token.kind) {
+        static_assert(COUNT_TOKENS == 22, "");
+        switch (n->token) {
         case TOKEN_ADD:
         case TOKEN_SUB:
         case TOKEN_MUL:
         case TOKEN_DIV:
-            check_expr(c, binary->lhs, false);
-            check_expr(c, binary->rhs, false);
-            type_assert_arith(binary->lhs);
-            n->type = type_assert_node(binary->rhs, binary->lhs);
+            check_arith(c, id);
             break;
 
         case TOKEN_SET:
             check_expr(c, binary->lhs, true);
             check_expr(c, binary->rhs, false);
-            type_assert_node(binary->rhs, binary->lhs);
-            n->type = (Type) {.kind = TYPE_UNIT};
+            type_assert_node(c, binary->rhs, binary->lhs);
+            n->type = TYPE_ID_UNIT;
             break;
 
         default:
@@ -232,7 +267,7 @@ static void check_expr(Context *c, Node *n, bool ref) {
     } break;
 
     case NODE_FN:
-        check_fn(c, n);
+        check_fn(c, id);
         break;
 
     default:
@@ -240,24 +275,24 @@ static void check_expr(Context *c, Node *n, bool ref) {
     }
 
     if (!allow_ref && ref) {
-        fprintf(stderr, PosFmt "ERROR: Cannot take reference to value not in memory\n", PosArg(n->token.pos));
-        exit(1);
+        context_fail(c, n->offset, "Cannot take reference to value not in memory");
     }
 }
 
-static void error_redefinition(const Node *n, const Node *previous, const char *label) {
-    fprintf(stderr, PosFmt "ERROR: Redefinition of %s '" SVFmt "'\n", PosArg(n->token.pos), label, SVArg(n->token.sv));
-    fprintf(stderr, PosFmt "NOTE: Defined here\n", PosArg(previous->token.pos));
-    exit(1);
+static _Noreturn void error_redefinition(Context *c, NodeId id, NodeId previous, Symbol name, const char *label) {
+    context_error(c, ast_node(c->ast, id)->offset, "Redefinition of %s '" SVFmt "'", label, SVArg(symbol_sv(name)));
+    diagnostics_note(c->error, ast_node(c->ast, previous)->offset, "Defined here");
+    longjmp(*c->bail, 1);
 }
 
 static_assert(COUNT_NODES == 10, "");
-static bool always_returns(Node *n) {
-    switch (n->kind) {
+static bool always_returns(const Ast *ast, NodeId id) {
+    switch (ast_node(ast, id)->kind) {
     case NODE_BLOCK: {
-        NodeBlock *block = (NodeBlock *) n;
-        for (Node *it = block->body.head; it; it = it->next) {
-            if (always_returns(it)) {
+        const NodeList body = ast_block(ast, id)->body;
+        const NodeId  *stmts = ast_list(ast, body);
+        for (size_t i = 0; i < body.count; i++) {
+            if (always_returns(ast, stmts[i])) {
                 return true;
             }
         }
@@ -265,11 +300,19 @@ static bool always_returns(Node *n) {
     }
 
     case NODE_IF: {
-        NodeIf *iff = (NodeIf *) n;
+        // Else-if ladders are followed in a loop
+        const NodeIf *iff = ast_if(ast, id);
+        while (iff->antecedence && ast_node(ast, iff->antecedence)->kind == NODE_IF) {
+            if (!always_returns(ast, iff->consequence)) {
+                return false;
+            }
+            iff = ast_if(ast, iff->antecedence);
+        }
+
         if (!iff->antecedence) {
             return false;
         }
-        return always_returns(iff->consequence) && always_returns(iff->antecedence);
+        return always_returns(ast, iff->consequence) && always_returns(ast, iff->antecedence);
     }
 
     case NODE_RETURN:
@@ -281,139 +324,316 @@ static bool always_returns(Node *n) {
 }
 
 static_assert(COUNT_NODES == 10, "");
-static void check_stmt(Context *c, Node *n) {
-    if (!n) {
+static void check_stmt(Context *c, NodeId id) {
+    if (!id) {
         return;
     }
 
+    Node *n = ast_node(c->ast, id);
     switch (n->kind) {
     case NODE_IF: {
-        NodeIf *iff = (NodeIf *) n;
-        check_expr(c, iff->condition, false);
-        type_assert(iff->condition, (Type) {.kind = TYPE_BOOL});
-
-        check_stmt(c, iff->consequence);
-        check_stmt(c, iff->antecedence);
+        // Else-if ladders are followed in a loop, only the final 'else' is recursed into
+        NodeId it = id;
+        while (it && ast_node(c->ast, it)->kind == NODE_IF) {
+            const NodeIf *iff = ast_if(c->ast, it);
+            check_expr(c, iff->condition, false);
+            type_assert(c, iff->condition, TYPE_ID_BOOL);
+
+            check_stmt(c, iff->consequence);
+            it = iff->antecedence;
+        }
+        check_stmt(c, it);
     } break;
 
     case NODE_BLOCK: {
         const size_t locals_count_save = c->locals.count;
 
-        NodeBlock *block = (NodeBlock *) n;
-        for (Node *it = block->body.head; it; it = it->next) {
-            check_stmt(c, it);
+        const NodeList body = ast_block(c->ast, id)->body;
+        const NodeId  *stmts = ast_list(c->ast, body);
+        for (size_t i = 0; i < body.count; i++) {
+            check_stmt(c, stmts[i]);
         }
 
-        c->locals.count = locals_count_save;
+        scope_pop(&c->locals, locals_count_save);
     } break;
 
     case NODE_RETURN: {
-        NodeReturn *ret = (NodeReturn *) n;
+        const NodeReturn *ret = ast_return(c->ast, id);
 
-        n->type = (Type) {.kind = TYPE_UNIT};
+        n->type = TYPE_ID_UNIT;
         if (ret->value) {
             check_expr(c, ret->value, false);
-            n->type = ret->value->type;
+            n->type = ast_node(c->ast, ret->value)->type;
         }
 
-        type_assert(n, node_fn_return_type(c->fn.fn));
+        type_assert(c, id, type_ret(ast_node(c->ast, c->fn.fn)->type));
     } break;
 
     case NODE_FN:
-        check_fn(c, n);
+        check_fn(c, id);
         break;
 
     case NODE_VAR: {
-        NodeVar *var = (NodeVar *) n;
+        const NodeVar *var = ast_var(c->ast, id);
         if (var->kind == NODE_VAR_GLOBAL) {
-            const Node *previous = scope_find(c->globals, n->token.sv);
+            const NodeId previous = scope_find(&c->globals, var->name);
             if (previous) {
-                error_redefinition(n, previous, "identifier");
+                error_redefinition(c, id, previous, var->name, "identifier");
             }
         }
 
         if (var->type) {
-            check_type(var->type);
-            n->type = var->type->type;
+            check_type(c, var->type);
+            n->type = ast_node(c->ast, var->type)->type;
         }
 
         if (var->expr) {
             check_expr(c, var->expr, false);
-            n->type = var->expr->type;
+            n->type = ast_node(c->ast, var->expr)->type;
 
-            if (n->type.kind == TYPE_UNIT) {
-                fprintf(
-                    stderr,
-                    PosFmt "ERROR: Cannot define variable with type '%s'\n",
-                    PosArg(n->token.pos),
-                    type_to_cstr(n->type));
-
-                exit(1);
+            if (n->type == TYPE_ID_UNIT) {
+                context_fail(c, n->offset, "Cannot define variable with type '%s'", type_to_cstr(n->type));
             }
 
             if (var->type) {
-                type_assert(var->expr, var->type->type);
-                n->type = var->expr->type;
+                type_assert(c, var->expr, ast_node(c->ast, var->type)->type);
+                n->type = ast_node(c->ast, var->expr)->type;
             }
         }
 
         if (var->kind == NODE_VAR_GLOBAL) {
-            da_push(&c->globals, n);
+            scope_push(&c->globals, var->name, id);
         } else {
-            da_push(&c->locals, n);
+            scope_push(&c->locals, var->name, id);
         }
     } break;
 
     case NODE_PRINT: {
-        NodePrint *print = (NodePrint *) n;
+        const NodePrint *print = ast_print(c->ast, id);
         check_expr(c, print->operand, false);
-        type_assert_scalar(print->operand);
+        type_assert_scalar(c, print->operand);
     } break;
 
     default:
-        check_expr(c, n, false);
+        check_expr(c, id, false);
         break;
     }
 }
 
-static void check_fn(Context *c, Node *n) {
-    NodeFn *fn = (NodeFn *) n;
-    if (fn->local) {
-        da_push(&c->locals, n);
+// Declares the function and checks everything but its body
+static void check_fn_signature(Context *c, NodeId id) {
+    const NodeFn *fn = ast_fn(c->ast, id);
+    if (fn->name == SYMBOL_NONE) {
+        // Literals are only reached through the expression they are in
+    } else if (fn->local) {
+        scope_push(&c->locals, fn->name, id);
     } else {
-        const Node *previous = scope_find(c->globals, n->token.sv);
+        const NodeId previous = scope_find(&c->globals, fn->name);
         if (previous) {
-            error_redefinition(n, previous, "identifier");
+            error_redefinition(c, id, previous, fn->name, "identifier");
         }
-        da_push(&c->globals, n);
+        scope_push(&c->globals, fn->name, id);
     }
-    n->type = (Type) {.kind = TYPE_FN, .spec = n};
 
-    const ContextFn context_fn_save = context_fn_begin(c, fn);
-    for (Node *it = fn->args.head; it; it = it->next) {
-        if (it->token.kind == TOKEN_IDENT) {
-            const Node *previous = nodes_find(fn->args, it->token.sv, it);
-            if (previous) {
-                error_redefinition(it, previous, "argument");
+    const NodeId *args = ast_list(c->ast, fn->args);
+    for (size_t i = 0; i < fn->args.count; i++) {
+        const NodeVar *arg = ast_var(c->ast, args[i]);
+        for (size_t j = 0; j < i; j++) {
+            if (ast_var(c->ast, args[j])->name == arg->name) {
+                error_redefinition(c, args[i], args[j], arg->name, "argument");
             }
         }
 
-        check_stmt(c, it);
+        check_type(c, arg->type);
+        ast_node(c->ast, args[i])->type = ast_node(c->ast, arg->type)->type;
+    }
+
+    check_type(c, fn->ret);
+    ast_node(c->ast, id)->type = fn_signature(c, fn);
+}
+
+static void check_fn_body(Context *c, NodeId id) {
+    const NodeFn   *fn = ast_fn(c->ast, id);
+    const ContextFn context_fn_save = context_fn_begin(c, id);
+
+    const NodeId *args = ast_list(c->ast, fn->args);
+    for (size_t i = 0; i < fn->args.count; i++) {
+        scope_push(&c->locals, ast_var(c->ast, args[i])->name, args[i]);
     }
 
-    check_type(fn->ret);
     check_stmt(c, fn->body);
 
-    if (fn->ret && !always_returns(fn->body)) {
-        fprintf(stderr, PosFmt "ERROR: Expected return statement\n", PosArg(fn->body->token.pos));
-        exit(1);
+    if (fn->ret && !always_returns(c->ast, fn->body)) {
+        context_fail(c, ast_node(c->ast, fn->body)->offset, "Expected return statement");
     }
 
     context_fn_end(c, context_fn_save);
 }
 
-void check_nodes(Context *c, Nodes ns) {
-    for (Node *it = ns.head; it; it = it->next) {
-        check_stmt(c, it);
+static void check_fn(Context *c, NodeId id) {
+    check_fn_signature(c, id);
+    check_fn_body(c, id);
+}
+
+// Runs one check, catching its error in c->error
+static bool check_guarded(Context *c, void (*check)(Context *, NodeId), NodeId id) {
+    jmp_buf *outer = c->bail;
+
+    jmp_buf bail;
+    c->bail = &bail;
+    if (setjmp(bail)) {
+        c->bail = outer;
+        return false;
+    }
+
+    check(c, id);
+    c->bail = outer;
+    return true;
+}
+
+#define CHECK_BODIES_PER_WORKER 16
+
+typedef struct {
+    NodeId fn;
+    size_t item;    // Index of the top-level statement
+    size_t horizon; // Globals declared up to and including the function
+} Body;
+
+typedef struct {
+    const Context *context;
+
+    const Body *data;
+    size_t      count;
+
+    atomic_size_t next;
+    Diagnostics **errors; // Indexed by item
+} Bodies;
+
+// Bodies only read the globals, so every worker shares them and keeps its own locals
+static void *check_bodies_worker(void *arg) {
+    Bodies *bodies = arg;
+    Context c = {.ast = bodies->context->ast, .globals = bodies->context->globals};
+
+    while (true) {
+        const size_t i = atomic_fetch_add(&bodies->next, 1);
+        if (i >= bodies->count) {
+            break;
+        }
+
+        const Body *it = &bodies->data[i];
+        c.horizon = it->horizon;
+        if (!check_guarded(&c, check_fn_body, it->fn)) {
+            bodies->errors[it->item] = c.error;
+            scope_pop(&c.locals, 0);
+            c.spine.count = 0;
+            c.fn = (ContextFn) {0};
+        }
+    }
+
+    da_free(&c.locals.innermost);
+    da_free(&c.locals);
+    da_free(&c.spine);
+    return NULL;
+}
+
+// Threads of their own release their scratch arena, the calling thread keeps it
+static void *check_bodies_thread(void *arg) {
+    check_bodies_worker(arg);
+    temp_free();
+    return NULL;
+}
+
+static void check_bodies(Bodies *bodies) {
+    size_t workers = (bodies->count + CHECK_BODIES_PER_WORKER - 1) / CHECK_BODIES_PER_WORKER;
+
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && workers > (size_t) cpus) {
+        workers = cpus;
+    }
+
+    if (workers <= 1) {
+        check_bodies_worker(bodies);
+        return;
     }
+
+    pthread_t *threads = malloc(workers * sizeof(*threads));
+    assert(threads);
+
+    size_t started = 0;
+    while (started < workers && !pthread_create(&threads[started], NULL, check_bodies_thread, bodies)) {
+        started++;
+    }
+
+    // Whatever could not get a thread of its own is picked up here
+    check_bodies_worker(bodies);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+// Globals are declared in order first, which also checks variable initializers and function signatures. Function
+// bodies only depend on what was declared before them, so they are checked afterwards in parallel. Only the first
+// error in source order is reported, exactly as a single pass would.
+bool check_nodes(Context *c, NodeList ns) {
+    const NodeId *items = ast_list(c->ast, ns);
+
+    Diagnostics **errors = calloc(ns.count, sizeof(*errors));
+    assert(errors || !ns.count);
+
+    struct {
+        Body  *data;
+        size_t count;
+        size_t capacity;
+    } bodies = {0};
+
+    c->horizon = SIZE_MAX;
+    for (size_t i = 0; i < ns.count; i++) {
+        const NodeId it = items[i];
+        if (ast_node(c->ast, it)->kind != NODE_FN) {
+            if (!check_guarded(c, check_stmt, it)) {
+                errors[i] = c->error;
+                break;
+            }
+            continue;
+        }
+
+        if (!check_guarded(c, check_fn_signature, it)) {
+            errors[i] = c->error;
+            break;
+        }
+
+        const Body body = {.fn = it, .item = i, .horizon = c->globals.count};
+        da_push(&bodies, body);
+    }
+
+    Bodies work = {
+        .context = c,
+        .data = bodies.data,
+        .count = bodies.count,
+        .errors = errors,
+    };
+    check_bodies(&work);
+
+    Diagnostics *error = NULL;
+    for (size_t i = 0; i < ns.count; i++) {
+        if (!error) {
+            error = errors[i];
+        } else {
+            diagnostics_free(errors[i]);
+        }
+    }
+
+    da_free(&bodies);
+    free(errors);
+
+    c->error = error;
+    return !error;
+}
+
+// Checks one top-level statement against everything declared before it
+bool check_decl(Context *c, NodeId id) {
+    c->horizon = SIZE_MAX;
+    return check_guarded(c, check_stmt, id);
 }
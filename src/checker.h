@@ -3,6 +3,8 @@
 
 #include "context.h"
 
-void check_nodes(Context *c, Nodes ns);
+// Both return false on the first error, leaving it in c->error
+bool check_nodes(Context *c, NodeList ns);
+bool check_decl(Context *c, NodeId id);
 
 #endif // CHECKER_H
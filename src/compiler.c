@@ -1,64 +1,142 @@
-#include "compiler.h"
-#include "qbe.h"
-
-typedef struct {
-    Qbe   *qbe;
-    QbeFn *fn;
-} Compiler;
+#include <pthread.h>
 
-static_assert(COUNT_NODES == 10, "");
-static void compile_type(Type *type) {
-    if (!type) {
-        return;
-    }
+#include "compiler.h"
 
-    switch (type->kind) {
+static_assert(COUNT_TYPES == 4, "");
+static QbeType lower_type(Type type) {
+    switch (type_kind(type)) {
     case TYPE_UNIT:
-        type->qbe = qbe_type_basic(QBE_TYPE_I0);
-        break;
+        return qbe_type_basic(QBE_TYPE_I0);
 
     case TYPE_BOOL:
-        type->qbe = qbe_type_basic(QBE_TYPE_I8);
-        break;
+        return qbe_type_basic(QBE_TYPE_I8);
 
     case TYPE_I64:
-        type->qbe = qbe_type_basic(QBE_TYPE_I64);
-        break;
+        return qbe_type_basic(QBE_TYPE_I64);
 
     case TYPE_FN:
-        type->qbe = qbe_type_basic(QBE_TYPE_I64);
-        break;
+        return qbe_type_basic(QBE_TYPE_I64);
 
     default:
         unreachable();
     }
 }
 
-static void compile_stmt(Compiler *c, Node *n);
+static QbeType compile_type(Compiler *c, Type type) {
+    while (c->types.count <= type) {
+        const QbeType lowered = lower_type(c->types.count);
+        da_push(&c->types, lowered);
+    }
+    return c->types.data[type];
+}
+
+static QbeSV qbe_name(const char *cstr) {
+    const SV sv = symbol_sv(symbol_intern(sv_from_cstr(cstr)));
+    return (QbeSV) {sv.data, sv.count};
+}
+
+// Globals of modules, and the declarations importing them, are named after the module. That is how the units of a
+// program find each other once they are lowered into one Qbe context. No identifier contains a dot, so these never
+// clash with anything else.
+static QbeSV global_name(Symbol module, Symbol name) {
+    const ArenaMark temp = temp_save();
+    const QbeSV     qsv = qbe_name(temp_sprintf(SVFmt "." SVFmt, SVArg(symbol_sv(module)), SVArg(symbol_sv(name))));
+    temp_restore(temp);
+    return qsv;
+}
+
+// Globals of a program lowered in pieces find each other across objects the same way. No module name is empty, so
+// the double dot keeps them apart from module globals.
+static QbeSV piece_name(Symbol name) {
+    const ArenaMark temp = temp_save();
+    const QbeSV     qsv = qbe_name(temp_sprintf("glos.." SVFmt, SVArg(symbol_sv(name))));
+    temp_restore(temp);
+    return qsv;
+}
+
+// Debug rows are looked up in the line table of the function being lowered, which was resolved once when lowering
+// of the function began, so statements take no lock
+static size_t compile_row(const Compiler *c, NodeId id) {
+    return source_lines_row(&c->lines, ast_node(c->ast, id)->offset);
+}
+
+static void     compile_stmt(Compiler *c, NodeId id);
+static QbeNode *compile_expr(Compiler *c, NodeId id, bool ref);
+
+static_assert(COUNT_TOKENS == 22, "");
+static bool arith_op(const Ast *ast, NodeId id, QbeBinaryOp *op) {
+    const Node *n = ast_node(ast, id);
+    if (n->kind != NODE_BINARY) {
+        return false;
+    }
+
+    switch (n->token) {
+    case TOKEN_ADD:
+        *op = QBE_BINARY_ADD;
+        return true;
+
+    case TOKEN_SUB:
+        *op = QBE_BINARY_SUB;
+        return true;
+
+    case TOKEN_MUL:
+        *op = QBE_BINARY_MUL;
+        return true;
+
+    case TOKEN_DIV:
+        *op = QBE_BINARY_SDIV;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// The left spine of a chain like 'a + b + c' is walked with an explicit stack, so only the right operands are
+// recursed into. Instructions come out in the same order as a recursive walk would emit them.
+static QbeNode *compile_arith(Compiler *c, NodeId id) {
+    const size_t base = c->spine.count;
+
+    QbeBinaryOp op;
+    for (NodeId it = id; arith_op(c->ast, it, &op); it = ast_binary(c->ast, it)->lhs) {
+        da_push(&c->spine, it);
+    }
+
+    QbeNode *lhs = compile_expr(c, ast_binary(c->ast, c->spine.data[c->spine.count - 1])->lhs, false);
+    while (c->spine.count > base) {
+        const NodeId it = c->spine.data[--c->spine.count];
+        arith_op(c->ast, it, &op);
+
+        QbeNode *rhs = compile_expr(c, ast_binary(c->ast, it)->rhs, false);
+        lhs = qbe_build_binary(c->qbe, c->fn, op, compile_type(c, ast_node(c->ast, it)->type), lhs, rhs);
+    }
+    return lhs;
+}
 
 static_assert(COUNT_NODES == 10, "");
-static QbeNode *compile_expr(Compiler *c, Node *n, bool ref) {
-    if (!n) {
+static QbeNode *compile_expr(Compiler *c, NodeId id, bool ref) {
+    if (!id) {
         return NULL;
     }
 
-    compile_type(&n->type);
+    const Node   *n = ast_node(c->ast, id);
+    const QbeType type = compile_type(c, n->type);
     switch (n->kind) {
     case NODE_ATOM: {
-        NodeAtom *atom = (NodeAtom *) n;
+        const NodeAtom *atom = ast_atom(c->ast, id);
 
-        static_assert(COUNT_TOKENS == 21, "");
-        switch (n->token.kind) {
+        static_assert(COUNT_TOKENS == 22, "");
+        switch (n->token) {
         case TOKEN_INT:
-            return qbe_atom_int(c->qbe, QBE_TYPE_I64, n->token.as.integer);
+            return qbe_atom_int(c->qbe, QBE_TYPE_I64, atom->as.integer);
 
         case TOKEN_BOOL:
-            return qbe_atom_int(c->qbe, QBE_TYPE_I64, n->token.as.boolean);
+            return qbe_atom_int(c->qbe, QBE_TYPE_I64, atom->as.boolean);
 
         case TOKEN_IDENT:
-            switch (atom->definition->kind) {
+            switch (ast_node(c->ast, atom->definition)->kind) {
             case NODE_FN: {
-                NodeFn *fn = (NodeFn *) atom->definition;
+                const NodeFn *fn = ast_fn(c->ast, atom->definition);
                 if (!fn->qbe) {
                     compile_stmt(c, atom->definition);
                 }
@@ -66,7 +144,7 @@ static QbeNode *compile_expr(Compiler *c, Node *n, bool ref) {
             };
 
             case NODE_VAR: {
-                NodeVar *var = (NodeVar *) atom->definition;
+                const NodeVar *var = ast_var(c->ast, atom->definition);
                 if (!var->qbe) {
                     compile_stmt(c, atom->definition);
                 }
@@ -75,7 +153,7 @@ static QbeNode *compile_expr(Compiler *c, Node *n, bool ref) {
                     return var->qbe;
                 }
 
-                return qbe_build_load(c->qbe, c->fn, var->qbe, n->type.qbe);
+                return qbe_build_load(c->qbe, c->fn, var->qbe, type);
             } break;
 
             default:
@@ -89,25 +167,26 @@ static QbeNode *compile_expr(Compiler *c, Node *n, bool ref) {
     } break;
 
     case NODE_CALL: {
-        NodeCall *call = (NodeCall *) n;
-        QbeNode  *fn = compile_expr(c, call->fn, false);
+        const NodeCall *call = ast_call(c->ast, id);
+        QbeNode        *fn = compile_expr(c, call->fn, false);
 
-        QbeCall *fn_call = qbe_build_call(c->qbe, c->fn, fn, n->type.qbe);
-        for (Node *it = call->args.head; it; it = it->next) {
-            qbe_call_add_arg(c->qbe, fn_call, compile_expr(c, it, false));
+        QbeCall      *fn_call = qbe_build_call(c->qbe, c->fn, fn, type);
+        const NodeId *args = ast_list(c->ast, call->args);
+        for (size_t i = 0; i < call->args.count; i++) {
+            qbe_call_add_arg(c->qbe, fn_call, compile_expr(c, args[i], false));
         }
 
         return (QbeNode *) fn_call;
     };
 
     case NODE_UNARY: {
-        NodeUnary *unary = (NodeUnary *) n;
+        const NodeUnary *unary = ast_unary(c->ast, id);
 
-        static_assert(COUNT_TOKENS == 21, "");
-        switch (n->token.kind) {
+        static_assert(COUNT_TOKENS == 22, "");
+        switch (n->token) {
         case TOKEN_SUB: {
             QbeNode *operand = compile_expr(c, unary->operand, false);
-            return qbe_build_unary(c->qbe, c->fn, QBE_UNARY_NEG, n->type.qbe, operand);
+            return qbe_build_unary(c->qbe, c->fn, QBE_UNARY_NEG, type, operand);
         }
 
         default:
@@ -116,33 +195,15 @@ static QbeNode *compile_expr(Compiler *c, Node *n, bool ref) {
     } break;
 
     case NODE_BINARY: {
-        NodeBinary *binary = (NodeBinary *) n;
+        const NodeBinary *binary = ast_binary(c->ast, id);
 
-        static_assert(COUNT_TOKENS == 21, "");
-        switch (n->token.kind) {
-        case TOKEN_ADD: {
-            QbeNode *lhs = compile_expr(c, binary->lhs, false);
-            QbeNode *rhs = compile_expr(c, binary->rhs, false);
-            return qbe_build_binary(c->qbe, c->fn, QBE_BINARY_ADD, n->type.qbe, lhs, rhs);
-        }
-
-        case TOKEN_SUB: {
-            QbeNode *lhs = compile_expr(c, binary->lhs, false);
-            QbeNode *rhs = compile_expr(c, binary->rhs, false);
-            return qbe_build_binary(c->qbe, c->fn, QBE_BINARY_SUB, n->type.qbe, lhs, rhs);
-        }
-
-        case TOKEN_MUL: {
-            QbeNode *lhs = compile_expr(c, binary->lhs, false);
-            QbeNode *rhs = compile_expr(c, binary->rhs, false);
-            return qbe_build_binary(c->qbe, c->fn, QBE_BINARY_MUL, n->type.qbe, lhs, rhs);
-        }
-
-        case TOKEN_DIV: {
-            QbeNode *lhs = compile_expr(c, binary->lhs, false);
-            QbeNode *rhs = compile_expr(c, binary->rhs, false);
-            return qbe_build_binary(c->qbe, c->fn, QBE_BINARY_SDIV, n->type.qbe, lhs, rhs);
-        }
+        static_assert(COUNT_TOKENS == 22, "");
+        switch (n->token) {
+        case TOKEN_ADD:
+        case TOKEN_SUB:
+        case TOKEN_MUL:
+        case TOKEN_DIV:
+            return compile_arith(c, id);
 
         case TOKEN_SET: {
             QbeNode *lhs = compile_expr(c, binary->lhs, true);
@@ -156,11 +217,9 @@ static QbeNode *compile_expr(Compiler *c, Node *n, bool ref) {
         }
     } break;
 
-    case NODE_FN: {
-        NodeFn *fn = (NodeFn *) n;
-        compile_stmt(c, n);
-        return fn->qbe;
-    }
+    case NODE_FN:
+        compile_stmt(c, id);
+        return ast_fn(c->ast, id)->qbe;
 
     default:
         unreachable();
@@ -168,110 +227,161 @@ static QbeNode *compile_expr(Compiler *c, Node *n, bool ref) {
 }
 
 static_assert(COUNT_NODES == 10, "");
-static void compile_stmt(Compiler *c, Node *n) {
-    if (!n) {
+static void compile_stmt(Compiler *c, NodeId id) {
+    if (!id) {
         return;
     }
 
+    const Node *n = ast_node(c->ast, id);
     switch (n->kind) {
     case NODE_IF: {
-        NodeIf *iff = (NodeIf *) n;
+        // Else-if ladders are followed in a loop. The end of every link is kept until the ladder is done, then each
+        // one jumps to the end of the link that contains it.
+        const size_t base = c->ends.count;
 
-        QbeBlock *consequence = qbe_block_new(c->qbe);
-        QbeBlock *antecedence = qbe_block_new(c->qbe);
+        NodeId it = id;
+        while (it && ast_node(c->ast, it)->kind == NODE_IF) {
+            const NodeIf *iff = ast_if(c->ast, it);
 
-        QbeBlock *end = antecedence;
-        if (iff->antecedence) {
-            end = qbe_block_new(c->qbe);
-        }
+            QbeBlock *consequence = qbe_block_new(c->qbe);
+            QbeBlock *antecedence = qbe_block_new(c->qbe);
 
-        // Condition
-        QbeNode *condition = compile_expr(c, iff->condition, false);
-        qbe_build_branch(c->qbe, c->fn, condition, consequence, antecedence);
+            QbeBlock *end = antecedence;
+            if (iff->antecedence) {
+                end = qbe_block_new(c->qbe);
+            }
+            da_push(&c->ends, end);
 
-        // Consequence
-        qbe_build_block(c->qbe, c->fn, consequence);
-        compile_stmt(c, iff->consequence);
-        qbe_build_jump(c->qbe, c->fn, end);
+            // Condition
+            QbeNode *condition = compile_expr(c, iff->condition, false);
+            qbe_build_branch(c->qbe, c->fn, condition, consequence, antecedence);
 
-        // Antecedence
-        if (iff->antecedence) {
-            qbe_build_block(c->qbe, c->fn, antecedence);
-            compile_stmt(c, iff->antecedence);
+            // Consequence
+            qbe_build_block(c->qbe, c->fn, consequence);
+            compile_stmt(c, iff->consequence);
             qbe_build_jump(c->qbe, c->fn, end);
+
+            // Antecedence
+            if (iff->antecedence) {
+                qbe_build_block(c->qbe, c->fn, antecedence);
+            }
+            it = iff->antecedence;
+        }
+
+        if (it) {
+            compile_stmt(c, it);
+            qbe_build_jump(c->qbe, c->fn, c->ends.data[c->ends.count - 1]);
         }
 
         // End
-        qbe_build_block(c->qbe, c->fn, end);
+        while (true) {
+            qbe_build_block(c->qbe, c->fn, c->ends.data[--c->ends.count]);
+            if (c->ends.count == base) {
+                break;
+            }
+            qbe_build_jump(c->qbe, c->fn, c->ends.data[c->ends.count - 1]);
+        }
     } break;
 
     case NODE_BLOCK: {
-        NodeBlock *block = (NodeBlock *) n;
-        for (Node *it = block->body.head; it; it = it->next) {
-            qbe_build_debug_line(c->qbe, c->fn, it->token.pos.row + 1);
-            compile_stmt(c, it);
+        const NodeList body = ast_block(c->ast, id)->body;
+        const NodeId  *stmts = ast_list(c->ast, body);
+        for (size_t i = 0; i < body.count; i++) {
+            qbe_build_debug_line(c->qbe, c->fn, compile_row(c, stmts[i]) + 1);
+            compile_stmt(c, stmts[i]);
         }
-        qbe_build_debug_line(c->qbe, c->fn, n->token.pos.row + 1);
+        qbe_build_debug_line(c->qbe, c->fn, compile_row(c, id) + 1);
     } break;
 
     case NODE_RETURN: {
-        NodeReturn *ret = (NodeReturn *) n;
+        const NodeReturn *ret = ast_return(c->ast, id);
         qbe_build_return(c->qbe, c->fn, compile_expr(c, ret->value, false));
         qbe_build_block(c->qbe, c->fn, qbe_block_new(c->qbe));
     } break;
 
     case NODE_FN: {
-        NodeFn *fn = (NodeFn *) n;
+        NodeFn *fn = ast_fn(c->ast, id);
+        if (fn->module) {
+            fn->qbe = qbe_atom_symbol(c->qbe, global_name(fn->module, fn->name), qbe_type_basic(QBE_TYPE_I64));
+            break;
+        }
+
+        const bool global = !fn->local && n->token == TOKEN_IDENT;
+        if (c->split && global && id != c->piece) {
+            fn->qbe = qbe_atom_symbol(c->qbe, piece_name(fn->name), qbe_type_basic(QBE_TYPE_I64));
+            da_push(&c->refs, id);
+            break;
+        }
+
+        QbeSV name = {0};
+        if (c->module && global) {
+            name = global_name(c->module, fn->name);
+        } else if (c->split && global) {
+            name = piece_name(fn->name);
+            da_push(&c->refs, id);
+        }
 
-        Type return_type = node_fn_return_type(fn);
-        compile_type(&return_type);
+        // Nested functions come from the same source as the one around them
+        if (!fn->local) {
+            c->lines = source_lines(n->offset);
+        }
 
         QbeFn *fn_save = c->fn;
-        c->fn = qbe_fn_new(c->qbe, (QbeSV) {0}, return_type.qbe);
+        c->fn = qbe_fn_new(c->qbe, name, compile_type(c, type_ret(n->type)));
         fn->qbe = (QbeNode *) c->fn;
 
-        for (Node *it = fn->args.head; it; it = it->next) {
-            NodeVar *arg = (NodeVar *) it;
-            compile_type(&it->type);
-            arg->qbe = qbe_fn_add_arg(c->qbe, c->fn, it->type.qbe);
+        const NodeId *args = ast_list(c->ast, fn->args);
+        for (size_t i = 0; i < fn->args.count; i++) {
+            NodeVar      *arg = ast_var(c->ast, args[i]);
+            const QbeType type = compile_type(c, ast_node(c->ast, args[i])->type);
+            arg->qbe = qbe_fn_add_arg(c->qbe, c->fn, type);
             if (arg->kind == NODE_VAR_LOCAL) {
-                QbeNode *var = qbe_fn_add_var(c->qbe, c->fn, it->type.qbe);
+                QbeNode *var = qbe_fn_add_var(c->qbe, c->fn, type);
                 qbe_build_store(c->qbe, c->fn, var, arg->qbe);
                 arg->qbe = var;
             }
         }
 
-        assert(fn->body->kind == NODE_BLOCK);
-        NodeBlock *fn_block = (NodeBlock *) fn->body;
+        const NodeList body = ast_block(c->ast, fn->body)->body;
+        const NodeId  *stmts = ast_list(c->ast, body);
 
         size_t fn_row = 0;
-        if (fn_block->body.head) {
-            fn_row = fn_block->body.head->token.pos.row;
+        if (body.count) {
+            fn_row = compile_row(c, stmts[0]);
 
-            compile_stmt(c, fn_block->body.head);
-            for (Node *it = fn_block->body.head->next; it; it = it->next) {
-                qbe_build_debug_line(c->qbe, c->fn, it->token.pos.row + 1);
-                compile_stmt(c, it);
+            compile_stmt(c, stmts[0]);
+            for (size_t i = 1; i < body.count; i++) {
+                qbe_build_debug_line(c->qbe, c->fn, compile_row(c, stmts[i]) + 1);
+                compile_stmt(c, stmts[i]);
             }
         } else {
-            fn_row = fn_block->node.token.pos.row;
+            fn_row = compile_row(c, fn->body);
         }
 
-        qbe_build_debug_line(c->qbe, c->fn, fn_block->node.token.pos.row + 1);
-        qbe_fn_set_debug(c->qbe, c->fn, qbe_sv_from_cstr(n->token.pos.path), fn_row + 1);
+        qbe_build_debug_line(c->qbe, c->fn, compile_row(c, fn->body) + 1);
+        qbe_fn_set_debug(c->qbe, c->fn, qbe_sv_from_cstr(c->lines.path), fn_row + 1);
         qbe_build_return(c->qbe, c->fn, NULL);
 
         c->fn = fn_save;
     } break;
 
     case NODE_VAR: {
-        NodeVar *var = (NodeVar *) n;
-
-        compile_type(&n->type);
-        if (var->kind == NODE_VAR_GLOBAL) {
-            var->qbe = qbe_var_new(c->qbe, (QbeSV) {0}, n->type.qbe);
+        NodeVar      *var = ast_var(c->ast, id);
+        const QbeType type = compile_type(c, n->type);
+        if (var->module) {
+            var->qbe = qbe_atom_symbol(c->qbe, global_name(var->module, var->name), qbe_type_basic(QBE_TYPE_I64));
+        } else if (var->kind == NODE_VAR_GLOBAL && c->split) {
+            // Only the entry piece defines global variables
+            if (c->piece) {
+                var->qbe = qbe_atom_symbol(c->qbe, piece_name(var->name), qbe_type_basic(QBE_TYPE_I64));
+            } else {
+                var->qbe = qbe_var_new(c->qbe, piece_name(var->name), type);
+            }
+            da_push(&c->refs, id);
+        } else if (var->kind == NODE_VAR_GLOBAL) {
+            var->qbe = qbe_var_new(c->qbe, c->module ? global_name(c->module, var->name) : (QbeSV) {0}, type);
         } else {
-            var->qbe = qbe_fn_add_var(c->qbe, c->fn, n->type.qbe);
+            var->qbe = qbe_fn_add_var(c->qbe, c->fn, type);
             if (var->expr) {
                 qbe_build_store(c->qbe, c->fn, var->qbe, compile_expr(c, var->expr, false));
             } else {
@@ -280,26 +390,24 @@ static void compile_stmt(Compiler *c, Node *n) {
                 QbeCall *call = qbe_build_call(c->qbe, c->fn, memset, qbe_type_basic(QBE_TYPE_I64));
                 qbe_call_add_arg(c->qbe, call, var->qbe);
                 qbe_call_add_arg(c->qbe, call, qbe_atom_int(c->qbe, QBE_TYPE_I32, 0));
-                qbe_call_add_arg(c->qbe, call, qbe_atom_int(c->qbe, QBE_TYPE_I64, qbe_sizeof(n->type.qbe)));
+                qbe_call_add_arg(c->qbe, call, qbe_atom_int(c->qbe, QBE_TYPE_I64, qbe_sizeof(type)));
             }
         }
     } break;
 
     case NODE_PRINT: {
-        NodePrint *print = (NodePrint *) n;
+        const NodePrint *print = ast_print(c->ast, id);
 
-        static QbeNode *fn;
-        if (!fn) {
-            fn = qbe_atom_symbol(c->qbe, qbe_sv_from_cstr("printf"), qbe_type_basic(QBE_TYPE_I64));
+        if (!c->print_fn) {
+            c->print_fn = qbe_atom_symbol(c->qbe, qbe_sv_from_cstr("printf"), qbe_type_basic(QBE_TYPE_I64));
         }
 
-        static QbeNode *fmt;
-        if (!fmt) {
-            fmt = qbe_str_new(c->qbe, qbe_sv_from_cstr("%ld\n"));
+        if (!c->print_fmt) {
+            c->print_fmt = qbe_str_new(c->qbe, qbe_sv_from_cstr("%ld\n"));
         }
 
-        QbeCall *call = qbe_build_call(c->qbe, c->fn, fn, qbe_type_basic(QBE_TYPE_I32));
-        qbe_call_add_arg(c->qbe, call, fmt);
+        QbeCall *call = qbe_build_call(c->qbe, c->fn, c->print_fn, qbe_type_basic(QBE_TYPE_I32));
+        qbe_call_add_arg(c->qbe, call, c->print_fmt);
         qbe_call_start_variadic(c->qbe, call);
 
         QbeNode *operand = compile_expr(c, print->operand, false);
@@ -307,72 +415,401 @@ static void compile_stmt(Compiler *c, Node *n) {
     } break;
 
     default:
-        compile_expr(c, n, false);
+        compile_expr(c, id, false);
         break;
     }
 }
 
+// Only the type is looked at, since a released 'main' keeps nothing else
 static NodeFn *get_main(Context *c) {
-    Node *main = scope_find(c->globals, sv_from_cstr("main"));
-    if (!main) {
-        fprintf(stderr, "ERROR: Function 'main' is not defined\n");
-        exit(1);
+    const NodeId id = scope_find(&c->globals, SYMBOL_MAIN);
+    if (!id) {
+        context_error(c, OFFSET_NONE, "Function 'main' is not defined");
+        return NULL;
     }
 
+    const Node *main = ast_node(c->ast, id);
     if (main->kind != NODE_FN) {
-        fprintf(stderr, PosFmt "ERROR: Function 'main' must be a function literal\n", PosArg(main->token.pos));
-        exit(1);
+        context_error(c, main->offset, "Function 'main' must be a function literal");
+        return NULL;
+    }
+
+    if (type_arity(main->type)) {
+        context_error(c, main->offset, "Function 'main' cannot take any arguments");
+        return NULL;
     }
 
-    NodeFn *main_fn = (NodeFn *) main;
-    if (main_fn->arity) {
-        fprintf(stderr, PosFmt "ERROR: Function 'main' cannot take any arguments\n", PosArg(main->token.pos));
-        exit(1);
+    if (type_ret(main->type) != TYPE_ID_UNIT) {
+        context_error(c, main->offset, "Function 'main' cannot return anything");
+        return NULL;
     }
+    return ast_fn(c->ast, id);
+}
 
-    if (main_fn->ret) {
-        fprintf(stderr, PosFmt "ERROR: Function 'main' cannot return anything\n", PosArg(main->token.pos));
-        exit(1);
+// Global initializers run in the entry point before 'main' is called
+static QbeFn *compile_entry(Compiler *c) {
+    if (!c->entry) {
+        c->entry = qbe_fn_new(c->qbe, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
+        qbe_fn_set_debug(c->qbe, c->entry, qbe_sv_from_cstr("glos_start_call_main.h"), 1);
     }
-    return main_fn;
+    return c->entry;
 }
 
-void compile_nodes(Context *context, const char *output) {
-    NodeFn *main = get_main(context);
+static void compile_switch(Compiler *c, Context *context) {
+    c->context = context;
+    c->ast = context->ast;
 
-    Compiler c = {0};
-    c.qbe = qbe_new();
+    // A checked tree may be compiled more than once, and what was lowered before belongs to another Qbe context
+    for (size_t i = 0; i < c->ast->fns.count; i++) {
+        c->ast->fns.data[i].qbe = NULL;
+    }
 
-    for (size_t i = 0; i < context->globals.count; i++) {
-        compile_stmt(&c, context->globals.data[i]);
+    for (size_t i = 0; i < c->ast->vars.count; i++) {
+        c->ast->vars.data[i].qbe = NULL;
     }
+}
 
-    // Entry
-    c.fn = qbe_fn_new(c.qbe, qbe_sv_from_cstr("main"), qbe_type_basic(QBE_TYPE_I32));
-    qbe_fn_set_debug(c.qbe, c.fn, qbe_sv_from_cstr("glos_start_call_main.h"), 1);
+void compile_begin(Compiler *c, Context *context) {
+    memset(c, 0, sizeof(*c));
+    c->qbe = qbe_new();
+    compile_switch(c, context);
+}
 
+void compile_unit(Compiler *c, Context *context, Symbol module) {
+    compile_switch(c, context);
+    c->module = module;
     for (size_t i = 0; i < context->globals.count; i++) {
-        Node *it = context->globals.data[i];
-        if (it->kind == NODE_VAR) {
-            NodeVar *var = (NodeVar *) it;
-            if (var->expr) {
-                qbe_build_store(c.qbe, c.fn, var->qbe, compile_expr(&c, var->expr, false));
+        compile_decl(c, context->globals.data[i].node);
+    }
+}
+
+void compile_decl(Compiler *c, NodeId id) {
+    compile_stmt(c, id);
+
+    if (ast_node(c->ast, id)->kind == NODE_VAR) {
+        const NodeVar *var = ast_var(c->ast, id);
+        if (var->kind == NODE_VAR_GLOBAL && var->expr) {
+            c->fn = compile_entry(c);
+            qbe_build_store(c->qbe, c->fn, var->qbe, compile_expr(c, var->expr, false));
+            c->fn = NULL;
+        }
+    }
+}
+
+// libqbe makes no promise that the backend can run on several threads at once
+static pthread_mutex_t generate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool compile_finish(Compiler *c) {
+    NodeFn *main = get_main(c->context);
+    if (!main) {
+        return false;
+    }
+
+    // The entry piece has only the name of 'main'
+    QbeNode *fn = main->qbe;
+    if (c->split) {
+        fn = qbe_atom_symbol(c->qbe, piece_name(SYMBOL_MAIN), qbe_type_basic(QBE_TYPE_I64));
+    }
+
+    c->fn = compile_entry(c);
+    qbe_build_call(c->qbe, c->fn, fn, qbe_type_basic(QBE_TYPE_I0));
+    qbe_build_return(c->qbe, c->fn, qbe_atom_int(c->qbe, QBE_TYPE_I32, 0));
+    return true;
+}
+
+// Whatever the backend lowered is gone with its context, including the nodes the tree still points at
+static void compile_free(Compiler *c) {
+    qbe_free(c->qbe);
+    da_free(&c->types);
+    da_free(&c->spine);
+    da_free(&c->ends);
+    memset(c, 0, sizeof(*c));
+}
+
+bool compile_end(Compiler *c, const char *output) {
+    bool ok = compile_finish(c);
+    if (ok) {
+        pthread_mutex_lock(&generate_lock);
+        const int code = qbe_generate(c->qbe, QBE_TARGET_DEFAULT, output, NULL, 0);
+        pthread_mutex_unlock(&generate_lock);
+
+        if (code) {
+            context_error(c->context, OFFSET_NONE, "Could not generate '%s'", output);
+            ok = false;
+        }
+    }
+
+    compile_free(c);
+    return ok;
+}
+
+bool compile_end_memory(Compiler *c, char **program, size_t *size) {
+    const bool ok = compile_finish(c);
+    if (ok) {
+        pthread_mutex_lock(&generate_lock);
+        qbe_compile(c->qbe);
+        const QbeSV compiled = qbe_get_compiled_program(c->qbe);
+        pthread_mutex_unlock(&generate_lock);
+
+        // The compiled program lives in the context, which goes away below
+        *program = malloc(compiled.count + 1);
+        assert(*program);
+        memcpy(*program, compiled.data, compiled.count);
+        (*program)[compiled.count] = '\0';
+        *size = compiled.count;
+    }
+
+    compile_free(c);
+    return ok;
+}
+
+void compile_split_begin(Compiler *c, Context *context) {
+    memset(c, 0, sizeof(*c));
+    compile_switch(c, context);
+    c->split = true;
+}
+
+// The nodes lowered for globals belong to the context of the piece, and the next piece gives them its own
+static void compile_piece_free(Compiler *c) {
+    for (size_t i = 0; i < c->refs.count; i++) {
+        const NodeId id = c->refs.data[i];
+        if (ast_node(c->ast, id)->kind == NODE_FN) {
+            ast_fn(c->ast, id)->qbe = NULL;
+        } else {
+            ast_var(c->ast, id)->qbe = NULL;
+        }
+    }
+    c->refs.count = 0;
+
+    qbe_free(c->qbe);
+    c->qbe = NULL;
+    c->fn = NULL;
+    c->entry = NULL;
+    c->print_fn = NULL;
+    c->print_fmt = NULL;
+    c->types.count = 0;
+}
+
+bool compile_piece(Compiler *c, NodeId id, const char *output) {
+    c->qbe = qbe_new();
+    c->piece = id;
+
+    bool ok = true;
+    if (id) {
+        compile_stmt(c, id);
+    } else {
+        for (size_t i = 0; i < c->context->globals.count; i++) {
+            const NodeId it = c->context->globals.data[i].node;
+            if (ast_node(c->ast, it)->kind == NODE_VAR) {
+                compile_decl(c, it);
             }
         }
+        ok = compile_finish(c);
     }
 
-    qbe_build_call(c.qbe, c.fn, main->qbe, qbe_type_basic(QBE_TYPE_I0));
-    qbe_build_return(c.qbe, c.fn, qbe_atom_int(c.qbe, QBE_TYPE_I32, 0));
+    if (ok) {
+        // Assembled but not linked, the objects of every piece are linked together by compile_link()
+        const char *flags[] = {"-c"};
 
-#if 0
-    qbe_compile(c.qbe);
-    QbeSV program = qbe_get_compiled_program(c.qbe);
-    fwrite(program.data, program.count, 1, stdout);
-    exit(0);
-#endif
+        pthread_mutex_lock(&generate_lock);
+        const int code = qbe_generate(c->qbe, QBE_TARGET_DEFAULT, output, flags, len(flags));
+        pthread_mutex_unlock(&generate_lock);
+
+        if (code) {
+            context_error(c->context, OFFSET_NONE, "Could not generate '%s'", output);
+            ok = false;
+        }
+    }
+
+    compile_piece_free(c);
+    return ok;
+}
+
+void compile_split_end(Compiler *c) {
+    da_free(&c->types);
+    da_free(&c->spine);
+    da_free(&c->ends);
+    da_free(&c->refs);
+    memset(c, 0, sizeof(*c));
+}
+
+bool compile_link(Context *context, const char **objects, size_t count, const char *output) {
+    Cmd cmd = {0};
+    da_push(&cmd, "cc");
+    da_push(&cmd, "-o");
+    da_push(&cmd, output);
+    da_push_many(&cmd, objects, count);
+
+    const int code = cmd_run(&cmd);
+    da_free(&cmd);
 
-    const int code = qbe_generate(c.qbe, QBE_TARGET_DEFAULT, output, NULL, 0);
     if (code) {
-        exit(code);
+        context_error(context, OFFSET_NONE, "Could not link '%s'", output);
+        return false;
+    }
+    return true;
+}
+
+static uint64_t hash_mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * 0x100000001b3;
+    return h ^ (h >> 29);
+}
+
+// Children are pushed last to first, so they are popped in order. Together with the counts of lists and which
+// optional children are there, the order they are hashed in is enough to tell the shape of the tree apart.
+typedef struct {
+    NodeId *data;
+    size_t  count;
+    size_t  capacity;
+} HashStack;
+
+static void hash_push(HashStack *s, NodeId id) {
+    if (id) {
+        da_push(s, id);
+    }
+}
+
+static void hash_push_list(HashStack *s, const Ast *ast, NodeList list) {
+    const NodeId *ids = ast_list(ast, list);
+    for (size_t i = list.count; i > 0; i--) {
+        da_push(s, ids[i - 1]);
+    }
+}
+
+// Globals are lowered as references by name, whatever their definition looks like
+static bool is_global(const Ast *ast, NodeId id) {
+    const Node *n = ast_node(ast, id);
+    if (n->kind == NODE_FN) {
+        return !ast_fn(ast, id)->local && n->token == TOKEN_IDENT;
+    }
+    return ast_var(ast, id)->kind == NODE_VAR_GLOBAL;
+}
+
+static_assert(COUNT_NODES == 10, "");
+uint64_t compile_piece_hash(const Ast *ast, NodeId id) {
+    const SourceLines lines = source_lines(ast_node(ast, id)->offset);
+    uint64_t          h = hash_bytes(lines.path, strlen(lines.path));
+
+    HashStack s = {0};
+    da_push(&s, id);
+
+    while (s.count) {
+        const NodeId it = s.data[--s.count];
+        const Node  *n = ast_node(ast, it);
+        h = hash_mix(h, n->kind | (uint64_t) n->token << 8 | (uint64_t) n->type << 16);
+
+        switch (n->kind) {
+        case NODE_ATOM: {
+            const NodeAtom *atom = ast_atom(ast, it);
+
+            static_assert(COUNT_TOKENS == 22, "");
+            switch (n->token) {
+            case TOKEN_INT:
+                h = hash_mix(h, atom->as.integer);
+                break;
+
+            case TOKEN_BOOL:
+                h = hash_mix(h, atom->as.boolean);
+                break;
+
+            case TOKEN_IDENT: {
+                // Which local a name resolves to follows from the shape of the tree. A global is outside of it, and
+                // its type is the type of the identifier.
+                const NodeKind kind = ast_node(ast, atom->definition)->kind;
+                h = hash_mix(hash_mix(h, atom->as.symbol), is_global(ast, atom->definition) ? kind + 1 : 0);
+            } break;
+
+            default:
+                break;
+            }
+        } break;
+
+        case NODE_CALL: {
+            const NodeCall *call = ast_call(ast, it);
+            h = hash_mix(h, call->args.count);
+            hash_push_list(&s, ast, call->args);
+            hash_push(&s, call->fn);
+        } break;
+
+        case NODE_UNARY:
+            hash_push(&s, ast_unary(ast, it)->operand);
+            break;
+
+        case NODE_BINARY:
+            hash_push(&s, ast_binary(ast, it)->rhs);
+            hash_push(&s, ast_binary(ast, it)->lhs);
+            break;
+
+        case NODE_IF: {
+            const NodeIf *iff = ast_if(ast, it);
+            h = hash_mix(h, iff->antecedence != 0);
+            hash_push(&s, iff->antecedence);
+            hash_push(&s, iff->consequence);
+            hash_push(&s, iff->condition);
+        } break;
+
+        case NODE_BLOCK: {
+            const NodeList body = ast_block(ast, it)->body;
+            const NodeId  *stmts = ast_list(ast, body);
+
+            // Blocks and their statements are the rows which end up in debug info
+            h = hash_mix(hash_mix(h, body.count), source_lines_row(&lines, n->offset));
+            for (size_t i = 0; i < body.count; i++) {
+                h = hash_mix(h, source_lines_row(&lines, ast_node(ast, stmts[i])->offset));
+            }
+            hash_push_list(&s, ast, body);
+        } break;
+
+        case NODE_RETURN:
+            h = hash_mix(h, ast_return(ast, it)->value != 0);
+            hash_push(&s, ast_return(ast, it)->value);
+            break;
+
+        // Written types are left out, the types of the nodes are hashed already
+        case NODE_FN: {
+            const NodeFn *fn = ast_fn(ast, it);
+            h = hash_mix(hash_mix(hash_mix(hash_mix(h, fn->name), fn->args.count), fn->local), fn->module);
+            hash_push(&s, fn->body);
+            hash_push_list(&s, ast, fn->args);
+        } break;
+
+        case NODE_VAR: {
+            const NodeVar *var = ast_var(ast, it);
+            h = hash_mix(hash_mix(hash_mix(hash_mix(h, var->name), var->kind), var->module), var->expr != 0);
+            hash_push(&s, var->expr);
+        } break;
+
+        case NODE_PRINT:
+            hash_push(&s, ast_print(ast, it)->operand);
+            break;
+
+        default:
+            unreachable();
+        }
     }
+
+    da_free(&s);
+    return h;
+}
+
+static bool compile_globals(Compiler *c, Context *context) {
+    if (!get_main(context)) {
+        return false;
+    }
+
+    compile_begin(c, context);
+    for (size_t i = 0; i < context->globals.count; i++) {
+        compile_decl(c, context->globals.data[i].node);
+    }
+    return true;
+}
+
+bool compile_nodes(Context *context, const char *output) {
+    Compiler c;
+    return compile_globals(&c, context) && compile_end(&c, output);
+}
+
+bool compile_nodes_memory(Context *context, char **program, size_t *size) {
+    Compiler c;
+    return compile_globals(&c, context) && compile_end_memory(&c, program, size);
 }
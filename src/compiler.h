@@ -3,6 +3,83 @@
 
 #include "context.h"
 
-void compile_nodes(Context *context, const char *output);
+typedef struct {
+    Qbe     *qbe;
+    QbeFn   *fn;
+    QbeFn   *entry;
+    Ast     *ast;
+    Context *context;
+    Symbol   module; // Module of the unit being lowered, zero for the program itself
+
+    SourceLines lines; // Of the top-level function being lowered
+
+    // Set while a program is lowered in pieces, see compile_piece()
+    bool   split;
+    NodeId piece; // Top-level function being lowered, zero for the entry piece
+
+    // Globals given a node by the current piece, which belongs to its Qbe context
+    struct {
+        NodeId *data;
+        size_t  count;
+        size_t  capacity;
+    } refs;
+
+    // Shared by every print statement, created on first use
+    QbeNode *print_fn;
+    QbeNode *print_fmt;
+
+    // Lowered types, indexed by canonical type
+    struct {
+        QbeType *data;
+        size_t   count;
+        size_t   capacity;
+    } types;
+
+    // Left spines of binary chains being compiled, innermost operator last
+    struct {
+        NodeId *data;
+        size_t  count;
+        size_t  capacity;
+    } spine;
+
+    // End blocks of the else-if ladders being compiled, innermost last
+    struct {
+        QbeBlock **data;
+        size_t     count;
+        size_t     capacity;
+    } ends;
+} Compiler;
+
+// All of these return false on an error, leaving it in the context
+bool compile_nodes(Context *context, const char *output);
+
+// Compiles checked top-level statements one at a time, in the order they were declared
+void compile_begin(Compiler *c, Context *context);
+void compile_decl(Compiler *c, NodeId id);
+bool compile_end(Compiler *c, const char *output);
+
+// Lowers every global of another checked unit into the same program. Modules go first, in an order where each comes
+// after the ones it imports. The program itself comes last with a zero module, as compile_end() looks for its 'main'.
+void compile_unit(Compiler *c, Context *context, Symbol module);
+
+// Lowers a checked program in pieces, each into a Qbe context of its own which the backend assembles into an object
+// file. Every top-level function is a piece, and the entry piece with a zero ID holds the global variables, their
+// initializers and the entry point. Pieces name their globals and refer to the others by name, so the objects link
+// into the program. Each piece is lowered at most once between compile_split_begin() and compile_split_end().
+void compile_split_begin(Compiler *c, Context *context);
+bool compile_piece(Compiler *c, NodeId id, const char *output);
+void compile_split_end(Compiler *c);
+bool compile_link(Context *context, const char **objects, size_t count, const char *output);
+
+// Everything the piece of a top-level declaration depends on: the shape, types and values of its tree, the names,
+// kinds and types of the globals it refers to, and the rows which end up in its debug info. Node IDs, list indexes and
+// offsets are left out, so a declaration hashes the same wherever it was moved in the tree. The entry piece depends on
+// the hashes of every global variable.
+uint64_t compile_piece_hash(const Ast *ast, NodeId id);
+
+// Keep the program compiled by the backend in memory instead of generating an executable. It is null terminated, and
+// the caller frees it.
+bool compile_nodes_memory(Context *context, char **program, size_t *size);
+bool compile_end_memory(Compiler *c, char **program, size_t *size);
 
 #endif // COMPILER_H
@@ -1,17 +1,74 @@
+#include <stdarg.h>
+
 #include "context.h"
 
-Node *scope_find(Scope s, SV name) {
-    for (size_t i = s.count; i > 0; i--) {
-        Node *it = s.data[i - 1];
-        if (sv_eq(it->token.sv, name)) {
-            return it;
-        }
+static uint32_t scope_innermost(const Scope *s, Symbol name) {
+    if (name >= s->innermost.count) {
+        return 0;
+    }
+    return s->innermost.data[name];
+}
+
+void scope_push(Scope *s, Symbol name, NodeId node) {
+    if (name >= s->innermost.count) {
+        const size_t count = name + 1 - s->innermost.count;
+        da_grow(&s->innermost, count);
+        memset(&s->innermost.data[s->innermost.count], 0, count * sizeof(*s->innermost.data));
+        s->innermost.count += count;
+    }
+
+    const ScopeEntry entry = {.name = name, .node = node, .shadowed = s->innermost.data[name]};
+    da_push(s, entry);
+    s->innermost.data[name] = s->count;
+}
+
+// Drops entries until 'count' remain, uncovering whatever they shadowed
+void scope_pop(Scope *s, size_t count) {
+    assert(count <= s->count);
+    while (s->count > count) {
+        const ScopeEntry *it = &s->data[--s->count];
+        s->innermost.data[it->name] = it->shadowed;
+    }
+}
+
+NodeId scope_find(const Scope *s, Symbol name) {
+    const uint32_t index = scope_innermost(s, name);
+    if (!index) {
+        return 0;
     }
+    return s->data[index - 1].node;
+}
+
+static void scope_free(Scope *s) {
+    da_free(&s->innermost);
+    da_free(s);
+}
+
+void context_free(Context *c) {
+    scope_free(&c->locals);
+    scope_free(&c->globals);
+    da_free(&c->spine);
+}
+
+void context_error(Context *c, uint32_t offset, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    c->error = diagnostics_verror(offset, fmt, args);
+    va_end(args);
+}
+
+void context_fail(Context *c, uint32_t offset, const char *fmt, ...) {
+    assert(c->bail);
 
-    return NULL;
+    va_list args;
+    va_start(args, fmt);
+    c->error = diagnostics_verror(offset, fmt, args);
+    va_end(args);
+
+    longjmp(*c->bail, 1);
 }
 
-ContextFn context_fn_begin(Context *c, NodeFn *fn) {
+ContextFn context_fn_begin(Context *c, NodeId fn) {
     const ContextFn save = c->fn;
     c->fn.base = c->locals.count;
     c->fn.fn = fn;
@@ -19,13 +76,83 @@ ContextFn context_fn_begin(Context *c, NodeFn *fn) {
 }
 
 void context_fn_end(Context *c, ContextFn save) {
-    c->locals.count = c->fn.base;
+    scope_pop(&c->locals, c->fn.base);
     c->fn = save;
 }
 
-Node *context_fn_find(ContextFn f, Scope s, SV name) {
-    assert(f.base <= s.count);
-    s.data += f.base;
-    s.count -= f.base;
-    return scope_find(s, name);
+// Bindings below the function's base belong to enclosing functions. Anything they shadow is older still, so the
+// innermost binding alone decides whether the name is visible.
+NodeId context_fn_find(ContextFn f, const Scope *s, Symbol name) {
+    assert(f.base <= s->count);
+    const uint32_t index = scope_innermost(s, name);
+    if (index <= f.base) {
+        return 0;
+    }
+    return s->data[index - 1].node;
+}
+
+NodeId context_global_find(const Context *c, Symbol name) {
+    const uint32_t index = scope_innermost(&c->globals, name);
+    if (!index || index > c->horizon) {
+        return 0;
+    }
+    return c->globals.data[index - 1].node;
+}
+
+// Rewinds the AST to the mark once everything parsed since has been checked and compiled. Globals declared since
+// then survive as bare declarations with no children, renumbered in place, so later code can still resolve them.
+void context_release(Context *c, AstMark m, size_t globals) {
+    assert(globals <= c->globals.count);
+
+    typedef struct {
+        Node node;
+        union {
+            NodeFn  fn;
+            NodeVar var;
+        } as;
+    } Kept;
+
+    const ArenaMark temp = temp_save();
+    const size_t    count = c->globals.count - globals;
+
+    Kept *kept = temp_alloc(count * sizeof(*kept));
+    for (size_t i = 0; i < count; i++) {
+        const NodeId id = c->globals.data[globals + i].node;
+        assert(id >= m.nodes);
+
+        kept[i].node = *ast_node(c->ast, id);
+        switch (kept[i].node.kind) {
+        case NODE_FN:
+            kept[i].as.fn = *ast_fn(c->ast, id);
+            kept[i].as.fn.args = (NodeList) {0};
+            kept[i].as.fn.ret = 0;
+            kept[i].as.fn.body = 0;
+            break;
+
+        case NODE_VAR:
+            kept[i].as.var = *ast_var(c->ast, id);
+            kept[i].as.var.expr = 0;
+            kept[i].as.var.type = 0;
+            break;
+
+        default:
+            unreachable();
+        }
+    }
+
+    ast_rewind(c->ast, m);
+    for (size_t i = 0; i < count; i++) {
+        const Node  *it = &kept[i].node;
+        const NodeId id = ast_push(c->ast, it->kind, it->token, it->offset);
+        ast_node(c->ast, id)->type = it->type;
+
+        if (it->kind == NODE_FN) {
+            *ast_fn(c->ast, id) = kept[i].as.fn;
+        } else {
+            *ast_var(c->ast, id) = kept[i].as.var;
+        }
+        c->globals.data[globals + i].node = id;
+    }
+
+    temp_restore(temp);
 }
@@ -1,30 +1,73 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <setjmp.h>
+
+#include "diagnostic.h"
 #include "node.h"
 
 typedef struct {
-    Node **data;
-    size_t count;
-    size_t capacity;
+    Symbol   name;
+    NodeId   node;
+    uint32_t shadowed; // Index + 1 of the entry this one hides, zero if none
+} ScopeEntry;
+
+// A stack of bindings. Symbols are dense, so the innermost binding of each name is found by indexing with it.
+typedef struct {
+    ScopeEntry *data;
+    size_t      count;
+    size_t      capacity;
+
+    struct {
+        uint32_t *data; // Index + 1 of the innermost entry, zero if unbound
+        size_t    count;
+        size_t    capacity;
+    } innermost;
 } Scope;
 
-Node *scope_find(Scope s, SV name);
+void   scope_push(Scope *s, Symbol name, NodeId node);
+void   scope_pop(Scope *s, size_t count);
+NodeId scope_find(const Scope *s, Symbol name);
 
 typedef struct {
-    NodeFn *fn;
-    size_t  base;
+    NodeId fn;
+    size_t base;
 } ContextFn;
 
 typedef struct {
+    Ast *ast;
+
     Scope locals;
     Scope globals;
 
     ContextFn fn;
+
+    // Left spines of binary chains being checked, innermost operator last
+    struct {
+        NodeId *data;
+        size_t  count;
+        size_t  capacity;
+    } spine;
+
+    // Globals at or past this index are declared later in the file, so code being checked cannot see them yet
+    size_t horizon;
+
+    // Errors are recorded in 'error' and unwind to 'bail', the entry points then return failure
+    jmp_buf     *bail;
+    Diagnostics *error;
 } Context;
 
-ContextFn context_fn_begin(Context *c, NodeFn *fn);
+void context_free(Context *c);
+
+// Records an error at the offset in 'error'. Failing also unwinds to 'bail', which must be set.
+void context_error(Context *c, uint32_t offset, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+_Noreturn void context_fail(Context *c, uint32_t offset, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+ContextFn context_fn_begin(Context *c, NodeId fn);
 void      context_fn_end(Context *c, ContextFn save);
-Node     *context_fn_find(ContextFn f, Scope s, SV name);
+NodeId    context_fn_find(ContextFn f, const Scope *s, Symbol name);
+NodeId    context_global_find(const Context *c, Symbol name);
+
+void context_release(Context *c, AstMark m, size_t globals);
 
 #endif // CONTEXT_H
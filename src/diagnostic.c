@@ -0,0 +1,68 @@
+#include "diagnostic.h"
+
+static void diagnostics_vpush(Diagnostics *ds, Severity severity, uint32_t offset, const char *fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    const int n = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+
+    assert(n >= 0);
+    Diagnostic d = {.severity = severity, .offset = offset, .message = malloc(n + 1)};
+    assert(d.message);
+    vsnprintf(d.message, n + 1, fmt, args);
+    da_push(ds, d);
+}
+
+Diagnostics *diagnostics_verror(uint32_t offset, const char *fmt, va_list args) {
+    Diagnostics *ds = calloc(1, sizeof(*ds));
+    assert(ds);
+    diagnostics_vpush(ds, SEVERITY_ERROR, offset, fmt, args);
+    return ds;
+}
+
+Diagnostics *diagnostics_error(uint32_t offset, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    Diagnostics *ds = diagnostics_verror(offset, fmt, args);
+    va_end(args);
+    return ds;
+}
+
+void diagnostics_note(Diagnostics *ds, uint32_t offset, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    diagnostics_vpush(ds, SEVERITY_NOTE, offset, fmt, args);
+    va_end(args);
+}
+
+char *diagnostics_format(const Diagnostics *ds) {
+    const ArenaMark temp = temp_save();
+
+    const char *s = "";
+    for (size_t i = 0; i < ds->count; i++) {
+        const Diagnostic *it = &ds->data[i];
+        const char       *severity = it->severity == SEVERITY_NOTE ? "NOTE" : "ERROR";
+        if (it->offset == OFFSET_NONE) {
+            s = temp_sprintf("%s%s: %s\n", s, severity, it->message);
+        } else {
+            s = temp_sprintf("%s" PosFmt "%s: %s\n", s, PosArg(source_pos(it->offset)), severity, it->message);
+        }
+    }
+
+    char *text = strdup(s);
+    assert(text);
+    temp_restore(temp);
+    return text;
+}
+
+void diagnostics_free(Diagnostics *ds) {
+    if (!ds) {
+        return;
+    }
+
+    for (size_t i = 0; i < ds->count; i++) {
+        free(ds->data[i].message);
+    }
+    da_free(ds);
+    free(ds);
+}
@@ -0,0 +1,38 @@
+#ifndef DIAGNOSTIC_H
+#define DIAGNOSTIC_H
+
+#include <stdarg.h>
+
+#include "source.h"
+
+typedef enum {
+    SEVERITY_ERROR,
+    SEVERITY_NOTE,
+} Severity;
+
+// Offset of diagnostics about the program as a whole, like a missing 'main' function
+#define OFFSET_NONE UINT32_MAX
+
+typedef struct {
+    Severity severity;
+    uint32_t offset;
+    char    *message; // Bare text, the command line adds the position and severity
+} Diagnostic;
+
+// An error followed by the notes which belong to it, recorded where it was raised
+typedef struct {
+    Diagnostic *data;
+    size_t      count;
+    size_t      capacity;
+} Diagnostics;
+
+Diagnostics *diagnostics_error(uint32_t offset, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+Diagnostics *diagnostics_verror(uint32_t offset, const char *fmt, va_list args);
+void diagnostics_note(Diagnostics *ds, uint32_t offset, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// Lines of "PATH:ROW:COL: ERROR: ...", without the position if there is none. The sources must still be registered.
+char *diagnostics_format(const Diagnostics *ds);
+
+void diagnostics_free(Diagnostics *ds);
+
+#endif // DIAGNOSTIC_H
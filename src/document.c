@@ -0,0 +1,438 @@
+#include "checker.h"
+#include "document.h"
+#include "parser.h"
+
+void document_init(Document *d, const char *path) {
+    memset(d, 0, sizeof(*d));
+    d->path = path;
+    d->context.ast = &d->ast;
+}
+
+static void decls_drop(DocumentDecl *decls, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(decls[i].error);
+    }
+}
+
+void document_free(Document *d) {
+    if (d->source) {
+        source_remove(d->base);
+        free(d->source);
+    }
+
+    decls_drop(d->decls.data, d->decls.count);
+    ast_free(&d->ast);
+    ast_free(&d->tail);
+    context_free(&d->context);
+    da_free(&d->decls);
+    da_free(&d->refs);
+    da_free(&d->pending);
+    diagnostics_free(d->error);
+    memset(d, 0, sizeof(*d));
+}
+
+// Tree before the declaration
+static AstMark document_begin(const Document *d, size_t i) {
+    if (i) {
+        return d->decls.data[i - 1].mark;
+    }
+    return (AstMark) {.nodes = d->ast.nodes.count ? 1 : 0};
+}
+
+// Whole blocks are compared first, since most edits leave almost all of a large file as it was
+static size_t common_prefix(const char *a, const char *b, size_t count) {
+    size_t i = 0;
+    while (i + 64 <= count && !memcmp(a + i, b + i, 64)) {
+        i += 64;
+    }
+
+    while (i < count && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+static size_t common_suffix(const char *a, const char *b, size_t count) {
+    size_t i = 0;
+    while (i + 64 <= count && !memcmp(a - i - 64, b - i - 64, 64)) {
+        i += 64;
+    }
+
+    while (i < count && a[-(ptrdiff_t) i - 1] == b[-(ptrdiff_t) i - 1]) {
+        i++;
+    }
+    return i;
+}
+
+static Symbol decl_name(const Ast *ast, NodeId id) {
+    const Node *n = ast_node(ast, id);
+    if (n->kind == NODE_FN) {
+        return ast_fn(ast, id)->name;
+    }
+
+    if (n->kind == NODE_VAR) {
+        return ast_var(ast, id)->name;
+    }
+    return 0;
+}
+
+// Parse errors have no notes, so the message and the offset are all there is to keep
+static void decl_error(const Document *d, DocumentDecl *decl, const Diagnostics *error) {
+    assert(error->count == 1);
+    decl->error = strdup(error->data[0].message);
+    assert(decl->error);
+    decl->error_offset = error->data[0].offset - d->base;
+}
+
+// Identifiers in the moved tree that refer to globals outside of it, starting at the mark. Those below 'keep' stay
+// where they are, the rest are found again by name.
+static void tail_refs(Document *d, AstMark from, NodeId keep) {
+    d->refs.count = 0;
+    for (size_t i = from.payloads[NODE_ATOM]; i < d->ast.atoms.count; i++) {
+        const NodeId definition = d->ast.atoms.data[i].definition;
+        if (definition && definition < from.nodes) {
+            const DocumentRef ref = {
+                .atom = i - from.payloads[NODE_ATOM],
+                .definition = definition < keep ? definition : 0,
+                .kind = ast_node(&d->ast, definition)->kind,
+            };
+            da_push(&d->refs, ref);
+        }
+    }
+}
+
+// Relative to where the declaration moved from, the tree of the moved declarations starts at 'from'
+static AstMark mark_relocate(AstMark m, AstMark from, AstMark to) {
+    m.nodes = m.nodes - from.nodes + to.nodes;
+    m.lists = m.lists - from.lists + to.lists;
+    for (size_t i = 0; i < COUNT_NODES; i++) {
+        m.payloads[i] = m.payloads[i] - from.payloads[i] + to.payloads[i];
+    }
+    return m;
+}
+
+// Puts the moved declarations from 'first' on back at the end of the tree. Those before 'first' were parsed over and
+// are dropped, so whatever refers to their globals has to find them again by name.
+static void tail_join(Document *d, DocumentDecl *moved, size_t first, size_t count, AstMark from,
+                      uint32_t shift, int64_t delta) {
+    decls_drop(moved, first);
+
+    const AstMark start = first ? moved[first - 1].mark : from;
+    if (first) {
+        const AstMark cut = mark_relocate(start, from, (AstMark) {.nodes = 1});
+
+        // Refs past the cut are kept, and those into the part dropped join them
+        d->pending.count = 0;
+        size_t ref = 0;
+        for (size_t i = cut.payloads[NODE_ATOM]; i < d->tail.atoms.count; i++) {
+            while (ref < d->refs.count && d->refs.data[ref].atom < i) {
+                ref++;
+            }
+
+            const NodeId definition = d->tail.atoms.data[i].definition;
+            if (ref < d->refs.count && d->refs.data[ref].atom == i) {
+                DocumentRef it = d->refs.data[ref];
+                it.atom -= cut.payloads[NODE_ATOM];
+                da_push(&d->pending, it);
+            } else if (definition && definition < cut.nodes) {
+                const DocumentRef it = {
+                    .atom = i - cut.payloads[NODE_ATOM],
+                    .kind = ast_node(&d->tail, definition)->kind,
+                };
+                da_push(&d->pending, it);
+            }
+        }
+
+        d->refs.count = 0;
+        da_push_many(&d->refs, d->pending.data, d->pending.count);
+
+        Ast rest = {0};
+        ast_split(&d->tail, cut, &rest);
+        ast_free(&d->tail);
+        d->tail = rest;
+    }
+
+    for (size_t i = 1; i < d->tail.nodes.count; i++) {
+        d->tail.nodes.data[i].offset += shift;
+    }
+
+    // Node 0 may only be reserved by the append, so the node IDs are taken from what it returns
+    AstMark dest = ast_mark(&d->ast);
+    dest.nodes = ast_append(&d->ast, &d->tail) + 1;
+
+    // Refs to kept globals are put back as they were, the others wait for the check to find them
+    d->pending.count = 0;
+    for (size_t i = 0; i < d->refs.count; i++) {
+        DocumentRef it = d->refs.data[i];
+        it.atom += dest.payloads[NODE_ATOM];
+        if (it.definition) {
+            d->ast.atoms.data[it.atom].definition = it.definition;
+        } else {
+            da_push(&d->pending, it);
+        }
+    }
+
+    for (size_t i = first; i < count; i++) {
+        DocumentDecl it = moved[i];
+        it.start += delta;
+        it.error_offset += delta;
+        if (it.next != UINT32_MAX) {
+            it.next += delta;
+        }
+        if (it.end != UINT32_MAX) {
+            it.end += delta;
+        }
+
+        it.mark = mark_relocate(it.mark, start, dest);
+        if (it.node) {
+            it.node = it.node - start.nodes + dest.nodes;
+        }
+        da_push(&d->decls, it);
+    }
+}
+
+// Whether a moved declaration still checks as it did. Every global it refers to has to be there with the same type,
+// the ones parsed again being found by name, and the global it declares must not clash with one declared before it.
+static bool tail_holds(Document *d, size_t i, size_t *pending) {
+    const DocumentDecl *decl = &d->decls.data[i];
+    const AstMark       begin = document_begin(d, i);
+
+    bool holds = decl->checked;
+    for (NodeId id = begin.nodes; id < decl->mark.nodes; id++) {
+        const Node *n = ast_node(&d->ast, id);
+        if (n->kind != NODE_ATOM || n->token != TOKEN_IDENT) {
+            continue;
+        }
+
+        NodeAtom *atom = ast_atom(&d->ast, id);
+        if (*pending < d->pending.count && d->pending.data[*pending].atom == n->data) {
+            const NodeId found = scope_find(&d->context.globals, atom->as.symbol);
+            if (found && ast_node(&d->ast, found)->kind == d->pending.data[*pending].kind) {
+                atom->definition = found;
+            } else {
+                holds = false;
+            }
+            (*pending)++;
+        }
+
+        if (atom->definition && atom->definition < begin.nodes &&
+            ast_node(&d->ast, atom->definition)->type != n->type) {
+            holds = false;
+        }
+    }
+
+    const Symbol name = decl_name(&d->ast, decl->node);
+    if (name && scope_find(&d->context.globals, name)) {
+        holds = false;
+    }
+    return holds;
+}
+
+bool document_update(Document *d, SV sv) {
+    d->kept = d->decls.count;
+    d->parsed = 0;
+    d->checked = 0;
+    if (d->source && sv.count == d->count && !memcmp(sv.data, d->source, sv.count)) {
+        return !d->error;
+    }
+
+    const size_t  common = sv.count < d->count ? sv.count : d->count;
+    const size_t  prefix = d->source ? common_prefix(sv.data, d->source, common) : 0;
+    const size_t  suffix = d->source ? common_suffix(sv.data + sv.count, d->source + d->count, common - prefix) : 0;
+    const int64_t delta = (int64_t) sv.count - (int64_t) d->count;
+
+    // A declaration which does not parse skips ahead past its end, and is only kept if it does not skip into the edit
+    size_t keep = 0;
+    while (keep < d->decls.count && d->decls.data[keep].end < prefix && d->decls.data[keep].next <= prefix) {
+        keep++;
+    }
+
+    // Kept declarations past the first error were only parsed, so checking starts over at the first of them
+    size_t check = keep;
+    while (check && !d->decls.data[check - 1].checked) {
+        check--;
+    }
+
+    size_t tail = keep;
+    while (tail < d->decls.count && d->decls.data[tail].start < d->count - suffix) {
+        tail++;
+    }
+    decls_drop(d->decls.data + keep, tail - keep);
+
+    // The declarations which may move are taken out of the tree, along with what they refer to before them
+    const ArenaMark temp = temp_save();
+    const AstMark   from = document_begin(d, tail);
+    const size_t    moved = d->decls.count - tail;
+
+    DocumentDecl *old = NULL;
+    if (moved) {
+        old = temp_alloc(moved * sizeof(*old));
+        memcpy(old, d->decls.data + tail, moved * sizeof(*old));
+        tail_refs(d, from, document_begin(d, keep).nodes);
+        ast_split(&d->ast, from, &d->tail);
+    }
+
+    Context *c = &d->context;
+    ast_rewind(&d->ast, document_begin(d, keep));
+    scope_pop(&c->globals, check ? d->decls.data[check - 1].globals : 0);
+    d->decls.count = keep;
+    d->kept = keep;
+
+    // A failed check leaves the state of whatever it was inside of
+    scope_pop(&c->locals, 0);
+    c->fn = (ContextFn) {0};
+    c->spine.count = 0;
+
+    diagnostics_free(d->error);
+    d->error = NULL;
+
+    // The new text takes over the range of the old one. Should it land elsewhere, the kept nodes are moved along.
+    if (d->source) {
+        source_remove(d->base);
+        free(d->source);
+    }
+
+    d->count = sv.count;
+    d->source = malloc(d->count + 1);
+    assert(d->source);
+    memcpy(d->source, sv.data, d->count);
+
+    Lexer l = {0};
+    lexer_init(&l, d->path, (SV) {d->source, d->count});
+
+    const uint32_t shift = l.base - d->base;
+    for (size_t i = 0; i < d->ast.nodes.count; i++) {
+        d->ast.nodes.data[i].offset += shift;
+    }
+    d->base = l.base;
+
+    // Resume at the token following the last kept declaration
+    uint32_t resume = keep ? d->decls.data[keep - 1].next : 0;
+    l.sv.data += resume;
+    l.sv.count -= resume;
+
+    Parser p = {.ast = &d->ast};
+    parse_begin(&p, l);
+
+    size_t first = 0;
+    bool   joined = false;
+    while (true) {
+        // Moved declarations the parser went past are gone. The first one it is in step with comes back with the rest.
+        while (first < moved && old[first].start + delta < resume) {
+            first++;
+        }
+
+        if (first < moved && old[first].start + delta == resume) {
+            joined = true;
+            break;
+        }
+
+        const NodeId id = parse_next(&p);
+        if (!id) {
+            break;
+        }
+
+        DocumentDecl decl = {.start = resume, .mark = ast_mark(&d->ast), .node = id, .end = UINT32_MAX};
+        if (p.index < p.tokens.count) {
+            decl.next = p.tokens.offsets[p.index] - d->base;
+            decl.end = decl.next + p.tokens.lengths[p.index];
+        }
+        da_push(&d->decls, decl);
+        d->parsed++;
+
+        resume = decl.end == UINT32_MAX ? UINT32_MAX : decl.next;
+    }
+
+    // A declaration which does not parse is skipped up to the next one moved along, so the rest of the tree survives.
+    // Tokens do not span lines, so it fails the same way until its text changes up to the end of the last line the
+    // parser looked at. Running into the end of the file depends on whatever follows, so that is never kept.
+    const size_t parsed = d->decls.count;
+    if (p.error) {
+        DocumentDecl decl = {.start = resume, .mark = ast_mark(&d->ast), .next = UINT32_MAX, .end = UINT32_MAX};
+        decl_error(d, &decl, p.error);
+
+        const size_t last = p.index < p.tokens.count ? p.index : p.tokens.count - 1;
+        if (first < moved && (p.tokens.kinds[last] != TOKEN_EOF || p.tokens.error)) {
+            const uint32_t seen = p.tokens.offsets[last] - d->base;
+            const char    *newline = memchr(d->source + seen, '\n', d->count - seen);
+            decl.next = old[first].start + delta;
+            decl.end = newline ? (size_t) (newline - d->source) : d->count;
+            joined = true;
+        }
+        da_push(&d->decls, decl);
+    }
+
+    if (joined) {
+        tail_join(d, old, first, moved, from, shift + (uint32_t) delta, delta);
+    } else {
+        decls_drop(old, moved);
+    }
+    temp_restore(temp);
+
+    size_t pending = 0;
+    for (size_t i = check; i < d->decls.count; i++) {
+        DocumentDecl *decl = &d->decls.data[i];
+        if (!decl->node && !d->error) {
+            d->error = diagnostics_error(d->base + decl->error_offset, "%s", decl->error);
+        }
+
+        if (d->error) {
+            decl->checked = false;
+        } else if (i >= parsed && tail_holds(d, i, &pending)) {
+            const Symbol name = decl_name(&d->ast, decl->node);
+            if (name) {
+                scope_push(&c->globals, name, decl->node);
+            }
+        } else {
+            const size_t globals = c->globals.count;
+            d->checked++;
+            decl->checked = check_decl(c, decl->node);
+            if (!decl->checked) {
+                d->error = c->error;
+                c->error = NULL;
+                scope_pop(&c->globals, globals);
+            }
+        }
+        decl->globals = c->globals.count;
+    }
+
+    diagnostics_free(p.error);
+    parser_free(&p);
+    return !d->error;
+}
+
+NodeId document_find(const Document *d, uint32_t offset) {
+    size_t lo = 0;
+    size_t hi = d->decls.count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (d->decls.data[mid].start <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (!lo || !d->decls.data[lo - 1].checked) {
+        return 0;
+    }
+
+    const AstMark begin = document_begin(d, lo - 1);
+    const AstMark end = d->decls.data[lo - 1].mark;
+    for (NodeId id = begin.nodes; id < end.nodes; id++) {
+        const Node *n = ast_node(&d->ast, id);
+
+        Symbol name = 0;
+        if (n->kind == NODE_ATOM && n->token == TOKEN_IDENT) {
+            name = ast_atom(&d->ast, id)->as.symbol;
+        } else {
+            name = decl_name(&d->ast, id);
+        }
+
+        const uint32_t start = n->offset - d->base;
+        if (name && offset >= start && offset < start + symbol_sv(name).count) {
+            return id;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include "context.h"
+
+// A source kept parsed and checked across edits, for watch mode and the language server.
+//
+// A global only sees what was declared before it, so the checked state after a declaration depends on nothing past the
+// token following it. An update keeps every declaration whose tokens and lookahead end before the first changed byte
+// and parses again from there. Once the parser is back in step with a declaration starting past the last changed byte,
+// the rest of the old tree is moved along instead. A moved declaration is only checked again if a global it refers to
+// is gone or changed its type, or if the global it declares now clashes with one declared before it.
+typedef struct {
+    uint32_t start;   // Where parsing the declaration began, relative to the source
+    uint32_t next;    // Start of the token following it
+    uint32_t end;     // One past that token, or UINT32_MAX if it was never lexed
+    AstMark  mark;    // Tree after the declaration
+    NodeId   node;    // The top-level statement
+    size_t   globals; // Globals after the declaration
+    bool     checked; // False from the first error on, past which declarations are only parsed
+
+    // A declaration which does not parse has no node, and the text up to 'next' is skipped. The error is kept relative
+    // to the source, in case the declaration moved.
+    char    *error;
+    uint32_t error_offset;
+} DocumentDecl;
+
+// An identifier of a moved declaration referring to a global outside of it
+typedef struct {
+    uint32_t atom;       // Index in Ast.atoms
+    NodeId   definition; // Zero if the global was parsed again, and has to be found by name
+    NodeKind kind;
+} DocumentRef;
+
+typedef struct {
+    const char *path;
+
+    // A copy of the last text, since whoever changes it has usually done so by the time they are compared
+    char    *source;
+    size_t   count;
+    uint32_t base;
+
+    Ast     ast;
+    Context context;
+
+    struct {
+        DocumentDecl *data;
+        size_t        count;
+        size_t        capacity;
+    } decls;
+
+    size_t       kept;    // Declarations the last update left where they were in the tree
+    size_t       parsed;  // Declarations the last update parsed
+    size_t       checked; // Declarations the last update checked
+    Diagnostics *error;   // First error in source order, NULL if there is none
+
+    // Scratch space of updates, kept for its capacity
+    Ast tail;
+    struct {
+        DocumentRef *data;
+        size_t       count;
+        size_t       capacity;
+    } refs, pending;
+} Document;
+
+void document_init(Document *d, const char *path);
+void document_free(Document *d);
+
+// Brings the tree up to date with the new text, returning false if it has an error
+bool document_update(Document *d, SV sv);
+
+// The identifier, function or variable whose name covers the offset, relative to the source. Only declarations before
+// the first error are searched, so the types and definitions of what is found hold. Zero if there is none.
+NodeId document_find(const Document *d, uint32_t offset);
+
+#endif // DOCUMENT_H
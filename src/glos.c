@@ -0,0 +1,87 @@
+#include "checker.h"
+#include "compiler.h"
+#include "glos.h"
+#include "parser.h"
+
+typedef enum {
+    EMIT_NONE,
+    EMIT_FILE,
+    EMIT_MEMORY,
+} Emit;
+
+// Every position inside one compilation belongs to the source being compiled, which is still registered
+static void diagnostics_convert(GlosResult *r, const Diagnostics *error) {
+    for (size_t i = 0; i < error->count; i++) {
+        const Diagnostic *it = &error->data[i];
+
+        GlosDiagnostic d = {.severity = it->severity == SEVERITY_NOTE ? GLOS_NOTE : GLOS_ERROR};
+        if (it->offset != OFFSET_NONE) {
+            const Pos pos = source_pos(it->offset);
+            d.row = pos.row + 1;
+            d.col = pos.col + 1;
+        }
+
+        d.message = strdup(it->message);
+        assert(d.message);
+        da_push(&r->diagnostics, d);
+    }
+}
+
+static bool glos_compile(const char *name, SV source, Emit emit, const char *output, GlosResult *result) {
+    memset(result, 0, sizeof(*result));
+
+    const ArenaMark temp = temp_save();
+
+    Lexer l = {0};
+    lexer_init(&l, name, source);
+
+    Ast     ast = {0};
+    Parser  p = {.ast = &ast};
+    Context c = {.ast = &ast};
+
+    Diagnostics *error = NULL;
+    if (!parse_file(&p, l)) {
+        error = p.error;
+    } else if (!check_nodes(&c, p.nodes)) {
+        error = c.error;
+    } else if (emit == EMIT_FILE && !compile_nodes(&c, output)) {
+        error = c.error;
+    } else if (emit == EMIT_MEMORY && !compile_nodes_memory(&c, &result->program, &result->program_size)) {
+        error = c.error;
+    }
+
+    if (error) {
+        diagnostics_convert(result, error);
+        diagnostics_free(error);
+    }
+    result->ok = !error;
+
+    parser_free(&p);
+    context_free(&c);
+    ast_free(&ast);
+    source_remove(l.base);
+
+    temp_restore(temp);
+    return result->ok;
+}
+
+bool glos_check(const char *name, const char *source, size_t size, GlosResult *result) {
+    return glos_compile(name, (SV) {source, size}, EMIT_NONE, NULL, result);
+}
+
+bool glos_emit_file(const char *name, const char *source, size_t size, const char *output, GlosResult *result) {
+    return glos_compile(name, (SV) {source, size}, EMIT_FILE, output, result);
+}
+
+bool glos_emit_memory(const char *name, const char *source, size_t size, GlosResult *result) {
+    return glos_compile(name, (SV) {source, size}, EMIT_MEMORY, NULL, result);
+}
+
+void glos_result_free(GlosResult *result) {
+    for (size_t i = 0; i < result->diagnostics.count; i++) {
+        free(result->diagnostics.data[i].message);
+    }
+    da_free(&result->diagnostics);
+    free(result->program);
+    memset(result, 0, sizeof(*result));
+}
@@ -0,0 +1,50 @@
+#ifndef GLOS_H
+#define GLOS_H
+
+// In-process interface to the compiler, archived into libglos.a by 'make libglos.a'. Programs using it also link
+// against libqbe and pthread. Every entry point may be called from several threads at once.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    GLOS_ERROR,
+    GLOS_NOTE,
+} GlosSeverity;
+
+typedef struct {
+    GlosSeverity severity;
+
+    // One-based position in the source. Both are zero for diagnostics about the program as a whole, like a missing
+    // 'main' function.
+    size_t row;
+    size_t col;
+
+    char *message;
+} GlosDiagnostic;
+
+typedef struct {
+    bool ok;
+
+    // A note always follows the error it belongs to
+    struct {
+        GlosDiagnostic *data;
+        size_t          count;
+        size_t          capacity;
+    } diagnostics;
+
+    // Set by glos_emit_memory() only
+    char  *program;
+    size_t program_size;
+} GlosResult;
+
+// The source is read from memory and only needs to live until the call returns. The name labels it in diagnostics and
+// debug info, it need not exist on disk. Each returns whether the source compiled, and the result must be freed with
+// glos_result_free() either way.
+bool glos_check(const char *name, const char *source, size_t size, GlosResult *result);
+bool glos_emit_file(const char *name, const char *source, size_t size, const char *output, GlosResult *result);
+bool glos_emit_memory(const char *name, const char *source, size_t size, GlosResult *result);
+
+void glos_result_free(GlosResult *result);
+
+#endif // GLOS_H
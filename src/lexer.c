@@ -1,108 +1,270 @@
 #include <ctype.h>
-#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#    include <immintrin.h>
+#endif
 
 #include "lexer.h"
 
 bool lexer_open(Lexer *l, const char *path) {
-    if (!read_file(&l->sv, path)) {
+    File file = {0};
+    if (!read_file(&file, path)) {
         return false;
     }
 
-    l->pos.path = path;
+    lexer_init(l, strcmp(path, "-") ? path : "<stdin>", file.sv);
+    l->file = file;
     return true;
 }
 
-void lexer_buffer(Lexer *l, Token token) {
-    l->peeked = true;
-    l->buffer = token;
+void lexer_close(Lexer *l) {
+    source_remove(l->base);
+    free_file(&l->file);
 }
 
-void lexer_unbuffer(Lexer *l) {
-    l->peeked = false;
+void lexer_init(Lexer *l, const char *path, SV sv) {
+    *l = (Lexer) {0};
+    l->sv = sv;
+    l->start = sv.data;
+    l->base = source_add(path, sv);
 }
 
-static bool isident(char ch) {
-    return isalnum(ch) || ch == '_';
+// Character Classes
+enum {
+    CLASS_BLANK = 1 << 0,
+    CLASS_NEWLINE = 1 << 1,
+    CLASS_DIGIT = 1 << 2,
+    CLASS_IDENT = 1 << 3,
+};
+
+#define CLASS_ALPHA(c) ((((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z') || (c) == '_')
+
+#define CLASS_OF(c)                                                                                                    \
+    ((c) == ' ' || (c) == '\t' || (c) == '\r' ? CLASS_BLANK                                                            \
+     : (c) == '\n'                            ? CLASS_NEWLINE                                                          \
+     : (c) >= '0' && (c) <= '9'               ? CLASS_DIGIT | CLASS_IDENT                                              \
+     : CLASS_ALPHA(c)                         ? CLASS_IDENT                                                            \
+                                              : 0)
+
+#define CLASS_ROW(c)                                                                                                   \
+    CLASS_OF(c + 0x0), CLASS_OF(c + 0x1), CLASS_OF(c + 0x2), CLASS_OF(c + 0x3), CLASS_OF(c + 0x4), CLASS_OF(c + 0x5),  \
+        CLASS_OF(c + 0x6), CLASS_OF(c + 0x7), CLASS_OF(c + 0x8), CLASS_OF(c + 0x9), CLASS_OF(c + 0xa),                 \
+        CLASS_OF(c + 0xb), CLASS_OF(c + 0xc), CLASS_OF(c + 0xd), CLASS_OF(c + 0xe), CLASS_OF(c + 0xf)
+
+// Bytes from 0x80 upwards are left zeroed, which makes them invalid everywhere
+static const unsigned char classes[256] = {
+    CLASS_ROW(0x00),
+    CLASS_ROW(0x10),
+    CLASS_ROW(0x20),
+    CLASS_ROW(0x30),
+    CLASS_ROW(0x40),
+    CLASS_ROW(0x50),
+    CLASS_ROW(0x60),
+    CLASS_ROW(0x70),
+};
+
+static bool char_is(char ch, int class) {
+    return classes[(unsigned char) ch] & class;
 }
 
-static void next_char(Lexer *l) {
-    if (*l->sv.data == '\n') {
-        if (l->sv.count > 1) {
-            l->pos.row++;
-            l->pos.col = 0;
-        }
-    } else {
-        l->pos.col++;
-    }
+// Block Scanners
+//
+// Classify BLOCK_SIZE bytes at once into a bitmask, one bit per byte. Callers only load whole blocks which lie inside
+// the source and finish the tail through the table, so nothing past the end is ever read.
+#if defined(__AVX2__)
+#    define BLOCK_SIZE 32
+
+typedef __m256i  Block;
+typedef uint32_t BlockMask;
+
+#    define block_load(p)   _mm256_loadu_si256((const __m256i *) (p))
+#    define block_set(c)    _mm256_set1_epi8(c)
+#    define block_eq(a, b)  _mm256_cmpeq_epi8((a), (b))
+#    define block_gt(a, b)  _mm256_cmpgt_epi8((a), (b))
+#    define block_and(a, b) _mm256_and_si256((a), (b))
+#    define block_or(a, b)  _mm256_or_si256((a), (b))
+#    define block_mask(a)   ((BlockMask) _mm256_movemask_epi8(a))
+#elif defined(__SSE2__)
+#    define BLOCK_SIZE 16
+
+typedef __m128i  Block;
+typedef uint32_t BlockMask;
+
+#    define block_load(p)   _mm_loadu_si128((const __m128i *) (p))
+#    define block_set(c)    _mm_set1_epi8(c)
+#    define block_eq(a, b)  _mm_cmpeq_epi8((a), (b))
+#    define block_gt(a, b)  _mm_cmpgt_epi8((a), (b))
+#    define block_and(a, b) _mm_and_si128((a), (b))
+#    define block_or(a, b)  _mm_or_si128((a), (b))
+#    define block_mask(a)   ((BlockMask) _mm_movemask_epi8(a))
+#endif
+
+#ifdef BLOCK_SIZE
+#    define BLOCK_FULL ((BlockMask) ((1ull << BLOCK_SIZE) - 1))
+
+// Bytes at or above 0x80 compare as negative, so they never fall inside an ASCII range
+static Block block_range(Block b, char lo, char hi) {
+    return block_and(block_gt(b, block_set(lo - 1)), block_gt(block_set(hi + 1), b));
+}
 
-    l->sv.data++;
-    l->sv.count--;
+static BlockMask block_digit(Block b) {
+    return block_mask(block_range(b, '0', '9'));
 }
 
-static char peek_char(Lexer *l, size_t n) {
-    if (l->sv.count > n) {
-        return l->sv.data[n];
+static BlockMask block_ident(Block b) {
+    const Block alpha = block_range(block_or(b, block_set(0x20)), 'a', 'z');
+    return block_mask(block_or(block_or(alpha, block_range(b, '0', '9')), block_eq(b, block_set('_'))));
+}
+
+static BlockMask block_blank(Block b) {
+    const Block space = block_or(block_eq(b, block_set(' ')), block_eq(b, block_set('\t')));
+    return block_mask(block_or(space, block_eq(b, block_set('\r'))));
+}
+
+static BlockMask block_newline(Block b) {
+    return block_mask(block_eq(b, block_set('\n')));
+}
+#endif
+
+static size_t scan_class(const char *data, size_t count, int class) {
+    size_t i = 0;
+
+#ifdef BLOCK_SIZE
+    // Most identifiers and literals are short, and finishing those through the table is cheaper than a block
+    while (i < 8 && i < count && char_is(data[i], class)) {
+        i++;
     }
 
-    return 0;
+    if (i < 8) {
+        return i;
+    }
+
+    while (i + BLOCK_SIZE <= count) {
+        const Block     b = block_load(&data[i]);
+        const BlockMask m = class == CLASS_DIGIT ? block_digit(b) : block_ident(b);
+        if (m != BLOCK_FULL) {
+            return i + __builtin_ctz(~m);
+        }
+        i += BLOCK_SIZE;
+    }
+#endif
+
+    while (i < count && char_is(data[i], class)) {
+        i++;
+    }
+    return i;
 }
 
-static char read_char(Lexer *l) {
-    next_char(l);
-    return l->sv.data[-1];
+// Indentation and blank lines come in runs, so after a newline whole blocks are skipped at once
+static const char *skip_blank_lines(const char *data, const char *end) {
+#ifdef BLOCK_SIZE
+    while (end - data >= BLOCK_SIZE) {
+        const Block     b = block_load(data);
+        const BlockMask m = block_blank(b) | block_newline(b);
+        if (m != BLOCK_FULL) {
+            return data + __builtin_ctz(~m);
+        }
+        data += BLOCK_SIZE;
+    }
+#else
+    unused(end);
+#endif
+
+    return data;
 }
 
 static void skip_whitespace(Lexer *l) {
     l->newline = false;
-    while (l->sv.count) {
-        switch (*l->sv.data) {
-        case ' ':
-        case '\t':
-        case '\r':
-            next_char(l);
-            break;
 
-        case '\n':
-            next_char(l);
+    const char *data = l->sv.data;
+    const char *end = data + l->sv.count;
+    while (data < end) {
+        if (char_is(*data, CLASS_BLANK)) {
+            data++;
+        } else if (*data == '\n') {
             l->newline = true;
+            data = skip_blank_lines(data + 1, end);
+        } else if (*data == '/' && data + 1 < end && data[1] == '/') {
+            const char *eol = memchr(data, '\n', end - data);
+            data = eol ? eol : end;
+        } else {
             break;
+        }
+    }
 
-        case '/':
-            if (peek_char(l, 1) == '/') {
-                while (l->sv.count && *l->sv.data != '\n') {
-                    next_char(l);
-                }
-            } else {
-                return;
-            }
-            break;
+    l->sv.count -= data - l->sv.data;
+    l->sv.data = data;
+}
 
-        default:
-            return;
-        }
+// Keywords
+//
+// (length * 6 + first) is collision free over the keyword set, so a lookup is one probe and one compare. Adding a
+// keyword which collides trips -Woverride-init on the table below.
+#define KEYWORD_HASH(n, ch) ((((n) * 6) + (unsigned char) (ch)) & 31)
+
+typedef struct {
+    const char *name;
+    size_t      count;
+    TokenKind   kind;
+    bool        boolean;
+} Keyword;
+
+#define KEYWORD(ch, s, k, b)                                                                                           \
+    [KEYWORD_HASH(sizeof(s) - 1, ch)] = {.name = s, .count = sizeof(s) - 1, .kind = k, .boolean = b}
+
+static_assert(COUNT_TOKENS == 22, "");
+static const Keyword keywords[32] = {
+    KEYWORD('t', "true", TOKEN_BOOL, true),
+    KEYWORD('f', "false", TOKEN_BOOL, false),
+    KEYWORD('i', "if", TOKEN_IF, false),
+    KEYWORD('e', "else", TOKEN_ELSE, false),
+    KEYWORD('r', "return", TOKEN_RETURN, false),
+    KEYWORD('f', "fn", TOKEN_FN, false),
+    KEYWORD('v', "var", TOKEN_VAR, false),
+    KEYWORD('i', "import", TOKEN_IMPORT, false),
+    KEYWORD('p', "print", TOKEN_PRINT, false),
+};
+
+static const Keyword *keyword_find(SV sv) {
+    const Keyword *k = &keywords[KEYWORD_HASH(sv.count, *sv.data)];
+    if (k->count == sv.count && memcmp(k->name, sv.data, sv.count) == 0) {
+        return k;
     }
+    return NULL;
 }
 
-static void error_invalid(Pos pos, char ch, const char *label) {
+static uint32_t lexer_offset(const Lexer *l, const char *at) {
+    return l->base + (at - l->start);
+}
+
+// Lexing stops at the first error, which ends the stream with TOKEN_EOF and leaves the message in 'error'
+static Token lexer_fail(Lexer *l, Token token, uint32_t offset, const char *error) {
+    l->error = error;
+    l->error_offset = offset;
+    l->sv.data += l->sv.count;
+    l->sv.count = 0;
+
+    token.kind = TOKEN_EOF;
+    token.sv.count = 0;
+    return token;
+}
+
+static Token error_invalid(Lexer *l, Token token, uint32_t offset, char ch, const char *label) {
     if (isprint(ch)) {
-        fprintf(stderr, PosFmt "ERROR: Invalid %s '%c'\n", PosArg(pos), label, ch);
-    } else {
-        fprintf(stderr, PosFmt "ERROR: Invalid %s (%d)\n", PosArg(pos), label, ch);
+        return lexer_fail(l, token, offset, temp_sprintf("Invalid %s '%c'", label, ch));
     }
 
-    exit(1);
+    return lexer_fail(l, token, offset, temp_sprintf("Invalid %s (%d)", label, ch));
 }
 
-static_assert(COUNT_TOKENS == 21, "");
+static_assert(COUNT_TOKENS == 22, "");
 Token lexer_next(Lexer *l) {
-    if (l->peeked) {
-        lexer_unbuffer(l);
-        return l->buffer;
-    }
     skip_whitespace(l);
 
     Token token = {
-        .pos = l->pos,
+        .offset = lexer_offset(l, l->sv.data),
         .sv = l->sv,
         .newline = l->newline,
     };
@@ -111,65 +273,56 @@ Token lexer_next(Lexer *l) {
         return token;
     }
 
-    if (isdigit(*l->sv.data)) {
+    const char ch = *l->sv.data;
+    if (char_is(ch, CLASS_DIGIT)) {
         token.kind = TOKEN_INT;
-        while (l->sv.count > 0 && isdigit(*l->sv.data)) {
-            next_char(l);
-        }
-        token.sv.count -= l->sv.count;
+        token.sv.count = scan_class(l->sv.data, l->sv.count, CLASS_DIGIT);
+        l->sv.data += token.sv.count;
+        l->sv.count -= token.sv.count;
 
-        if (l->sv.count && isident(*l->sv.data)) {
-            error_invalid(l->pos, *l->sv.data, "digit");
+        if (l->sv.count && char_is(*l->sv.data, CLASS_IDENT)) {
+            return error_invalid(l, token, lexer_offset(l, l->sv.data), *l->sv.data, "digit");
         }
 
-        char buffer[32] = {0};
-        if (token.sv.count < sizeof(buffer) - 1) {
-            memcpy(buffer, token.sv.data, token.sv.count);
-
-            errno = 0;
-            token.as.integer = strtol(buffer, NULL, 10);
-
-            if (!errno) {
-                return token;
+        size_t value = 0;
+        for (size_t i = 0; i < token.sv.count; i++) {
+            const size_t digit = token.sv.data[i] - '0';
+            if (value > (LONG_MAX - digit) / 10) {
+                return lexer_fail(
+                    l,
+                    token,
+                    token.offset,
+                    temp_sprintf("Integer literal '" SVFmt "' is too large", SVArg(token.sv)));
             }
+            value = value * 10 + digit;
         }
 
-        fprintf(stderr, PosFmt "ERROR: Integer literal '" SVFmt "' is too large\n", PosArg(token.pos), SVArg(token.sv));
-        exit(1);
+        token.as.integer = value;
+        return token;
     }
 
-    if (isident(*l->sv.data)) {
-        while (l->sv.count > 0 && isident(*l->sv.data)) {
-            next_char(l);
-        }
-        token.sv.count -= l->sv.count;
-
-        if (sv_match(token.sv, "true")) {
-            token.kind = TOKEN_BOOL;
-            token.as.boolean = 1;
-        } else if (sv_match(token.sv, "false")) {
-            token.kind = TOKEN_BOOL;
-            token.as.boolean = 0;
-        } else if (sv_match(token.sv, "if")) {
-            token.kind = TOKEN_IF;
-        } else if (sv_match(token.sv, "else")) {
-            token.kind = TOKEN_ELSE;
-        } else if (sv_match(token.sv, "return")) {
-            token.kind = TOKEN_RETURN;
-        } else if (sv_match(token.sv, "fn")) {
-            token.kind = TOKEN_FN;
-        } else if (sv_match(token.sv, "var")) {
-            token.kind = TOKEN_VAR;
-        } else if (sv_match(token.sv, "print")) {
-            token.kind = TOKEN_PRINT;
+    if (char_is(ch, CLASS_IDENT)) {
+        token.kind = TOKEN_IDENT;
+        token.sv.count = scan_class(l->sv.data, l->sv.count, CLASS_IDENT);
+        l->sv.data += token.sv.count;
+        l->sv.count -= token.sv.count;
+
+        const Keyword *keyword = keyword_find(token.sv);
+        if (keyword) {
+            token.kind = keyword->kind;
+            token.as.boolean = keyword->boolean;
         } else {
-            token.kind = TOKEN_IDENT;
+            token.as.symbol = symbol_intern(token.sv);
         }
 
         return token;
     }
 
-    switch (read_char(l)) {
+    l->sv.data++;
+    l->sv.count--;
+    token.sv.count = 1;
+
+    switch (ch) {
     case ';':
         token.kind = TOKEN_EOL;
         break;
@@ -215,44 +368,30 @@ Token lexer_next(Lexer *l) {
         break;
 
     default:
-        error_invalid(token.pos, *token.sv.data, "character");
-        break;
+        return error_invalid(l, token, token.offset, ch, "character");
     }
 
-    token.sv.count -= l->sv.count;
     return token;
 }
 
-Token lexer_peek(Lexer *l) {
-    if (!l->peeked) {
-        lexer_buffer(l, lexer_next(l));
-    }
-    return l->buffer;
+void lexer_tokenize(Lexer *l, Tokens *out) {
+    while (!lexer_fill(l, out, SIZE_MAX));
 }
 
-bool lexer_read(Lexer *l, TokenKind kind) {
-    lexer_peek(l);
-    l->peeked = l->buffer.kind != kind;
-    return !l->peeked;
-}
+bool lexer_fill(Lexer *l, Tokens *out, size_t count) {
+    out->start = l->start;
+    out->base = l->base;
 
-Token lexer_expect_impl(Lexer *l, const TokenKind *kinds) {
-    const Token token = lexer_next(l);
-    for (const TokenKind *it = kinds; *it != TOKEN_EOF; it++) {
-        if (token.kind == *it) {
-            return token;
-        }
-    }
+    for (size_t i = 0; i < count; i++) {
+        const Token token = lexer_next(l);
+        tokens_push(out, token);
 
-    fprintf(stderr, PosFmt "ERROR: Expected ", PosArg(token.pos));
-    for (const TokenKind *it = kinds; *it != TOKEN_EOF; it++) {
-        if (it != kinds) {
-            fprintf(stderr, " or ");
+        if (token.kind == TOKEN_EOF) {
+            out->error = l->error;
+            out->error_offset = l->error_offset;
+            return true;
         }
-
-        fprintf(stderr, "%s", token_kind_to_cstr(*it));
     }
 
-    fprintf(stderr, ", got %s\n", token_kind_to_cstr(token.kind));
-    exit(1);
+    return false;
 }
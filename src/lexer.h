@@ -4,24 +4,27 @@
 #include "token.h"
 
 typedef struct {
-    Pos  pos;
-    SV   sv;
-    bool newline;
-
-    bool  peeked;
-    Token buffer;
+    SV          sv;
+    const char *start;
+    uint32_t    base;
+    bool        newline;
+    const char *error; // Message of the error which ended the stream, positioned at 'error_offset'
+    uint32_t    error_offset;
+    File        file; // Set by lexer_open()
 } Lexer;
 
 bool lexer_open(Lexer *l, const char *path);
+void lexer_init(Lexer *l, const char *path, SV sv);
 
-void lexer_buffer(Lexer *l, Token token);
-void lexer_unbuffer(Lexer *l);
+// Releases what lexer_open() took, the file and its range of offsets. Positions inside it can no longer be printed.
+void lexer_close(Lexer *l);
 
 Token lexer_next(Lexer *l);
-Token lexer_peek(Lexer *l);
-bool  lexer_read(Lexer *l, TokenKind kind);
 
-Token lexer_expect_impl(Lexer *l, const TokenKind *kinds);
-#define lexer_expect(l, ...) lexer_expect_impl((l), (const TokenKind[]) {__VA_ARGS__, TOKEN_EOF})
+// Lexes the rest of the source in one pass, the stream always ends with TOKEN_EOF
+void lexer_tokenize(Lexer *l, Tokens *out);
+
+// Lexes at most 'count' more tokens, stopping early at TOKEN_EOF. Returns whether the stream has ended.
+bool lexer_fill(Lexer *l, Tokens *out, size_t count);
 
 #endif // LEXER_H
@@ -0,0 +1,884 @@
+#include <stdarg.h>
+#include <strings.h>
+
+#include "document.h"
+#include "lsp.h"
+
+// JSON
+
+typedef enum {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} JsonKind;
+
+typedef struct Json Json;
+
+// Values are allocated from the temporary arena, which is restored once the message is handled
+struct Json {
+    JsonKind kind;
+    SV       raw;  // Text of the whole value
+    SV       key;  // Set on the members of an object
+    Json    *next; // Next item of the array or object holding it
+
+    union {
+        bool    boolean;
+        double  number;
+        SV      string;
+        Json   *items;
+    } as;
+};
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct {
+    const char *at;
+    const char *end;
+    size_t      depth;
+} JsonParser;
+
+static void json_space(JsonParser *j) {
+    while (j->at < j->end && (*j->at == ' ' || *j->at == '\t' || *j->at == '\n' || *j->at == '\r')) {
+        j->at++;
+    }
+}
+
+static bool json_hex(JsonParser *j, uint32_t *out) {
+    if (j->end - j->at < 4) {
+        return false;
+    }
+
+    *out = 0;
+    for (size_t i = 0; i < 4; i++) {
+        const char ch = *j->at++;
+        if (ch >= '0' && ch <= '9') {
+            *out = *out * 16 + (ch - '0');
+        } else if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f') {
+            *out = *out * 16 + ((ch | 0x20) - 'a' + 10);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t utf8_encode(char *out, uint32_t cp) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+
+    if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+// Escapes only ever shrink, so the decoded string fits in as many bytes as the quoted one
+static bool json_string(JsonParser *j, SV *out) {
+    if (j->at >= j->end || *j->at != '"') {
+        return false;
+    }
+    j->at++;
+
+    const char *close = j->at;
+    while (close < j->end && *close != '"') {
+        close += *close == '\\' ? 2 : 1;
+    }
+
+    if (close >= j->end) {
+        return false;
+    }
+
+    char  *data = temp_alloc(close - j->at + 1);
+    size_t count = 0;
+    while (j->at < close) {
+        const char ch = *j->at++;
+        if (ch != '\\') {
+            data[count++] = ch;
+            continue;
+        }
+
+        uint32_t cp = 0;
+        switch (*j->at++) {
+        case '"':
+            data[count++] = '"';
+            break;
+
+        case '\\':
+            data[count++] = '\\';
+            break;
+
+        case '/':
+            data[count++] = '/';
+            break;
+
+        case 'b':
+            data[count++] = '\b';
+            break;
+
+        case 'f':
+            data[count++] = '\f';
+            break;
+
+        case 'n':
+            data[count++] = '\n';
+            break;
+
+        case 'r':
+            data[count++] = '\r';
+            break;
+
+        case 't':
+            data[count++] = '\t';
+            break;
+
+        case 'u':
+            if (!json_hex(j, &cp)) {
+                return false;
+            }
+
+            // Characters past the first plane come as a pair of surrogates
+            uint32_t low = 0;
+            if (cp >= 0xD800 && cp < 0xDC00 && close - j->at >= 6 && j->at[0] == '\\' && j->at[1] == 'u') {
+                j->at += 2;
+                if (!json_hex(j, &low) || low < 0xDC00 || low >= 0xE000) {
+                    return false;
+                }
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            count += utf8_encode(data + count, cp);
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    j->at = close + 1;
+    *out = (SV) {data, count};
+    return true;
+}
+
+static Json *json_value(JsonParser *j);
+
+static Json *json_items(JsonParser *j, Json *json, char close, bool keys) {
+    j->at++;
+    json_space(j);
+    if (j->at < j->end && *j->at == close) {
+        j->at++;
+        return json;
+    }
+
+    Json **last = &json->as.items;
+    while (true) {
+        SV key = {0};
+        if (keys) {
+            json_space(j);
+            if (!json_string(j, &key)) {
+                return NULL;
+            }
+
+            json_space(j);
+            if (j->at >= j->end || *j->at++ != ':') {
+                return NULL;
+            }
+        }
+
+        Json *item = json_value(j);
+        if (!item) {
+            return NULL;
+        }
+        item->key = key;
+        *last = item;
+        last = &item->next;
+
+        json_space(j);
+        if (j->at >= j->end) {
+            return NULL;
+        }
+
+        const char ch = *j->at++;
+        if (ch == close) {
+            return json;
+        }
+
+        if (ch != ',') {
+            return NULL;
+        }
+    }
+}
+
+static bool json_literal(JsonParser *j, const char *literal) {
+    const size_t n = strlen(literal);
+    if ((size_t) (j->end - j->at) < n || memcmp(j->at, literal, n)) {
+        return false;
+    }
+    j->at += n;
+    return true;
+}
+
+static Json *json_value(JsonParser *j) {
+    json_space(j);
+    if (j->at >= j->end || j->depth >= JSON_MAX_DEPTH) {
+        return NULL;
+    }
+
+    Json *json = temp_alloc(sizeof(*json));
+    memset(json, 0, sizeof(*json));
+
+    const char *start = j->at;
+    switch (*j->at) {
+    case '{':
+    case '[':
+        json->kind = *j->at == '{' ? JSON_OBJECT : JSON_ARRAY;
+        j->depth++;
+        json = json_items(j, json, *j->at == '{' ? '}' : ']', *j->at == '{');
+        j->depth--;
+        break;
+
+    case '"':
+        json->kind = JSON_STRING;
+        if (!json_string(j, &json->as.string)) {
+            json = NULL;
+        }
+        break;
+
+    case 't':
+    case 'f':
+        json->kind = JSON_BOOL;
+        json->as.boolean = *j->at == 't';
+        if (!json_literal(j, json->as.boolean ? "true" : "false")) {
+            json = NULL;
+        }
+        break;
+
+    case 'n':
+        json->kind = JSON_NULL;
+        if (!json_literal(j, "null")) {
+            json = NULL;
+        }
+        break;
+
+    default: {
+        // Messages are read with a terminator past their end, so strtod() stops in time
+        char *end = NULL;
+        json->kind = JSON_NUMBER;
+        json->as.number = strtod(j->at, &end);
+        if (end == j->at || end > j->end) {
+            return NULL;
+        }
+        j->at = end;
+    } break;
+    }
+
+    if (json) {
+        json->raw = (SV) {start, j->at - start};
+    }
+    return json;
+}
+
+static Json *json_parse(SV sv) {
+    JsonParser j = {.at = sv.data, .end = sv.data + sv.count};
+    Json      *json = json_value(&j);
+    json_space(&j);
+    return j.at == j.end ? json : NULL;
+}
+
+static Json *json_get(const Json *json, const char *key) {
+    if (!json || json->kind != JSON_OBJECT) {
+        return NULL;
+    }
+
+    for (Json *it = json->as.items; it; it = it->next) {
+        if (sv_match(it->key, key)) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+static SV json_str(const Json *json) {
+    return json && json->kind == JSON_STRING ? json->as.string : (SV) {0};
+}
+
+static size_t json_size(const Json *json) {
+    return json && json->kind == JSON_NUMBER && json->as.number > 0 ? (size_t) json->as.number : 0;
+}
+
+// Responses are built up in one buffer, then sent with their header
+typedef struct {
+    char  *data;
+    size_t count;
+    size_t capacity;
+} Out;
+
+__attribute__((format(printf, 2, 3))) static void out_printf(Out *o, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    assert(n >= 0);
+    da_grow(o, (size_t) n + 1);
+
+    va_start(args, fmt);
+    vsnprintf(o->data + o->count, n + 1, fmt, args);
+    va_end(args);
+    o->count += n;
+}
+
+static void out_string(Out *o, SV s) {
+    da_push(o, '"');
+    for (size_t i = 0; i < s.count; i++) {
+        const unsigned char ch = s.data[i];
+        if (ch == '"' || ch == '\\') {
+            da_push(o, '\\');
+            da_push(o, ch);
+        } else if (ch == '\n') {
+            out_printf(o, "\\n");
+        } else if (ch < 0x20) {
+            out_printf(o, "\\u%04x", ch);
+        } else {
+            da_push(o, ch);
+        }
+    }
+    da_push(o, '"');
+}
+
+// Messages
+
+// Each message is a header, of which only the length matters, and a JSON body
+static char *message_read(size_t *count) {
+    size_t length = SIZE_MAX;
+    char   line[256];
+    while (fgets(line, sizeof(line), stdin)) {
+        if (!strcmp(line, "\r\n") || !strcmp(line, "\n")) {
+            if (length == SIZE_MAX) {
+                return NULL;
+            }
+
+            char *body = malloc(length + 1);
+            assert(body);
+            if (fread(body, 1, length, stdin) != length) {
+                free(body);
+                return NULL;
+            }
+
+            body[length] = '\0';
+            *count = length;
+            return body;
+        }
+
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            length = strtoull(line + 15, NULL, 10);
+        }
+    }
+    return NULL;
+}
+
+static void message_write(const Out *o) {
+    printf("Content-Length: %zu\r\n\r\n", o->count);
+    fwrite(o->data, 1, o->count, stdout);
+    fflush(stdout);
+}
+
+// Files
+
+typedef struct {
+    char    *uri;
+    char    *path;
+    Document document;
+
+    // The text as the client has it, which edits apply to before the document is brought up to date
+    struct {
+        char  *data;
+        size_t count;
+        size_t capacity;
+    } text;
+} LspFile;
+
+typedef struct {
+    struct {
+        LspFile **data;
+        size_t    count;
+        size_t    capacity;
+    } files;
+
+    // Positions count UTF-16 code units by default, bytes if the client takes them
+    bool utf8;
+    bool shutdown;
+    Out  out;
+} Lsp;
+
+static int hex_digit(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+
+    if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f') {
+        return (ch | 0x20) - 'a' + 10;
+    }
+    return -1;
+}
+
+// Anything but a file URI is taken as a path as it is
+static char *uri_to_path(SV uri) {
+    const SV scheme = sv_from_cstr("file://");
+    if (uri.count >= scheme.count && !memcmp(uri.data, scheme.data, scheme.count)) {
+        uri.data += scheme.count;
+        uri.count -= scheme.count;
+    }
+
+    char  *path = malloc(uri.count + 1);
+    size_t count = 0;
+    assert(path);
+    for (size_t i = 0; i < uri.count; i++) {
+        if (uri.data[i] == '%' && i + 2 < uri.count && hex_digit(uri.data[i + 1]) >= 0 &&
+            hex_digit(uri.data[i + 2]) >= 0) {
+            path[count++] = hex_digit(uri.data[i + 1]) * 16 + hex_digit(uri.data[i + 2]);
+            i += 2;
+        } else {
+            path[count++] = uri.data[i];
+        }
+    }
+
+    path[count] = '\0';
+    return path;
+}
+
+static LspFile *lsp_file(const Lsp *lsp, const Json *params) {
+    const SV uri = json_str(json_get(json_get(params, "textDocument"), "uri"));
+    for (size_t i = 0; i < lsp->files.count; i++) {
+        if (sv_match(uri, lsp->files.data[i]->uri)) {
+            return lsp->files.data[i];
+        }
+    }
+    return NULL;
+}
+
+static void lsp_file_free(LspFile *f) {
+    document_free(&f->document);
+    da_free(&f->text);
+    free(f->uri);
+    free(f->path);
+    free(f);
+}
+
+// Positions
+
+static bool utf8_continuation(char ch) {
+    return (ch & 0xC0) == 0x80;
+}
+
+// Start of the line, or the end of the text if it has fewer lines
+static size_t line_start(SV text, size_t line) {
+    size_t at = 0;
+    while (line--) {
+        const char *newline = memchr(text.data + at, '\n', text.count - at);
+        if (!newline) {
+            return text.count;
+        }
+        at = newline - text.data + 1;
+    }
+    return at;
+}
+
+static size_t lsp_offset(const Lsp *lsp, SV text, const Json *position) {
+    size_t       at = line_start(text, json_size(json_get(position, "line")));
+    const size_t character = json_size(json_get(position, "character"));
+
+    // Characters past the end of the line mean its end
+    size_t units = 0;
+    while (at < text.count && text.data[at] != '\n' && units < character) {
+        const unsigned char ch = text.data[at++];
+        units += lsp->utf8 || ch < 0xF0 ? 1 : 2;
+        while (!lsp->utf8 && at < text.count && utf8_continuation(text.data[at])) {
+            at++;
+        }
+    }
+    return at;
+}
+
+static void out_position(const Lsp *lsp, Out *o, SV text, size_t offset) {
+    size_t line = 0;
+    size_t start = 0;
+    while (true) {
+        const char *newline = memchr(text.data + start, '\n', offset - start);
+        if (!newline) {
+            break;
+        }
+        start = newline - text.data + 1;
+        line++;
+    }
+
+    size_t character = 0;
+    for (size_t i = start; i < offset; i++) {
+        const unsigned char ch = text.data[i];
+        if (lsp->utf8) {
+            character++;
+        } else if (!utf8_continuation(ch)) {
+            character += ch >= 0xF0 ? 2 : 1;
+        }
+    }
+    out_printf(o, "{\"line\":%zu,\"character\":%zu}", line, character);
+}
+
+static void out_range(const Lsp *lsp, Out *o, SV text, size_t start, size_t end) {
+    out_printf(o, "{\"start\":");
+    out_position(lsp, o, text, start);
+    out_printf(o, ",\"end\":");
+    out_position(lsp, o, text, end);
+    out_printf(o, "}");
+}
+
+static bool ident_char(char ch) {
+    return ch == '_' || (ch >= '0' && ch <= '9') || ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'z');
+}
+
+// Errors only name where they start, so they cover the word there, or else the character
+static size_t error_end(SV text, size_t offset) {
+    size_t end = offset;
+    while (end < text.count && ident_char(text.data[end])) {
+        end++;
+    }
+
+    if (end == offset && end < text.count && text.data[end] != '\n') {
+        end++;
+        while (end < text.count && utf8_continuation(text.data[end])) {
+            end++;
+        }
+    }
+    return end;
+}
+
+// Diagnostics
+
+// An error is followed by the notes which belong to it, which become its related information
+static void out_diagnostics(const Lsp *lsp, Out *o, const LspFile *f) {
+    const Document    *d = &f->document;
+    const Diagnostics *error = d->error;
+    const SV           text = {d->source, d->count};
+
+    out_printf(o, "[");
+    for (size_t i = 0; error && i < error->count; i++) {
+        const Diagnostic *it = &error->data[i];
+        assert((it->severity == SEVERITY_NOTE) == (i > 0));
+
+        size_t offset = it->offset == OFFSET_NONE ? 0 : it->offset - d->base;
+        offset = offset < text.count ? offset : text.count;
+
+        if (i) {
+            out_printf(o, "%s{\"location\":{\"uri\":", i > 1 ? "," : "");
+            out_string(o, sv_from_cstr(f->uri));
+            out_printf(o, ",\"range\":");
+            out_range(lsp, o, text, offset, error_end(text, offset));
+            out_printf(o, "},\"message\":");
+            out_string(o, sv_from_cstr(it->message));
+            out_printf(o, "}");
+            continue;
+        }
+
+        out_printf(o, "{\"range\":");
+        out_range(lsp, o, text, offset, error_end(text, offset));
+        out_printf(o, ",\"severity\":1,\"source\":\"glos\",\"message\":");
+        out_string(o, sv_from_cstr(it->message));
+        out_printf(o, ",\"relatedInformation\":[");
+    }
+    out_printf(o, "%s]", error ? "]}" : "");
+}
+
+// Diagnostics are published after every change, empty once the file checks
+static void lsp_update(Lsp *lsp, LspFile *f) {
+    Document *d = &f->document;
+    document_update(d, (SV) {f->text.data, f->text.count});
+
+    Out *o = &lsp->out;
+    o->count = 0;
+    out_printf(o, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    out_string(o, sv_from_cstr(f->uri));
+    out_printf(o, ",\"diagnostics\":");
+    out_diagnostics(lsp, o, f);
+    out_printf(o, "}}");
+    message_write(o);
+}
+
+// Requests
+
+static void lsp_open(Lsp *lsp, const Json *params) {
+    const Json *document = json_get(params, "textDocument");
+    const SV    uri = json_str(json_get(document, "uri"));
+    const SV    text = json_str(json_get(document, "text"));
+
+    LspFile *f = lsp_file(lsp, params);
+    if (!f) {
+        f = calloc(1, sizeof(*f));
+        assert(f);
+        f->uri = strdup(temp_sv_to_cstr(uri));
+        f->path = uri_to_path(uri);
+        document_init(&f->document, f->path);
+        da_push(&lsp->files, f);
+    }
+
+    f->text.count = 0;
+    da_push_many(&f->text, text.data, text.count);
+    lsp_update(lsp, f);
+}
+
+// Changes either replace a range, given in positions of the text as the changes before left it, or the whole text
+static void lsp_change(Lsp *lsp, const Json *params) {
+    LspFile *f = lsp_file(lsp, params);
+    if (!f) {
+        return;
+    }
+
+    const Json *changes = json_get(params, "contentChanges");
+    for (const Json *it = changes ? changes->as.items : NULL; it; it = it->next) {
+        const SV    text = json_str(json_get(it, "text"));
+        const Json *range = json_get(it, "range");
+        if (!range) {
+            f->text.count = 0;
+            da_push_many(&f->text, text.data, text.count);
+            continue;
+        }
+
+        const SV     sv = {f->text.data, f->text.count};
+        const size_t from = lsp_offset(lsp, sv, json_get(range, "start"));
+        size_t       to = lsp_offset(lsp, sv, json_get(range, "end"));
+        to = to < from ? from : to;
+
+        const size_t rest = f->text.count - to;
+        if (text.count > to - from) {
+            da_grow(&f->text, text.count - (to - from));
+        }
+
+        memmove(f->text.data + from + text.count, f->text.data + to, rest);
+        memcpy(f->text.data + from, text.data, text.count);
+        f->text.count = from + text.count + rest;
+    }
+    lsp_update(lsp, f);
+}
+
+static void lsp_close(Lsp *lsp, const Json *params) {
+    LspFile *f = lsp_file(lsp, params);
+    if (!f) {
+        return;
+    }
+
+    Out *o = &lsp->out;
+    o->count = 0;
+    out_printf(o, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    out_string(o, sv_from_cstr(f->uri));
+    out_printf(o, ",\"diagnostics\":[]}}");
+    message_write(o);
+
+    for (size_t i = 0; i < lsp->files.count; i++) {
+        if (lsp->files.data[i] == f) {
+            lsp->files.data[i] = lsp->files.data[--lsp->files.count];
+            break;
+        }
+    }
+
+    lsp_file_free(f);
+}
+
+// The node under the cursor, or zero. Identifiers stand for what they were resolved to.
+static NodeId lsp_find(const Lsp *lsp, const LspFile *f, const Json *params, NodeId *definition) {
+    const Document *d = &f->document;
+    const size_t    offset = lsp_offset(lsp, (SV) {d->source, d->count}, json_get(params, "position"));
+
+    const NodeId id = document_find(d, offset);
+    *definition = id;
+    if (id && ast_node(&d->ast, id)->kind == NODE_ATOM) {
+        *definition = ast_atom(&d->ast, id)->definition;
+    }
+    return *definition ? id : 0;
+}
+
+static void out_name_range(const Lsp *lsp, Out *o, const Document *d, NodeId id) {
+    const Node  *n = ast_node(&d->ast, id);
+    const size_t start = n->offset - d->base;
+
+    Symbol name = 0;
+    if (n->kind == NODE_ATOM) {
+        name = ast_atom(&d->ast, id)->as.symbol;
+    } else if (n->kind == NODE_FN) {
+        name = ast_fn(&d->ast, id)->name;
+    } else {
+        name = ast_var(&d->ast, id)->name;
+    }
+    out_range(lsp, o, (SV) {d->source, d->count}, start, start + symbol_sv(name).count);
+}
+
+// Shown the way it is declared
+static const char *hover_text(const Ast *ast, NodeId id) {
+    const Node *n = ast_node(ast, id);
+    if (n->kind == NODE_FN) {
+        const NodeFn *fn = ast_fn(ast, id);
+        const NodeId *args = ast_list(ast, fn->args);
+
+        const char *s = temp_sprintf("fn " SVFmt "(", SVArg(symbol_sv(fn->name)));
+        for (size_t i = 0; i < fn->args.count; i++) {
+            const Node    *arg = ast_node(ast, args[i]);
+            const NodeVar *var = ast_var(ast, args[i]);
+            s = temp_sprintf("%s%s" SVFmt " %s", s, i ? ", " : "", SVArg(symbol_sv(var->name)),
+                             type_to_cstr(arg->type));
+        }
+
+        const Type ret = type_ret(n->type);
+        return ret == TYPE_ID_UNIT ? temp_sprintf("%s)", s) : temp_sprintf("%s) %s", s, type_to_cstr(ret));
+    }
+
+    const NodeVar *var = ast_var(ast, id);
+    return temp_sprintf("%s" SVFmt " %s", var->kind == NODE_VAR_ARG ? "" : "var ", SVArg(symbol_sv(var->name)),
+                        type_to_cstr(n->type));
+}
+
+static void lsp_hover(const Lsp *lsp, Out *o, const Json *params) {
+    const LspFile *f = lsp_file(lsp, params);
+
+    NodeId       definition = 0;
+    const NodeId id = f ? lsp_find(lsp, f, params, &definition) : 0;
+    if (!id) {
+        out_printf(o, "null");
+        return;
+    }
+
+    const Document *d = &f->document;
+    out_printf(o, "{\"contents\":{\"kind\":\"markdown\",\"value\":");
+    out_string(o, sv_from_cstr(temp_sprintf("```glos\n%s\n```", hover_text(&d->ast, definition))));
+    out_printf(o, "},\"range\":");
+    out_name_range(lsp, o, d, id);
+    out_printf(o, "}");
+}
+
+static void lsp_definition(const Lsp *lsp, Out *o, const Json *params) {
+    const LspFile *f = lsp_file(lsp, params);
+
+    NodeId definition = 0;
+    if (!f || !lsp_find(lsp, f, params, &definition)) {
+        out_printf(o, "null");
+        return;
+    }
+
+    out_printf(o, "{\"uri\":");
+    out_string(o, sv_from_cstr(f->uri));
+    out_printf(o, ",\"range\":");
+    out_name_range(lsp, o, &f->document, definition);
+    out_printf(o, "}");
+}
+
+static bool encodings_have_utf8(const Json *encodings) {
+    for (const Json *it = encodings && encodings->kind == JSON_ARRAY ? encodings->as.items : NULL; it; it = it->next) {
+        if (sv_match(json_str(it), "utf-8")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns whether the client asked to exit
+static bool lsp_handle(Lsp *lsp, SV body, int *status) {
+    Out *o = &lsp->out;
+    o->count = 0;
+
+    const Json *message = json_parse(body);
+    if (!message) {
+        out_printf(o, "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":-32700,\"message\":\"Parse error\"}}");
+        message_write(o);
+        return false;
+    }
+
+    const SV    method = json_str(json_get(message, "method"));
+    const Json *params = json_get(message, "params");
+    const Json *id = json_get(message, "id");
+
+    // Notifications get no response
+    if (!id) {
+        if (sv_match(method, "exit")) {
+            *status = lsp->shutdown ? 0 : 1;
+            return true;
+        } else if (sv_match(method, "textDocument/didOpen")) {
+            lsp_open(lsp, params);
+        } else if (sv_match(method, "textDocument/didChange")) {
+            lsp_change(lsp, params);
+        } else if (sv_match(method, "textDocument/didClose")) {
+            lsp_close(lsp, params);
+        }
+        return false;
+    }
+
+    out_printf(o, "{\"jsonrpc\":\"2.0\",\"id\":" SVFmt ",", SVArg(id->raw));
+    if (sv_match(method, "initialize")) {
+        const Json *general = json_get(json_get(params, "capabilities"), "general");
+        lsp->utf8 = encodings_have_utf8(json_get(general, "positionEncodings"));
+
+        out_printf(o, "\"result\":{\"capabilities\":{\"positionEncoding\":\"%s\",", lsp->utf8 ? "utf-8" : "utf-16");
+        out_printf(o, "\"textDocumentSync\":{\"openClose\":true,\"change\":2},");
+        out_printf(o, "\"hoverProvider\":true,\"definitionProvider\":true},\"serverInfo\":{\"name\":\"glos\"}}");
+    } else if (sv_match(method, "shutdown")) {
+        lsp->shutdown = true;
+        out_printf(o, "\"result\":null");
+    } else if (sv_match(method, "textDocument/hover")) {
+        out_printf(o, "\"result\":");
+        lsp_hover(lsp, o, params);
+    } else if (sv_match(method, "textDocument/definition")) {
+        out_printf(o, "\"result\":");
+        lsp_definition(lsp, o, params);
+    } else {
+        out_printf(o, "\"error\":{\"code\":-32601,\"message\":");
+        out_string(o, sv_from_cstr(temp_sprintf("Unsupported method '" SVFmt "'", SVArg(method))));
+        out_printf(o, "}");
+    }
+
+    out_printf(o, "}");
+    message_write(o);
+    return false;
+}
+
+int lsp_serve(void) {
+    Lsp lsp = {0};
+
+    int status = 1;
+    while (true) {
+        size_t count = 0;
+        char  *body = message_read(&count);
+        if (!body) {
+            break;
+        }
+
+        const ArenaMark temp = temp_save();
+        const bool      exit = lsp_handle(&lsp, (SV) {body, count}, &status);
+        temp_restore(temp);
+        free(body);
+
+        if (exit) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < lsp.files.count; i++) {
+        lsp_file_free(lsp.files.data[i]);
+    }
+
+    da_free(&lsp.files);
+    da_free(&lsp.out);
+    return status;
+}
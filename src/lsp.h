@@ -0,0 +1,10 @@
+#ifndef LSP_H
+#define LSP_H
+
+#include "basic.h"
+
+// Speaks the Language Server Protocol on stdin and stdout until the client exits, returning the exit status. Every
+// open file stays parsed and checked, so an edit only parses and checks again the declarations it touches.
+int lsp_serve(void);
+
+#endif // LSP_H
@@ -1,16 +1,41 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "astfile.h"
+#include "cache.h"
 #include "checker.h"
 #include "compiler.h"
+#include "lsp.h"
+#include "module.h"
 #include "parser.h"
+#include "server.h"
+#include "watch.h"
 
 static void usage(FILE *file) {
     fprintf(file, "Usage:\n");
     fprintf(file, "    glos COMMAND [...]\n\n");
     fprintf(file, "Commands:\n");
-    fprintf(file, "    help            Show this message\n");
-    fprintf(file, "    run   [FILE]    Run the program\n");
-    fprintf(file, "    build [FILE]    Compile the program\n");
+    fprintf(file, "    help               Show this message\n");
+    fprintf(file, "    run   [FILE]       Run the program\n");
+    fprintf(file, "    build [FILE...]    Compile the programs, directories are searched for .glos files\n");
+    fprintf(file, "    check [FILE]       Check the program without compiling it\n");
+    fprintf(file, "    watch [FILE]       Compile the program again whenever it is saved\n");
+    fprintf(file, "    serve              Compile programs for clients until killed\n");
+    fprintf(file, "    lsp                Serve editors over the Language Server Protocol on stdin and stdout\n");
+    fprintf(file, "    cache [ACTION]     Show the build cache with 'stats', or empty it with 'clear'\n\n");
+    fprintf(file, "Flags:\n");
+    fprintf(file, "    --stream           Compile each declaration as soon as it is parsed\n");
+    fprintf(file, "    --server           Have the compile server build the programs\n");
+    fprintf(file, "    --no-cache         Neither reuse nor keep programs in the build cache\n");
+    fprintf(file, "    --emit-ast         Save the checked program next to the source, for builds to pick up\n");
+    fprintf(file, "    -j [COUNT]         Compile up to COUNT programs at once, defaults to the number of CPUs\n\n");
+    fprintf(file, "Pass '-' as the FILE to read the program from stdin\n");
+    fprintf(file, "Programs can 'import NAME' to use NAME.glos next to them, only changed modules are checked again\n");
+    fprintf(file, "The compile server listens on $GLOS_SOCKET, or a socket private to the user if unset\n");
+    fprintf(file, "Built programs are cached in $XDG_CACHE_HOME/glos, up to $GLOS_CACHE_SIZE MiB\n");
 }
 
 static const char *shift(int *argc, char ***argv, const char *expected) {
@@ -24,10 +49,314 @@ static const char *shift(int *argc, char ***argv, const char *expected) {
     return *(*argv)++;
 }
 
+static _Noreturn void fail(char *error) {
+    fputs(error, stderr);
+    exit(1);
+}
+
+static _Noreturn void fail_diagnostics(const Diagnostics *error) {
+    fail(diagnostics_format(error));
+}
+
+// Builds which hand their diagnostics on format them while the sources are still registered
+static char *take_diagnostics(Diagnostics *error) {
+    char *text = diagnostics_format(error);
+    diagnostics_free(error);
+    return text;
+}
+
+// Streaming keeps only the declarations of earlier globals around, so memory is bounded by the largest declaration
+// rather than the whole file
+static void compile_streaming(Parser *p, Context *c, Lexer l, const char *output) {
+    Compiler comp;
+    compile_begin(&comp, c);
+    parse_begin(p, l);
+
+    while (true) {
+        const AstMark m = ast_mark(c->ast);
+        const size_t  globals = c->globals.count;
+
+        const NodeId id = parse_next(p);
+        if (!id) {
+            break;
+        }
+
+        if (!check_decl(c, id)) {
+            fail_diagnostics(c->error);
+        }
+        for (size_t i = globals; i < c->globals.count; i++) {
+            compile_decl(&comp, c->globals.data[i].node);
+        }
+        context_release(c, m, globals);
+    }
+
+    if (p->error) {
+        fail_diagnostics(p->error);
+    }
+
+    if (!compile_end(&comp, output)) {
+        fail_diagnostics(c->error);
+    }
+}
+
+static void compile(Parser *p, Context *c, Lexer l, bool stream, const char *output) {
+    if (stream) {
+        compile_streaming(p, c, l, output);
+    } else if (!compile_nodes(c, output)) {
+        fail_diagnostics(c->error);
+    }
+}
+
+static int run_program(const char *program, int argc, char **argv) {
+    Cmd cmd = {0};
+    da_push(&cmd, program);
+    da_push_many(&cmd, argv, argc);
+    return cmd_run(&cmd);
+}
+
+static int run_temporary(const char *program, int argc, char **argv) {
+    const int code = run_program(program, argc, argv);
+    remove(program);
+    return code;
+}
+
+static void build_remote(const char *server, const char *input, const char *output) {
+    char *error = server_build(server, input, output);
+    if (error) {
+        fail(error);
+    }
+}
+
+static const char *output_path(const char *input) {
+    if (!strcmp(input, "-")) {
+        return "a.out";
+    }
+    return temp_sv_to_cstr(sv_strip_suffix(sv_from_cstr(input), sv_from_cstr(".glos")));
+}
+
+static const char *ast_path(const char *input) {
+    return temp_sprintf("%s.ast", output_path(input));
+}
+
+// Modules keep their trees up to date next to their sources, which takes the place of both the build cache and
+// '--emit-ast'. Only checks them if 'output' is NULL.
+static char *build_modules(const char *input, Lexer l, const char *output) {
+    Modules ms = {0};
+
+    char *error = NULL;
+    if (!modules_update(&ms, input, l) || (output && !modules_compile(&ms, output))) {
+        error = take_diagnostics(ms.error);
+        ms.error = NULL;
+    }
+
+    modules_free(&ms);
+    return error;
+}
+
+static int check_program(const char *input, bool emit_ast) {
+    Lexer l = {0};
+    if (!lexer_open(&l, input)) {
+        fprintf(stderr, "ERROR: Could not read file '%s'\n", input);
+        return 1;
+    }
+
+    if (strcmp(input, "-") && modules_used(l)) {
+        char *error = build_modules(input, l, NULL);
+        if (error) {
+            fail(error);
+        }
+        return 0;
+    }
+
+    Ast     ast = {0};
+    Parser  p = {.ast = &ast};
+    Context c = {.ast = &ast};
+    if (!parse_file(&p, l)) {
+        fail_diagnostics(p.error);
+    }
+
+    if (!check_nodes(&c, p.nodes)) {
+        fail_diagnostics(c.error);
+    }
+
+    if (emit_ast && !astfile_write(ast_path(input), &c, l.sv, l.base)) {
+        fprintf(stderr, "ERROR: Could not write '%s'\n", ast_path(input));
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const char **data;
+    size_t       count;
+    size_t       capacity;
+} Inputs;
+
+static int dirent_filter(const struct dirent *e) {
+    return strcmp(e->d_name, ".") && strcmp(e->d_name, "..");
+}
+
+// Entries are sorted, so builds and their diagnostics come in the same order every time
+static void collect_inputs(Inputs *inputs, const char *dir) {
+    struct dirent **entries = NULL;
+
+    const int count = scandir(dir, &entries, dirent_filter, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "ERROR: Could not read directory '%s'\n", dir);
+        exit(1);
+    }
+
+    for (int i = 0; i < count; i++) {
+        const char *path = temp_sprintf("%s/%s", dir, entries[i]->d_name);
+
+        struct stat st;
+        if (!stat(path, &st) && S_ISDIR(st.st_mode)) {
+            collect_inputs(inputs, path);
+        } else if (sv_has_suffix(sv_from_cstr(path), sv_from_cstr(".glos"))) {
+            da_push(inputs, path);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+}
+
+typedef struct {
+    const char *input;
+    char       *error; // Diagnostics of a failed build, NULL if it succeeded
+} Build;
+
+typedef struct {
+    Build *data;
+    size_t count;
+
+    const char   *server; // Socket of the compile server, NULL to build in process
+    bool          cache;
+    atomic_size_t next;
+} Builds;
+
+static char *build_program(const char *input, bool use_cache) {
+    Lexer l = {0};
+    if (!lexer_open(&l, input)) {
+        return strdup(temp_sprintf("ERROR: Could not read file '%s'\n", input));
+    }
+
+    const char *output = output_path(input);
+    if (modules_used(l)) {
+        return build_modules(input, l, output);
+    }
+
+    // A batch can hold more sources than fit in the offset space at once, so each one is closed when it is built
+    Cache      cache = {0};
+    const bool cached = use_cache && cache_open(&cache, input, l.sv);
+    if (cached && cache_fetch(&cache, output)) {
+        lexer_close(&l);
+        return NULL;
+    }
+
+    Ast     ast = {0};
+    Parser  p = {.ast = &ast};
+    Context c = {.ast = &ast};
+
+    char *error = NULL;
+    if (!parse_file(&p, l)) {
+        error = take_diagnostics(p.error);
+    } else if (!check_nodes(&c, p.nodes) || !compile_nodes(&c, output)) {
+        error = take_diagnostics(c.error);
+    } else if (cached) {
+        cache_store(&cache, output);
+    }
+
+    parser_free(&p);
+    context_free(&c);
+    ast_free(&ast);
+    lexer_close(&l);
+    return error;
+}
+
+static void *build_worker(void *arg) {
+    Builds *builds = arg;
+    while (true) {
+        const size_t i = atomic_fetch_add(&builds->next, 1);
+        if (i >= builds->count) {
+            break;
+        }
+
+        Build *it = &builds->data[i];
+
+        const ArenaMark temp = temp_save();
+        if (builds->server) {
+            it->error = server_build(builds->server, it->input, output_path(it->input));
+        } else {
+            it->error = build_program(it->input, builds->cache);
+        }
+        temp_restore(temp);
+    }
+    return NULL;
+}
+
+// Threads of their own release their scratch arena, the calling thread keeps it
+static void *build_thread(void *arg) {
+    build_worker(arg);
+    temp_free();
+    return NULL;
+}
+
+// Programs are independent, so each worker takes the next one until none are left. Diagnostics are printed in input
+// order once everything is done.
+static int build_all(Inputs inputs, size_t jobs, const char *server, bool cache) {
+    Builds builds = {.count = inputs.count, .server = server, .cache = cache};
+    builds.data = calloc(builds.count, sizeof(*builds.data));
+    assert(builds.data || !builds.count);
+
+    for (size_t i = 0; i < inputs.count; i++) {
+        builds.data[i].input = inputs.data[i];
+    }
+
+    if (!jobs) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? cpus : 1;
+    }
+
+    if (jobs > builds.count) {
+        jobs = builds.count;
+    }
+
+    pthread_t *threads = malloc(jobs * sizeof(*threads));
+    assert(threads || !jobs);
+
+    size_t started = 0;
+    while (started + 1 < jobs && !pthread_create(&threads[started], NULL, build_thread, &builds)) {
+        started++;
+    }
+
+    build_worker(&builds);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    size_t built = 0;
+    for (size_t i = 0; i < builds.count; i++) {
+        if (builds.data[i].error) {
+            fputs(builds.data[i].error, stderr);
+            free(builds.data[i].error);
+        } else {
+            built++;
+        }
+    }
+    free(builds.data);
+
+    printf("Built %zu of %zu programs\n", built, inputs.count);
+    return built == inputs.count ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
     shift(&argc, &argv, "Program name");
 
     bool        run = false;
+    bool        watch = false;
+    bool        check = false;
     const char *command = shift(&argc, &argv, "Command");
     if (!strcmp(command, "help")) {
         usage(stdout);
@@ -36,49 +365,171 @@ int main(int argc, char **argv) {
         run = true;
     } else if (!strcmp(command, "build")) {
         // Pass
+    } else if (!strcmp(command, "watch")) {
+        watch = true;
+    } else if (!strcmp(command, "check")) {
+        check = true;
+    } else if (!strcmp(command, "cache")) {
+        return cache_command(shift(&argc, &argv, "Cache action"));
+    } else if (!strcmp(command, "serve")) {
+        return server_serve(server_socket()) ? 0 : 1;
+    } else if (!strcmp(command, "lsp")) {
+        return lsp_serve();
     } else {
         fprintf(stderr, "ERROR: Invalid command '%s'\n\n", command);
         usage(stderr);
         exit(1);
     }
 
-    const char *input = shift(&argc, &argv, "Input file");
+    bool        stream = false;
+    bool        batch = false;
+    size_t      jobs = 0;
+    const char *server = NULL;
+    bool        cache = true;
+    bool        emit_ast = false;
+
+    // Everything after the input of 'run' is passed on to the program
+    Inputs inputs = {0};
+    while (argc > 0 && !(run && inputs.count)) {
+        const char *arg = shift(&argc, &argv, "Input file");
+        if (!strcmp(arg, "--stream")) {
+            stream = true;
+        } else if (!strcmp(arg, "--server")) {
+            server = server_socket();
+        } else if (!strcmp(arg, "--no-cache")) {
+            cache = false;
+        } else if (!strcmp(arg, "--emit-ast")) {
+            emit_ast = true;
+        } else if (!strcmp(arg, "-j")) {
+            char *end = NULL;
+            arg = shift(&argc, &argv, "Job count");
+            jobs = strtoul(arg, &end, 10);
+            if (!jobs || *end) {
+                fprintf(stderr, "ERROR: Invalid job count '%s'\n", arg);
+                exit(1);
+            }
+        } else {
+            struct stat st;
+            if (!run && !watch && !check && strcmp(arg, "-") && !stat(arg, &st) && S_ISDIR(st.st_mode)) {
+                collect_inputs(&inputs, arg);
+                batch = true;
+            } else {
+                da_push(&inputs, arg);
+            }
+        }
+    }
+
+    if (!inputs.count) {
+        shift(&argc, &argv, "Input file");
+    }
+
+    if (watch) {
+        if (stream || server || inputs.count > 1 || !strcmp(inputs.data[0], "-")) {
+            fprintf(stderr, "ERROR: Watching only works on a single input file, compiled in process\n");
+            exit(1);
+        }
+        return watch_file(inputs.data[0], output_path(inputs.data[0])) ? 0 : 1;
+    }
+
+    if (emit_ast && (!check || !strcmp(inputs.data[0], "-"))) {
+        fprintf(stderr, "ERROR: Only 'check' on a file can emit its tree\n");
+        exit(1);
+    }
+
+    if (check) {
+        if (stream || server || inputs.count > 1) {
+            fprintf(stderr, "ERROR: Checking only works on a single input file, in process\n");
+            exit(1);
+        }
+        return check_program(inputs.data[0], emit_ast);
+    }
+
+    if (server && stream) {
+        fprintf(stderr, "ERROR: The compile server does not stream\n");
+        exit(1);
+    }
+
+    if (inputs.count > 1 || batch) {
+        if (stream) {
+            fprintf(stderr, "ERROR: Streaming only works on a single input file\n");
+            exit(1);
+        }
+        return build_all(inputs, jobs, server, cache);
+    }
+
+    const char *input = inputs.data[0];
+    if (server && !strcmp(input, "-")) {
+        fprintf(stderr, "ERROR: The compile server cannot read from stdin\n");
+        exit(1);
+    }
 
     Lexer l = {0};
-    if (!lexer_open(&l, input)) {
+    if (!server && !lexer_open(&l, input)) {
         fprintf(stderr, "ERROR: Could not read file '%s'\n", input);
         exit(1);
     }
 
-    Arena  arena = {0};
-    Parser p = {.arena = &arena};
-    parse_file(&p, l);
-
-    Context c = {0};
-    check_nodes(&c, p.nodes);
+    const bool modules = !server && modules_used(l);
+    if (modules && (stream || !strcmp(input, "-"))) {
+        fprintf(stderr, "ERROR: Programs with imports are only compiled from a file, without streaming\n");
+        exit(1);
+    }
 
+    // 'run' builds a temporary executable, which is removed once it exits
+    char        run_output[] = "/tmp/glos_run_XXXXXX";
+    const char *output = output_path(input);
     if (run) {
-        static char output[] = "/tmp/glos_run_XXXXXX";
-
-        const int fd = mkstemp(output);
+        const int fd = mkstemp(run_output);
         if (fd < 0) {
             fprintf(stderr, "ERROR: Could not create temporary executable\n");
             exit(1);
         } else {
             close(fd);
-            remove(output); // TODO: The production compiler need not do this
+            remove(run_output); // TODO: The production compiler need not do this
         }
-        compile_nodes(&c, output);
+        output = run_output;
+    }
 
-        Cmd cmd = {0};
-        da_push(&cmd, output);
-        da_push_many(&cmd, argv, argc);
-        const int code = cmd_run(&cmd);
-        remove(output);
-        return code;
+    // A cached program skips the compiler entirely. Even 'run' executes a copy of it, since another process can evict
+    // the entry at any time.
+    Cache      build_cache = {0};
+    const bool cached = !server && !modules && cache && cache_open(&build_cache, input, l.sv);
+    if (cached && cache_fetch(&build_cache, output)) {
+        return run ? run_temporary(output, argc, argv) : 0;
     }
 
-    const char *output = temp_sv_to_cstr(sv_strip_suffix(sv_from_cstr(input), sv_from_cstr(".glos")));
-    compile_nodes(&c, output);
-    return 0;
+    Ast     ast = {0};
+    Parser  p = {.ast = &ast};
+    Context c = {.ast = &ast};
+
+    // A tree saved by 'check --emit-ast' for this exact source skips the front end
+    AstFile    ast_file = {0};
+    const bool loaded = !server && !stream && !modules && strcmp(input, "-") &&
+                        astfile_read(&ast_file, ast_path(input), &c, l.sv, l.base);
+
+    if (!server && !stream && !modules && !loaded) {
+        if (!parse_file(&p, l)) {
+            fail_diagnostics(p.error);
+        }
+
+        if (!check_nodes(&c, p.nodes)) {
+            fail_diagnostics(c.error);
+        }
+    }
+
+    if (server) {
+        build_remote(server, input, output);
+    } else if (modules) {
+        char *error = build_modules(input, l, output);
+        if (error) {
+            fail(error);
+        }
+    } else {
+        compile(&p, &c, l, stream, output);
+    }
+
+    if (cached) {
+        cache_store(&build_cache, output);
+    }
+    return run ? run_temporary(output, argc, argv) : 0;
 }
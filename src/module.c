@@ -0,0 +1,694 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "astfile.h"
+#include "checker.h"
+#include "compiler.h"
+#include "module.h"
+#include "parser.h"
+
+#define INTERFACE_HEADER "glos interface 1"
+
+typedef struct {
+    Symbol   name;
+    uint32_t offset; // Of the name in the import, relative to the source
+    uint64_t hash;   // Interface of the module when this one was checked against it
+} InterfaceImport;
+
+typedef struct {
+    Symbol   name;
+    NodeKind kind;
+    Type     type;
+} Export;
+
+// Text, one record per line:
+//
+//     source HASH SIZE
+//     import NAME OFFSET HASH
+//     fn NAME TYPE
+//     var NAME TYPE
+//
+// Types are written in prefix form, 'fn ARITY ARGS... RET' for functions. Only the exports go into the hash of an
+// interface, since they are all that the files importing the module are checked against.
+typedef struct {
+    uint64_t source_hash;
+    uint64_t source_size;
+
+    struct {
+        InterfaceImport *data;
+        size_t           count;
+        size_t           capacity;
+    } imports;
+
+    struct {
+        Export *data;
+        size_t  count;
+        size_t  capacity;
+    } exports;
+
+    uint64_t hash;
+} Interface;
+
+typedef enum {
+    MODULE_NEW,
+    MODULE_VISITING,
+    MODULE_VISITED,
+} ModuleState;
+
+struct Module {
+    Symbol name;
+    char  *path; // Of the source
+    char  *stem; // Path of the source without '.glos', which its tree and interface files are named after
+    Lexer  lexer;
+
+    Ast     ast;
+    Parser  parser;
+    Context context;
+    AstFile file;
+    bool    parsed;
+
+    Interface interface;
+    bool      fresh; // The interface on disk was written for this source
+
+    // The module of each entry in interface.imports
+    struct {
+        Module **data;
+        size_t   count;
+        size_t   capacity;
+    } imports;
+
+    size_t       level; // Length of the longest chain of imports below the module
+    ModuleState  state;
+    Diagnostics *error;
+};
+
+__attribute__((format(printf, 3, 4))) static bool modules_fail(Modules *ms, uint32_t offset, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    ms->error = diagnostics_verror(offset, fmt, args);
+    va_end(args);
+    return false;
+}
+
+// Interfaces
+
+static_assert(COUNT_TYPES == 4, "");
+static void type_write(FILE *f, Type type) {
+    switch (type_kind(type)) {
+    case TYPE_UNIT:
+        fputs(" unit", f);
+        break;
+
+    case TYPE_BOOL:
+        fputs(" bool", f);
+        break;
+
+    case TYPE_I64:
+        fputs(" i64", f);
+        break;
+
+    case TYPE_FN:
+        fprintf(f, " fn %zu", type_arity(type));
+        for (size_t i = 0; i < type_arity(type); i++) {
+            type_write(f, type_arg(type, i));
+        }
+        type_write(f, type_ret(type));
+        break;
+
+    default:
+        unreachable();
+    }
+}
+
+static void exports_write(FILE *f, const Interface *in) {
+    for (size_t i = 0; i < in->exports.count; i++) {
+        const Export *it = &in->exports.data[i];
+        fprintf(f, "%s " SVFmt, it->kind == NODE_FN ? "fn" : "var", SVArg(symbol_sv(it->name)));
+        type_write(f, it->type);
+        fputc('\n', f);
+    }
+}
+
+static uint64_t interface_hash(const Interface *in) {
+    char  *data = NULL;
+    size_t size = 0;
+
+    FILE *f = open_memstream(&data, &size);
+    assert(f);
+    exports_write(f, in);
+    fclose(f);
+
+    const uint64_t hash = hash_bytes(data, size);
+    free(data);
+    return hash;
+}
+
+static bool interface_write(const Interface *in, const char *path) {
+    char     *temp_path = temp_sprintf("%s.XXXXXX", path);
+    const int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        return false;
+    }
+
+    FILE *f = !fchmod(fd, 0644) ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        close(fd);
+        remove(temp_path);
+        return false;
+    }
+
+    fprintf(f, INTERFACE_HEADER "\n");
+    fprintf(f, "source %016llx %llu\n", (unsigned long long) in->source_hash, (unsigned long long) in->source_size);
+    for (size_t i = 0; i < in->imports.count; i++) {
+        const InterfaceImport *it = &in->imports.data[i];
+        fprintf(
+            f,
+            "import " SVFmt " %u %016llx\n",
+            SVArg(symbol_sv(it->name)),
+            it->offset,
+            (unsigned long long) it->hash);
+    }
+    exports_write(f, in);
+
+    bool ok = !ferror(f);
+    if (fclose(f)) {
+        ok = false;
+    }
+
+    // Published with a rename, like the tree, so a reader never sees half an interface
+    if (ok && rename(temp_path, path) < 0) {
+        ok = false;
+    }
+
+    if (!ok) {
+        remove(temp_path);
+    }
+    return ok;
+}
+
+static bool word_u64(char **save, int base, uint64_t *out) {
+    const char *word = strtok_r(NULL, " ", save);
+    if (!word) {
+        return false;
+    }
+
+    char *end = NULL;
+    *out = strtoull(word, &end, base);
+    return end != word && !*end;
+}
+
+static bool type_read(char **save, Type *out) {
+    const char *word = strtok_r(NULL, " ", save);
+    if (!word) {
+        return false;
+    }
+
+    if (!strcmp(word, "unit")) {
+        *out = TYPE_ID_UNIT;
+        return true;
+    }
+
+    if (!strcmp(word, "bool")) {
+        *out = TYPE_ID_BOOL;
+        return true;
+    }
+
+    if (!strcmp(word, "i64")) {
+        *out = TYPE_ID_I64;
+        return true;
+    }
+
+    uint64_t arity = 0;
+    // Every argument takes up at least two more bytes of the line
+    if (strcmp(word, "fn") || !word_u64(save, 10, &arity) || !*save || arity > strlen(*save)) {
+        return false;
+    }
+
+    Type *args = temp_alloc(arity * sizeof(*args));
+    for (size_t i = 0; i < arity; i++) {
+        if (!type_read(save, &args[i])) {
+            return false;
+        }
+    }
+
+    Type ret = 0;
+    if (!type_read(save, &ret)) {
+        return false;
+    }
+
+    *out = type_fn(args, arity, ret);
+    return true;
+}
+
+static bool interface_line(Interface *in, char *line, bool *sourced) {
+    char       *save = NULL;
+    const char *word = strtok_r(line, " ", &save);
+    if (!word) {
+        return false;
+    }
+
+    if (!strcmp(word, "source")) {
+        *sourced = word_u64(&save, 16, &in->source_hash) && word_u64(&save, 10, &in->source_size);
+        return *sourced && !strtok_r(NULL, " ", &save);
+    }
+
+    if (!strcmp(word, "import")) {
+        const char *name = strtok_r(NULL, " ", &save);
+
+        uint64_t offset = 0;
+        uint64_t hash = 0;
+        if (!name || !word_u64(&save, 10, &offset) || offset > UINT32_MAX || !word_u64(&save, 16, &hash)) {
+            return false;
+        }
+
+        const InterfaceImport it = {.name = symbol_intern(sv_from_cstr(name)), .offset = offset, .hash = hash};
+        da_push(&in->imports, it);
+        return !strtok_r(NULL, " ", &save);
+    }
+
+    if (!strcmp(word, "fn") || !strcmp(word, "var")) {
+        Export it = {.kind = !strcmp(word, "fn") ? NODE_FN : NODE_VAR};
+
+        const char *name = strtok_r(NULL, " ", &save);
+        if (!name || !type_read(&save, &it.type) || (it.kind == NODE_FN && type_kind(it.type) != TYPE_FN)) {
+            return false;
+        }
+
+        it.name = symbol_intern(sv_from_cstr(name));
+        da_push(&in->exports, it);
+        return !strtok_r(NULL, " ", &save);
+    }
+
+    return false;
+}
+
+static void interface_reset(Interface *in) {
+    in->source_hash = 0;
+    in->source_size = 0;
+    in->imports.count = 0;
+    in->exports.count = 0;
+    in->hash = 0;
+}
+
+// Anything malformed reads as no interface at all, which only costs checking the module again
+static bool interface_read(Interface *in, const char *path) {
+    File file = {0};
+    if (!read_file(&file, path)) {
+        return false;
+    }
+
+    const ArenaMark temp = temp_save();
+    char           *text = temp_sv_to_cstr(file.sv);
+    free_file(&file);
+
+    char *save = NULL;
+    char *line = strtok_r(text, "\n", &save);
+
+    bool ok = line && !strcmp(line, INTERFACE_HEADER);
+    bool sourced = false;
+    while (ok && (line = strtok_r(NULL, "\n", &save))) {
+        ok = interface_line(in, line, &sourced);
+    }
+    temp_restore(temp);
+
+    if (!ok || !sourced) {
+        interface_reset(in);
+        return false;
+    }
+
+    in->hash = interface_hash(in);
+    return true;
+}
+
+static bool interface_matches(const Interface *in, SV source) {
+    if (in->source_size != source.count || in->source_hash != hash_bytes(source.data, source.count)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < in->imports.count; i++) {
+        if (in->imports.data[i].offset >= source.count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Modules
+
+static Module *module_new(Modules *ms, const char *path, Symbol name) {
+    Module *m = calloc(1, sizeof(*m));
+    assert(m);
+
+    m->name = name;
+    m->path = strdup(path);
+    m->stem = strdup(temp_sv_to_cstr(sv_strip_suffix(sv_from_cstr(path), sv_from_cstr(".glos"))));
+    m->context.ast = &m->ast;
+    m->parser.ast = &m->ast;
+    m->parser.modules = true;
+
+    da_push(ms, m);
+    return m;
+}
+
+static Module *modules_find(const Modules *ms, Symbol name) {
+    for (size_t i = 0; i < ms->count; i++) {
+        if (ms->data[i]->name == name) {
+            return ms->data[i];
+        }
+    }
+    return NULL;
+}
+
+static bool module_parse(Module *m, Diagnostics **error) {
+    m->parsed = true;
+    if (!parse_file(&m->parser, m->lexer)) {
+        *error = m->parser.error;
+        m->parser.error = NULL;
+        return false;
+    }
+
+    m->interface.imports.count = 0;
+    for (size_t i = 0; i < m->parser.imports.count; i++) {
+        const Import         *it = &m->parser.imports.data[i];
+        const InterfaceImport import = {.name = it->name, .offset = it->offset - m->lexer.base};
+        da_push(&m->interface.imports, import);
+    }
+    return true;
+}
+
+// Finds every module imported by 'm', depth first. What a module imports comes from its interface while that is up to
+// date, so an unchanged module is not even parsed.
+static bool module_visit(Modules *ms, Module *m) {
+    m->state = MODULE_VISITING;
+
+    m->fresh = interface_read(&m->interface, temp_sprintf("%s.gli", m->stem)) &&
+               interface_matches(&m->interface, m->lexer.sv);
+    if (!m->fresh) {
+        interface_reset(&m->interface);
+        if (!module_parse(m, &ms->error)) {
+            return false;
+        }
+    }
+
+    // Modules sit next to the files which import them
+    const char *slash = strrchr(m->path, '/');
+    const int   dir = slash ? slash + 1 - m->path : 0;
+
+    for (size_t i = 0; i < m->interface.imports.count; i++) {
+        const InterfaceImport *it = &m->interface.imports.data[i];
+        const uint32_t         offset = m->lexer.base + it->offset;
+
+        Module *import = modules_find(ms, it->name);
+        if (import && import->state == MODULE_VISITING) {
+            return modules_fail(ms, offset, "Import cycle through module '" SVFmt "'", SVArg(symbol_sv(it->name)));
+        }
+
+        if (!import) {
+            const char *path = temp_sprintf("%.*s" SVFmt ".glos", dir, m->path, SVArg(symbol_sv(it->name)));
+
+            // Only opened modules are added, so every one of them has a lexer to close
+            Lexer l = {0};
+            if (!lexer_open(&l, path)) {
+                return modules_fail(ms, offset, "Could not read module '%s'", path);
+            }
+
+            import = module_new(ms, path, it->name);
+            import->lexer = l;
+
+            if (!module_visit(ms, import)) {
+                return false;
+            }
+        }
+
+        da_push(&m->imports, import);
+        if (m->level < import->level + 1) {
+            m->level = import->level + 1;
+        }
+    }
+
+    m->state = MODULE_VISITED;
+    return true;
+}
+
+// A module is reused if it was checked against the interfaces it imports now, and its tree can still be read
+static bool module_fresh(Module *m) {
+    if (!m->fresh) {
+        return false;
+    }
+
+    for (size_t i = 0; i < m->imports.count; i++) {
+        if (m->imports.data[i]->interface.hash != m->interface.imports.data[i].hash) {
+            return false;
+        }
+    }
+
+    return astfile_read(&m->file, temp_sprintf("%s.ast", m->stem), &m->context, m->lexer.sv, m->lexer.base);
+}
+
+// Each import declares the exports of its module as globals without bodies, located at the import. The compiler
+// refers to them by name. A name exported twice, or defined here again, is a redefinition like any other.
+static bool module_declare(Module *m) {
+    Context *c = &m->context;
+    for (size_t i = 0; i < m->imports.count; i++) {
+        const Module  *import = m->imports.data[i];
+        const uint32_t offset = m->lexer.base + m->interface.imports.data[i].offset;
+
+        bool repeated = false;
+        for (size_t j = 0; j < i; j++) {
+            repeated = repeated || m->imports.data[j] == import;
+        }
+
+        for (size_t j = 0; j < import->interface.exports.count && !repeated; j++) {
+            const Export *it = &import->interface.exports.data[j];
+
+            const NodeId previous = scope_find(&c->globals, it->name);
+            if (previous) {
+                context_error(c, offset, "Redefinition of identifier '" SVFmt "'", SVArg(symbol_sv(it->name)));
+                diagnostics_note(c->error, ast_node(&m->ast, previous)->offset, "Defined here");
+                return false;
+            }
+
+            const NodeId id = ast_push(&m->ast, it->kind, TOKEN_IDENT, offset);
+            ast_node(&m->ast, id)->type = it->type;
+
+            if (it->kind == NODE_FN) {
+                NodeFn *fn = ast_fn(&m->ast, id);
+                fn->name = it->name;
+                fn->module = import->name;
+            } else {
+                NodeVar *var = ast_var(&m->ast, id);
+                var->name = it->name;
+                var->kind = NODE_VAR_GLOBAL;
+                var->module = import->name;
+            }
+
+            scope_push(&c->globals, it->name, id);
+        }
+    }
+    return true;
+}
+
+static void module_export(Module *m) {
+    Interface *in = &m->interface;
+    in->source_hash = hash_bytes(m->lexer.sv.data, m->lexer.sv.count);
+    in->source_size = m->lexer.sv.count;
+
+    for (size_t i = 0; i < m->imports.count; i++) {
+        in->imports.data[i].hash = m->imports.data[i]->interface.hash;
+    }
+
+    in->exports.count = 0;
+    for (size_t i = 0; i < m->context.globals.count; i++) {
+        const ScopeEntry *it = &m->context.globals.data[i];
+        const Node       *n = ast_node(&m->ast, it->node);
+
+        const bool imported =
+            n->kind == NODE_FN ? ast_fn(&m->ast, it->node)->module : ast_var(&m->ast, it->node)->module;
+        if (imported || it->name == SYMBOL_MAIN) {
+            continue;
+        }
+
+        const Export export = {.name = it->name, .kind = n->kind, .type = n->type};
+        da_push(&in->exports, export);
+    }
+
+    in->hash = interface_hash(in);
+}
+
+static void module_build(Module *m) {
+    if (module_fresh(m)) {
+        return;
+    }
+
+    if (!m->parsed && !module_parse(m, &m->error)) {
+        return;
+    }
+
+    if (!module_declare(m) || !check_nodes(&m->context, m->parser.nodes)) {
+        m->error = m->context.error;
+        m->context.error = NULL;
+        return;
+    }
+    module_export(m);
+
+    // The interface goes last, as it is what says the tree is up to date
+    const char *ast_path = temp_sprintf("%s.ast", m->stem);
+    const char *interface_path = temp_sprintf("%s.gli", m->stem);
+    if (!astfile_write(ast_path, &m->context, m->lexer.sv, m->lexer.base)) {
+        m->error = diagnostics_error(OFFSET_NONE, "Could not write '%s'", ast_path);
+    } else if (!interface_write(&m->interface, interface_path)) {
+        m->error = diagnostics_error(OFFSET_NONE, "Could not write '%s'", interface_path);
+    }
+}
+
+typedef struct {
+    Module      **data;
+    size_t        count;
+    atomic_size_t next;
+} Level;
+
+static void *level_worker(void *arg) {
+    Level *level = arg;
+    while (true) {
+        const size_t i = atomic_fetch_add(&level->next, 1);
+        if (i >= level->count) {
+            break;
+        }
+
+        const ArenaMark temp = temp_save();
+        module_build(level->data[i]);
+        temp_restore(temp);
+    }
+    return NULL;
+}
+
+// Threads of their own release their scratch arena, the calling thread keeps it
+static void *level_thread(void *arg) {
+    level_worker(arg);
+    temp_free();
+    return NULL;
+}
+
+// Modules of one level never import each other, so they are built at the same time
+static void level_build(Module **data, size_t count) {
+    Level level = {.data = data, .count = count};
+
+    size_t     workers = count;
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && workers > (size_t) cpus) {
+        workers = cpus;
+    }
+
+    pthread_t *threads = malloc(workers * sizeof(*threads));
+    assert(threads || !workers);
+
+    size_t started = 0;
+    while (started + 1 < workers && !pthread_create(&threads[started], NULL, level_thread, &level)) {
+        started++;
+    }
+
+    level_worker(&level);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+bool modules_used(Lexer l) {
+    Token token = lexer_next(&l);
+    while (token.kind == TOKEN_EOL) {
+        token = lexer_next(&l);
+    }
+    return token.kind == TOKEN_IMPORT;
+}
+
+bool modules_update(Modules *ms, const char *path, Lexer l) {
+    const char *slash = strrchr(path, '/');
+    const SV    stem = sv_strip_suffix(sv_from_cstr(slash ? slash + 1 : path), sv_from_cstr(".glos"));
+
+    // The program is found by its own name too, so a module importing it is a cycle
+    Module *program = module_new(ms, path, symbol_intern(stem));
+    program->lexer = l;
+    if (!module_visit(ms, program)) {
+        return false;
+    }
+
+    // Every module has a higher level than the ones it imports, and the program has the highest of all
+    for (size_t i = 1; i < ms->count; i++) {
+        Module *it = ms->data[i];
+
+        size_t j = i;
+        for (; j > 0 && ms->data[j - 1]->level > it->level; j--) {
+            ms->data[j] = ms->data[j - 1];
+        }
+        ms->data[j] = it;
+    }
+
+    for (size_t first = 0; first < ms->count;) {
+        size_t last = first + 1;
+        while (last < ms->count && ms->data[last]->level == ms->data[first]->level) {
+            last++;
+        }
+        level_build(ms->data + first, last - first);
+
+        for (size_t i = first; i < last; i++) {
+            if (ms->data[i]->error) {
+                ms->error = ms->data[i]->error;
+                ms->data[i]->error = NULL;
+                return false;
+            }
+        }
+        first = last;
+    }
+    return true;
+}
+
+bool modules_compile(Modules *ms, const char *output) {
+    assert(ms->count);
+    Module *program = ms->data[ms->count - 1];
+
+    Compiler c;
+    compile_begin(&c, &program->context);
+    for (size_t i = 0; i < ms->count; i++) {
+        Module *it = ms->data[i];
+        compile_unit(&c, &it->context, it != program ? it->name : 0);
+    }
+
+    if (!compile_end(&c, output)) {
+        ms->error = program->context.error;
+        program->context.error = NULL;
+        return false;
+    }
+    return true;
+}
+
+void modules_free(Modules *ms) {
+    for (size_t i = 0; i < ms->count; i++) {
+        Module *it = ms->data[i];
+        if (it->file.data) {
+            astfile_free(&it->file);
+        } else {
+            ast_free(&it->ast);
+        }
+
+        parser_free(&it->parser);
+        context_free(&it->context);
+        lexer_close(&it->lexer);
+
+        da_free(&it->interface.imports);
+        da_free(&it->interface.exports);
+        da_free(&it->imports);
+
+        diagnostics_free(it->error);
+        free(it->path);
+        free(it->stem);
+        free(it);
+    }
+
+    diagnostics_free(ms->error);
+    da_free(ms);
+}
@@ -0,0 +1,35 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "lexer.h"
+
+// A program can 'import NAME' to use the globals of NAME.glos, found next to the program. Every global a module
+// declares, except 'main', becomes visible to the files importing it.
+//
+// Modules are compiled separately. Checking one leaves its tree in NAME.ast, as 'check --emit-ast' does, and its
+// exported signatures in the interface file NAME.gli. Files which import a module are checked against its interface
+// alone, so changing a module without changing its interface leaves the files importing it as they were.
+typedef struct Module Module;
+
+typedef struct {
+    Module **data; // Each module comes after the ones it imports, the program itself last
+    size_t   count;
+    size_t   capacity;
+
+    Diagnostics *error;
+} Modules;
+
+// Imports come before every declaration, so the first token tells whether a program has any
+bool modules_used(Lexer l);
+
+// Brings the program at 'path', already opened as 'l', and every module it imports up to date. Only those whose
+// source or imported interfaces changed are checked again, the rest are mapped from their tree files. Modules which
+// do not import one another are checked in parallel. The lexer is closed by modules_free().
+bool modules_update(Modules *ms, const char *path, Lexer l);
+
+// Lowers every module along with the program into one executable
+bool modules_compile(Modules *ms, const char *output);
+
+void modules_free(Modules *ms);
+
+#endif // MODULE_H
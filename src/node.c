@@ -1,91 +1,348 @@
 #include "node.h"
 
-static_assert(COUNT_TYPES == 4, "");
-const char *type_to_cstr(Type type) {
-    const char *s = temp_alloc(0);
+void ast_free(Ast *ast) {
+    free(ast->nodes.data);
+    free(ast->lists.data);
 
-    switch (type.kind) {
-    case TYPE_UNIT:
-        temp_sprintf("()");
-        break;
+    free(ast->atoms.data);
+    free(ast->calls.data);
+    free(ast->unaries.data);
+    free(ast->binaries.data);
+    free(ast->ifs.data);
+    free(ast->blocks.data);
+    free(ast->returns.data);
+    free(ast->fns.data);
+    free(ast->vars.data);
+    free(ast->prints.data);
 
-    case TYPE_BOOL:
-        temp_sprintf("bool");
-        break;
+    memset(ast, 0, sizeof(*ast));
+}
 
-    case TYPE_I64:
-        temp_sprintf("i64");
-        break;
+static_assert(COUNT_NODES == 10, "");
+AstMark ast_mark(const Ast *ast) {
+    return (AstMark) {
+        .nodes = ast->nodes.count,
+        .lists = ast->lists.count,
+        .payloads = {
+            [NODE_ATOM] = ast->atoms.count,
+            [NODE_CALL] = ast->calls.count,
+            [NODE_UNARY] = ast->unaries.count,
+            [NODE_BINARY] = ast->binaries.count,
+            [NODE_IF] = ast->ifs.count,
+            [NODE_BLOCK] = ast->blocks.count,
+            [NODE_RETURN] = ast->returns.count,
+            [NODE_FN] = ast->fns.count,
+            [NODE_VAR] = ast->vars.count,
+            [NODE_PRINT] = ast->prints.count,
+        },
+    };
+}
 
-    case TYPE_FN: {
-        const NodeFn *spec = (const NodeFn *) type.spec;
-
-        temp_sprintf("fn (");
-        for (const Node *it = spec->args.head; it; it = it->next) {
-            temp_remove_null();
-            type_to_cstr(it->type);
-
-            if (it->next) {
-                temp_remove_null();
-                temp_sprintf(", ");
-            }
-        }
-        temp_remove_null();
-        temp_sprintf(")");
-
-        if (spec->ret) {
-            temp_remove_null();
-            temp_sprintf(" ");
-            temp_remove_null();
-            type_to_cstr(spec->ret->type);
-        }
-    } break;
+// Drops every node pushed since the mark, keeping the capacity for what gets parsed next
+static_assert(COUNT_NODES == 10, "");
+void ast_rewind(Ast *ast, AstMark m) {
+    assert(m.nodes <= ast->nodes.count && m.lists <= ast->lists.count);
 
-    default:
-        unreachable();
+    ast->nodes.count = m.nodes;
+    ast->lists.count = m.lists;
+
+    ast->atoms.count = m.payloads[NODE_ATOM];
+    ast->calls.count = m.payloads[NODE_CALL];
+    ast->unaries.count = m.payloads[NODE_UNARY];
+    ast->binaries.count = m.payloads[NODE_BINARY];
+    ast->ifs.count = m.payloads[NODE_IF];
+    ast->blocks.count = m.payloads[NODE_BLOCK];
+    ast->returns.count = m.payloads[NODE_RETURN];
+    ast->fns.count = m.payloads[NODE_FN];
+    ast->vars.count = m.payloads[NODE_VAR];
+    ast->prints.count = m.payloads[NODE_PRINT];
+}
+
+static NodeId ast_shift(NodeId id, uint32_t shift) {
+    return id ? id + shift : 0;
+}
+
+// Every payload is copied as is, except for the IDs and lists it holds
+static_assert(COUNT_NODES == 10, "");
+uint32_t ast_append(Ast *ast, const Ast *from) {
+    if (!ast->nodes.count) {
+        da_push(&ast->nodes, (Node) {0}); // Reserve the zero ID
+    }
+
+    const AstMark  at = ast_mark(ast);
+    const uint32_t shift = at.nodes - 1;
+
+    for (size_t i = 1; i < from->nodes.count; i++) {
+        Node it = from->nodes.data[i];
+        it.data += at.payloads[it.kind];
+        da_push(&ast->nodes, it);
+    }
+
+    for (size_t i = 0; i < from->lists.count; i++) {
+        da_push(&ast->lists, ast_shift(from->lists.data[i], shift));
+    }
+
+    for (size_t i = 0; i < from->atoms.count; i++) {
+        NodeAtom it = from->atoms.data[i];
+        it.definition = ast_shift(it.definition, shift);
+        da_push(&ast->atoms, it);
+    }
+
+    for (size_t i = 0; i < from->calls.count; i++) {
+        NodeCall it = from->calls.data[i];
+        it.fn = ast_shift(it.fn, shift);
+        it.args.first += at.lists;
+        da_push(&ast->calls, it);
+    }
+
+    for (size_t i = 0; i < from->unaries.count; i++) {
+        NodeUnary it = from->unaries.data[i];
+        it.operand = ast_shift(it.operand, shift);
+        da_push(&ast->unaries, it);
     }
 
-    return s;
+    for (size_t i = 0; i < from->binaries.count; i++) {
+        NodeBinary it = from->binaries.data[i];
+        it.lhs = ast_shift(it.lhs, shift);
+        it.rhs = ast_shift(it.rhs, shift);
+        da_push(&ast->binaries, it);
+    }
+
+    for (size_t i = 0; i < from->ifs.count; i++) {
+        NodeIf it = from->ifs.data[i];
+        it.condition = ast_shift(it.condition, shift);
+        it.consequence = ast_shift(it.consequence, shift);
+        it.antecedence = ast_shift(it.antecedence, shift);
+        da_push(&ast->ifs, it);
+    }
+
+    for (size_t i = 0; i < from->blocks.count; i++) {
+        NodeBlock it = from->blocks.data[i];
+        it.body.first += at.lists;
+        da_push(&ast->blocks, it);
+    }
+
+    for (size_t i = 0; i < from->returns.count; i++) {
+        NodeReturn it = from->returns.data[i];
+        it.value = ast_shift(it.value, shift);
+        da_push(&ast->returns, it);
+    }
+
+    for (size_t i = 0; i < from->fns.count; i++) {
+        NodeFn it = from->fns.data[i];
+        it.args.first += at.lists;
+        it.ret = ast_shift(it.ret, shift);
+        it.body = ast_shift(it.body, shift);
+        da_push(&ast->fns, it);
+    }
+
+    for (size_t i = 0; i < from->vars.count; i++) {
+        NodeVar it = from->vars.data[i];
+        it.expr = ast_shift(it.expr, shift);
+        it.type = ast_shift(it.type, shift);
+        da_push(&ast->vars, it);
+    }
+
+    for (size_t i = 0; i < from->prints.count; i++) {
+        NodePrint it = from->prints.data[i];
+        it.operand = ast_shift(it.operand, shift);
+        da_push(&ast->prints, it);
+    }
+
+    return shift;
 }
 
-static_assert(COUNT_TYPES == 4, "");
-bool type_eq(Type a, Type b) {
-    if (a.kind != b.kind) {
-        return false;
+static NodeId ast_unshift(NodeId id, uint32_t shift) {
+    return id ? id - shift : 0;
+}
+
+static_assert(COUNT_NODES == 10, "");
+void ast_split(Ast *ast, AstMark from, Ast *to) {
+    assert(from.nodes);
+    ast_rewind(to, (AstMark) {0});
+    da_push(&to->nodes, (Node) {0}); // Reserve the zero ID
+
+    const uint32_t shift = from.nodes - 1;
+    for (size_t i = from.nodes; i < ast->nodes.count; i++) {
+        Node it = ast->nodes.data[i];
+        it.data -= from.payloads[it.kind];
+        da_push(&to->nodes, it);
     }
 
-    switch (a.kind) {
-    case TYPE_FN: {
-        const NodeFn *a_spec = (const NodeFn *) a.spec;
-        const NodeFn *b_spec = (const NodeFn *) b.spec;
+    for (size_t i = from.lists; i < ast->lists.count; i++) {
+        da_push(&to->lists, ast_unshift(ast->lists.data[i], shift));
+    }
 
-        if (a_spec->arity != b_spec->arity) {
-            return false;
-        }
+    for (size_t i = from.payloads[NODE_ATOM]; i < ast->atoms.count; i++) {
+        NodeAtom it = ast->atoms.data[i];
+        it.definition = it.definition >= from.nodes ? it.definition - shift : 0;
+        da_push(&to->atoms, it);
+    }
 
-        for (const Node *a = a_spec->args.head, *b = b_spec->args.head; a; a = a->next, b = b->next) {
-            if (!type_eq(a->type, b->type)) {
-                return false;
-            }
-        }
+    for (size_t i = from.payloads[NODE_CALL]; i < ast->calls.count; i++) {
+        NodeCall it = ast->calls.data[i];
+        it.fn = ast_unshift(it.fn, shift);
+        it.args.first -= from.lists;
+        da_push(&to->calls, it);
+    }
 
-        return type_eq(node_fn_return_type(a_spec), node_fn_return_type(b_spec));
-    } break;
+    for (size_t i = from.payloads[NODE_UNARY]; i < ast->unaries.count; i++) {
+        NodeUnary it = ast->unaries.data[i];
+        it.operand = ast_unshift(it.operand, shift);
+        da_push(&to->unaries, it);
+    }
+
+    for (size_t i = from.payloads[NODE_BINARY]; i < ast->binaries.count; i++) {
+        NodeBinary it = ast->binaries.data[i];
+        it.lhs = ast_unshift(it.lhs, shift);
+        it.rhs = ast_unshift(it.rhs, shift);
+        da_push(&to->binaries, it);
+    }
+
+    for (size_t i = from.payloads[NODE_IF]; i < ast->ifs.count; i++) {
+        NodeIf it = ast->ifs.data[i];
+        it.condition = ast_unshift(it.condition, shift);
+        it.consequence = ast_unshift(it.consequence, shift);
+        it.antecedence = ast_unshift(it.antecedence, shift);
+        da_push(&to->ifs, it);
+    }
+
+    for (size_t i = from.payloads[NODE_BLOCK]; i < ast->blocks.count; i++) {
+        NodeBlock it = ast->blocks.data[i];
+        it.body.first -= from.lists;
+        da_push(&to->blocks, it);
+    }
+
+    for (size_t i = from.payloads[NODE_RETURN]; i < ast->returns.count; i++) {
+        NodeReturn it = ast->returns.data[i];
+        it.value = ast_unshift(it.value, shift);
+        da_push(&to->returns, it);
+    }
+
+    for (size_t i = from.payloads[NODE_FN]; i < ast->fns.count; i++) {
+        NodeFn it = ast->fns.data[i];
+        it.args.first -= from.lists;
+        it.ret = ast_unshift(it.ret, shift);
+        it.body = ast_unshift(it.body, shift);
+        da_push(&to->fns, it);
+    }
+
+    for (size_t i = from.payloads[NODE_VAR]; i < ast->vars.count; i++) {
+        NodeVar it = ast->vars.data[i];
+        it.expr = ast_unshift(it.expr, shift);
+        it.type = ast_unshift(it.type, shift);
+        da_push(&to->vars, it);
+    }
+
+    for (size_t i = from.payloads[NODE_PRINT]; i < ast->prints.count; i++) {
+        NodePrint it = ast->prints.data[i];
+        it.operand = ast_unshift(it.operand, shift);
+        da_push(&to->prints, it);
+    }
+
+    ast_rewind(ast, from);
+}
+
+#define ast_array_push(a, T, index)                                                                                    \
+    do {                                                                                                               \
+        (index) = (a)->count;                                                                                          \
+        da_push((a), (T) {0});                                                                                         \
+    } while (0)
+
+static_assert(COUNT_NODES == 10, "");
+NodeId ast_push(Ast *ast, NodeKind kind, TokenKind token, uint32_t offset) {
+    if (!ast->nodes.count) {
+        da_push(&ast->nodes, (Node) {0}); // Reserve the zero ID
+    }
+
+    uint32_t data = 0;
+    switch (kind) {
+    case NODE_ATOM:
+        ast_array_push(&ast->atoms, NodeAtom, data);
+        break;
+
+    case NODE_CALL:
+        ast_array_push(&ast->calls, NodeCall, data);
+        break;
+
+    case NODE_UNARY:
+        ast_array_push(&ast->unaries, NodeUnary, data);
+        break;
+
+    case NODE_BINARY:
+        ast_array_push(&ast->binaries, NodeBinary, data);
+        break;
+
+    case NODE_IF:
+        ast_array_push(&ast->ifs, NodeIf, data);
+        break;
+
+    case NODE_BLOCK:
+        ast_array_push(&ast->blocks, NodeBlock, data);
+        break;
+
+    case NODE_RETURN:
+        ast_array_push(&ast->returns, NodeReturn, data);
+        break;
+
+    case NODE_FN:
+        ast_array_push(&ast->fns, NodeFn, data);
+        break;
+
+    case NODE_VAR:
+        ast_array_push(&ast->vars, NodeVar, data);
+        break;
+
+    case NODE_PRINT:
+        ast_array_push(&ast->prints, NodePrint, data);
+        break;
 
     default:
-        return true;
+        unreachable();
     }
+
+    const Node node = {
+        .kind = kind,
+        .token = token,
+        .offset = offset,
+        .data = data,
+    };
+    da_push(&ast->nodes, node);
+    return ast->nodes.count - 1;
 }
 
-static_assert(COUNT_TYPES == 4, "");
-bool type_is_integer(Type type) {
-    return type.kind == TYPE_I64;
+Node *ast_node(const Ast *ast, NodeId id) {
+    assert(id && id < ast->nodes.count);
+    return &ast->nodes.data[id];
 }
 
-Type node_fn_return_type(const NodeFn *fn) {
-    if (fn->ret) {
-        return fn->ret->type;
+NodeList ast_list_push(Ast *ast, const NodeId *ids, size_t count) {
+    const NodeList list = {.first = ast->lists.count, .count = count};
+    if (count) {
+        da_push_many(&ast->lists, ids, count);
     }
+    return list;
+}
 
-    return (Type) {.kind = TYPE_UNIT};
+const NodeId *ast_list(const Ast *ast, NodeList list) {
+    assert(list.first + list.count <= ast->lists.count);
+    return &ast->lists.data[list.first];
 }
+
+#define AST_PAYLOAD(name, T, array, KIND)                                                                              \
+    T *name(const Ast *ast, NodeId id) {                                                                               \
+        const Node *n = ast_node(ast, id);                                                                             \
+        assert(n->kind == KIND);                                                                                       \
+        return &ast->array.data[n->data];                                                                              \
+    }
+
+AST_PAYLOAD(ast_atom, NodeAtom, atoms, NODE_ATOM)
+AST_PAYLOAD(ast_call, NodeCall, calls, NODE_CALL)
+AST_PAYLOAD(ast_unary, NodeUnary, unaries, NODE_UNARY)
+AST_PAYLOAD(ast_binary, NodeBinary, binaries, NODE_BINARY)
+AST_PAYLOAD(ast_if, NodeIf, ifs, NODE_IF)
+AST_PAYLOAD(ast_block, NodeBlock, blocks, NODE_BLOCK)
+AST_PAYLOAD(ast_return, NodeReturn, returns, NODE_RETURN)
+AST_PAYLOAD(ast_fn, NodeFn, fns, NODE_FN)
+AST_PAYLOAD(ast_var, NodeVar, vars, NODE_VAR)
+AST_PAYLOAD(ast_print, NodePrint, prints, NODE_PRINT)
@@ -3,34 +3,18 @@
 
 #include "qbe.h"
 #include "token.h"
+#include "type.h"
 
-typedef struct Node Node;
+// Index of a node in its Ast, zero is never a valid node
+typedef uint32_t NodeId;
 
+// Contiguous run of node IDs in Ast.lists
 typedef struct {
-    Node *head;
-    Node *tail;
-} Nodes;
+    uint32_t first;
+    uint32_t count;
+} NodeList;
 
-typedef enum {
-    TYPE_UNIT,
-    TYPE_BOOL,
-    TYPE_I64,
-
-    TYPE_FN,
-
-    COUNT_TYPES
-} TypeKind;
-
-typedef struct {
-    TypeKind kind;
-    Node    *spec;
-    QbeType  qbe;
-} Type;
-
-const char *type_to_cstr(Type type);
-
-bool type_eq(Type a, Type b);
-bool type_is_integer(Type type);
+typedef struct Ast Ast;
 
 typedef enum {
     NODE_ATOM,
@@ -49,69 +33,62 @@ typedef enum {
     COUNT_NODES
 } NodeKind;
 
-struct Node {
-    NodeKind kind;
+// Fields shared by every node. The rest lives at index 'data' in the array of the node's kind.
+typedef struct {
+    uint8_t  kind;
+    uint8_t  token;
+    uint32_t offset;
+    uint32_t data;
     Type     type;
-    Token    token;
-    Node    *next;
-};
+} Node;
 
 typedef struct {
-    Node  node;
-    Node *definition;
+    TokenValue as;
+    NodeId     definition;
 } NodeAtom;
 
 typedef struct {
-    Node  node;
-    Node *fn;
-
-    Nodes  args;
-    size_t arity;
+    NodeId   fn;
+    NodeList args;
 } NodeCall;
 
 typedef struct {
-    Node  node;
-    Node *operand;
+    NodeId operand;
 } NodeUnary;
 
 typedef struct {
-    Node  node;
-    Node *lhs;
-    Node *rhs;
+    NodeId lhs;
+    NodeId rhs;
 } NodeBinary;
 
 typedef struct {
-    Node  node;
-    Node *condition;
-    Node *consequence;
-    Node *antecedence;
+    NodeId condition;
+    NodeId consequence;
+    NodeId antecedence;
 } NodeIf;
 
 typedef struct {
-    Node  node;
-    Nodes body;
+    NodeList body;
 } NodeBlock;
 
 typedef struct {
-    Node  node;
-    Node *value;
+    NodeId value;
 } NodeReturn;
 
 typedef struct {
-    Node node;
+    Symbol   name;
+    NodeList args;
 
-    Nodes  args;
-    size_t arity;
+    NodeId ret;
+    NodeId body;
+    bool   local;
 
-    Node *ret;
-    Node *body;
-    bool  local;
+    // Module the function was imported from, which only declares it. Zero if it is defined here.
+    Symbol module;
 
     QbeNode *qbe;
 } NodeFn;
 
-Type node_fn_return_type(const NodeFn *fn);
-
 typedef enum {
     NODE_VAR_GLOBAL,
     NODE_VAR_LOCAL,
@@ -119,18 +96,77 @@ typedef enum {
 } NodeVarKind;
 
 typedef struct {
-    Node node;
+    Symbol name;
 
-    Node *expr;
-    Node *type;
+    NodeId expr;
+    NodeId type;
 
     NodeVarKind kind;
+    Symbol      module; // As for NodeFn
     QbeNode    *qbe;
 } NodeVar;
 
 typedef struct {
-    Node  node;
-    Node *operand;
+    NodeId operand;
 } NodePrint;
 
+#define AST_ARRAY(T)                                                                                                   \
+    struct {                                                                                                           \
+        T     *data;                                                                                                   \
+        size_t count;                                                                                                  \
+        size_t capacity;                                                                                               \
+    }
+
+// Nodes are stored in parse order, so walking the tree in source order walks memory linearly
+struct Ast {
+    AST_ARRAY(Node) nodes;
+    AST_ARRAY(NodeId) lists;
+
+    AST_ARRAY(NodeAtom) atoms;
+    AST_ARRAY(NodeCall) calls;
+    AST_ARRAY(NodeUnary) unaries;
+    AST_ARRAY(NodeBinary) binaries;
+    AST_ARRAY(NodeIf) ifs;
+    AST_ARRAY(NodeBlock) blocks;
+    AST_ARRAY(NodeReturn) returns;
+    AST_ARRAY(NodeFn) fns;
+    AST_ARRAY(NodeVar) vars;
+    AST_ARRAY(NodePrint) prints;
+};
+
+typedef struct {
+    uint32_t nodes;
+    uint32_t lists;
+    uint32_t payloads[COUNT_NODES];
+} AstMark;
+
+void ast_free(Ast *ast);
+
+AstMark ast_mark(const Ast *ast);
+void    ast_rewind(Ast *ast, AstMark m);
+
+// Appends a copy of 'from', returning what was added to its node IDs
+uint32_t ast_append(Ast *ast, const Ast *from);
+
+// Moves everything pushed since the mark into 'to', as a tree of its own that ast_append() can put back once the
+// tree has grown differently. Definitions from before the mark have no ID in 'to', so they become zero.
+void ast_split(Ast *ast, AstMark from, Ast *to);
+
+NodeId ast_push(Ast *ast, NodeKind kind, TokenKind token, uint32_t offset);
+Node  *ast_node(const Ast *ast, NodeId id);
+
+NodeList      ast_list_push(Ast *ast, const NodeId *ids, size_t count);
+const NodeId *ast_list(const Ast *ast, NodeList list);
+
+NodeAtom   *ast_atom(const Ast *ast, NodeId id);
+NodeCall   *ast_call(const Ast *ast, NodeId id);
+NodeUnary  *ast_unary(const Ast *ast, NodeId id);
+NodeBinary *ast_binary(const Ast *ast, NodeId id);
+NodeIf     *ast_if(const Ast *ast, NodeId id);
+NodeBlock  *ast_block(const Ast *ast, NodeId id);
+NodeReturn *ast_return(const Ast *ast, NodeId id);
+NodeFn     *ast_fn(const Ast *ast, NodeId id);
+NodeVar    *ast_var(const Ast *ast, NodeId id);
+NodePrint  *ast_print(const Ast *ast, NodeId id);
+
 #endif // NODE_H
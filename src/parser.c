@@ -1,16 +1,85 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+
 #include "parser.h"
 #include "node.h"
 
-static void nodes_push(Nodes *ns, Node *n) {
-    if (ns->tail) {
-        ns->tail->next = n;
-        ns->tail = n;
-    } else {
-        ns->head = n;
-        ns->tail = n;
+#define PARSER_WINDOW 4096
+
+__attribute__((format(printf, 3, 4))) static _Noreturn void
+parser_fail(Parser *p, uint32_t offset, const char *fmt, ...) {
+    assert(p->bail);
+
+    va_list args;
+    va_start(args, fmt);
+    p->error = diagnostics_verror(offset, fmt, args);
+    va_end(args);
+
+    longjmp(*p->bail, 1);
+}
+
+// A lexical error ends the stream early. It is reported once the parser reaches the end, which is exactly when lexing
+// on demand would have run into it, so diagnostics still come out in source order.
+static size_t parser_index(Parser *p) {
+    while (p->index >= p->tokens.count) {
+        assert(p->streaming);
+        lexer_fill(&p->lexer, &p->tokens, PARSER_WINDOW);
+    }
+
+    if (p->tokens.kinds[p->index] == TOKEN_EOF && p->tokens.error) {
+        parser_fail(p, p->tokens.error_offset, "%s", p->tokens.error);
+    }
+    return p->index;
+}
+
+// The index is taken first, as refilling the window can move the token arrays
+static TokenKind parser_peek(Parser *p) {
+    const size_t index = parser_index(p);
+    return p->tokens.kinds[index];
+}
+
+static bool parser_peek_newline(Parser *p) {
+    const size_t index = parser_index(p);
+    return p->tokens.flags[index] & TOKEN_FLAG_NEWLINE;
+}
+
+static size_t parser_next(Parser *p) {
+    const size_t index = parser_index(p);
+    if (p->tokens.kinds[index] != TOKEN_EOF) {
+        p->index++;
+    }
+    return index;
+}
+
+static bool parser_read(Parser *p, TokenKind kind) {
+    if (parser_peek(p) != kind) {
+        return false;
+    }
+
+    parser_next(p);
+    return true;
+}
+
+static size_t parser_expect_impl(Parser *p, const TokenKind *kinds) {
+    const size_t    index = parser_next(p);
+    const TokenKind kind = p->tokens.kinds[index];
+    for (const TokenKind *it = kinds; *it != TOKEN_EOF; it++) {
+        if (kind == *it) {
+            return index;
+        }
     }
+
+    const char *expected = "";
+    for (const TokenKind *it = kinds; *it != TOKEN_EOF; it++) {
+        expected = temp_sprintf("%s%s%s", expected, it != kinds ? " or " : "", token_kind_to_cstr(*it));
+    }
+
+    parser_fail(p, p->tokens.offsets[index], "Expected %s, got %s", expected, token_kind_to_cstr(kind));
 }
 
+#define parser_expect(p, ...) parser_expect_impl((p), (const TokenKind[]) {__VA_ARGS__, TOKEN_EOF})
+
 typedef enum {
     POWER_NIL,
     POWER_SET,
@@ -20,7 +89,7 @@ typedef enum {
     POWER_DOT
 } Power;
 
-static_assert(COUNT_TOKENS == 21, "");
+static_assert(COUNT_TOKENS == 22, "");
 static Power token_kind_to_power(TokenKind kind) {
     switch (kind) {
     case TOKEN_LPAREN:
@@ -42,40 +111,22 @@ static Power token_kind_to_power(TokenKind kind) {
     }
 }
 
-static_assert(COUNT_NODES == 10, "");
-static void *node_alloc(Parser *p, NodeKind kind, Token token) {
-    static const size_t sizes[COUNT_NODES] = {
-        [NODE_ATOM] = sizeof(NodeAtom),
-        [NODE_CALL] = sizeof(NodeCall),
-        [NODE_UNARY] = sizeof(NodeUnary),
-        [NODE_BINARY] = sizeof(NodeBinary),
-
-        [NODE_IF] = sizeof(NodeIf),
-        [NODE_BLOCK] = sizeof(NodeBlock),
-
-        [NODE_RETURN] = sizeof(NodeReturn),
-
-        [NODE_FN] = sizeof(NodeFn),
-        [NODE_VAR] = sizeof(NodeVar),
-
-        [NODE_PRINT] = sizeof(NodePrint),
-    };
-
-    assert(kind >= NODE_ATOM && kind < COUNT_NODES);
-    const size_t size = sizes[kind];
+static NodeId node_alloc(Parser *p, NodeKind kind, size_t token) {
+    return ast_push(p->ast, kind, p->tokens.kinds[token], p->tokens.offsets[token]);
+}
 
-    Node *node = arena_alloc(p->arena, size);
-    node->kind = kind;
-    node->token = token;
-    return node;
+static NodeList parser_list(Parser *p, size_t base) {
+    assert(base <= p->stack.count);
+    const NodeList list = ast_list_push(p->ast, p->stack.data + base, p->stack.count - base);
+    p->stack.count = base;
+    return list;
 }
 
-static void error_unexpected(Token token) {
-    fprintf(stderr, PosFmt "ERROR: Unexpected %s\n", PosArg(token.pos), token_kind_to_cstr(token.kind));
-    exit(1);
+static void error_unexpected(Parser *p, size_t token) {
+    parser_fail(p, p->tokens.offsets[token], "Unexpected %s", token_kind_to_cstr(p->tokens.kinds[token]));
 }
 
-static_assert(COUNT_TOKENS == 21, "");
+static_assert(COUNT_TOKENS == 22, "");
 static bool token_kind_is_start_of_type(TokenKind k) {
     switch (k) {
     case TOKEN_IDENT:
@@ -87,72 +138,76 @@ static bool token_kind_is_start_of_type(TokenKind k) {
     }
 }
 
-static_assert(COUNT_TOKENS == 21, "");
-static Node *parse_type(Parser *p) {
-    Node *node = NULL;
-    Token token = lexer_next(&p->lexer);
+static_assert(COUNT_TOKENS == 22, "");
+static NodeId parse_type(Parser *p) {
+    NodeId       node = 0;
+    const size_t token = parser_next(p);
 
-    switch (token.kind) {
+    switch (p->tokens.kinds[token]) {
     case TOKEN_IDENT:
         node = node_alloc(p, NODE_ATOM, token);
+        ast_atom(p->ast, node)->as = p->tokens.values[token];
         break;
 
     case TOKEN_FN: {
-        NodeFn *fn = node_alloc(p, NODE_FN, token);
+        node = node_alloc(p, NODE_FN, token);
 
-        lexer_expect(&p->lexer, TOKEN_LPAREN);
-        while (!lexer_read(&p->lexer, TOKEN_RPAREN)) {
-            NodeVar *arg = node_alloc(p, NODE_VAR, fn->node.token);
-            arg->type = parse_type(p);
+        const size_t base = p->stack.count;
+        parser_expect(p, TOKEN_LPAREN);
+        while (!parser_read(p, TOKEN_RPAREN)) {
+            const NodeId arg = node_alloc(p, NODE_VAR, token);
+            const NodeId type = parse_type(p);
+            ast_var(p->ast, arg)->type = type;
+            da_push(&p->stack, arg);
 
-            nodes_push(&fn->args, (Node *) arg);
-            fn->arity++;
-
-            token = lexer_expect(&p->lexer, TOKEN_COMMA, TOKEN_RPAREN);
-            if (token.kind != TOKEN_COMMA) {
+            if (p->tokens.kinds[parser_expect(p, TOKEN_COMMA, TOKEN_RPAREN)] != TOKEN_COMMA) {
                 break;
             }
         }
+        const NodeList args = parser_list(p, base);
 
-        token = lexer_peek(&p->lexer);
-        if (!token.newline && token_kind_is_start_of_type(token.kind)) {
-            fn->ret = parse_type(p);
+        NodeId ret = 0;
+        if (!parser_peek_newline(p) && token_kind_is_start_of_type(parser_peek(p))) {
+            ret = parse_type(p);
         }
 
-        node = (Node *) fn;
+        NodeFn *fn = ast_fn(p->ast, node);
+        fn->args = args;
+        fn->ret = ret;
     } break;
 
     default:
-        error_unexpected(token);
+        error_unexpected(p, token);
         break;
     }
 
     return node;
 }
 
-static Node *parse_fn(Parser *p, Token name);
+static NodeId parse_fn(Parser *p, size_t name);
 
-static_assert(COUNT_TOKENS == 21, "");
-static Node *parse_expr(Parser *p, Power mbp) {
-    Node *node = NULL;
-    Token token = lexer_next(&p->lexer);
+static_assert(COUNT_TOKENS == 22, "");
+static NodeId parse_expr(Parser *p, Power mbp) {
+    NodeId node = 0;
+    size_t token = parser_next(p);
 
-    switch (token.kind) {
+    switch (p->tokens.kinds[token]) {
     case TOKEN_INT:
     case TOKEN_BOOL:
     case TOKEN_IDENT:
         node = node_alloc(p, NODE_ATOM, token);
+        ast_atom(p->ast, node)->as = p->tokens.values[token];
         break;
 
     case TOKEN_SUB: {
-        NodeUnary *unary = node_alloc(p, NODE_UNARY, token);
-        unary->operand = parse_expr(p, POWER_PRE);
-        node = (Node *) unary;
+        node = node_alloc(p, NODE_UNARY, token);
+        const NodeId operand = parse_expr(p, POWER_PRE);
+        ast_unary(p->ast, node)->operand = operand;
     } break;
 
     case TOKEN_LPAREN:
         node = parse_expr(p, POWER_SET);
-        lexer_expect(&p->lexer, TOKEN_RPAREN);
+        parser_expect(p, TOKEN_RPAREN);
         break;
 
     case TOKEN_FN:
@@ -160,42 +215,48 @@ static Node *parse_expr(Parser *p, Power mbp) {
         break;
 
     default:
-        error_unexpected(token);
+        error_unexpected(p, token);
     }
 
     while (true) {
-        token = lexer_peek(&p->lexer);
-        if (token.newline) {
+        if (parser_peek_newline(p)) {
             break;
         }
 
-        const Power lbp = token_kind_to_power(token.kind);
+        const Power lbp = token_kind_to_power(parser_peek(p));
         if (lbp <= mbp) {
             break;
         }
-        lexer_unbuffer(&p->lexer);
+        token = parser_next(p);
 
-        switch (token.kind) {
+        switch (p->tokens.kinds[token]) {
         case TOKEN_LPAREN: {
-            NodeCall *call = node_alloc(p, NODE_CALL, token);
-            call->fn = node;
-            while (!lexer_read(&p->lexer, TOKEN_RPAREN)) {
-                nodes_push(&call->args, parse_expr(p, POWER_SET));
-                call->arity++;
-
-                token = lexer_expect(&p->lexer, TOKEN_COMMA, TOKEN_RPAREN);
-                if (token.kind != TOKEN_COMMA) {
+            const NodeId call = node_alloc(p, NODE_CALL, token);
+
+            const size_t base = p->stack.count;
+            while (!parser_read(p, TOKEN_RPAREN)) {
+                const NodeId arg = parse_expr(p, POWER_SET);
+                da_push(&p->stack, arg);
+
+                if (p->tokens.kinds[parser_expect(p, TOKEN_COMMA, TOKEN_RPAREN)] != TOKEN_COMMA) {
                     break;
                 }
             }
-            node = (Node *) call;
+
+            NodeCall *it = ast_call(p->ast, call);
+            it->fn = node;
+            it->args = parser_list(p, base);
+            node = call;
         } break;
 
         default: {
-            NodeBinary *binary = node_alloc(p, NODE_BINARY, token);
-            binary->lhs = node;
-            binary->rhs = parse_expr(p, lbp);
-            node = (Node *) binary;
+            const NodeId binary = node_alloc(p, NODE_BINARY, token);
+            const NodeId rhs = parse_expr(p, lbp);
+
+            NodeBinary *it = ast_binary(p->ast, binary);
+            it->lhs = node;
+            it->rhs = rhs;
+            node = binary;
         } break;
         }
     }
@@ -204,102 +265,137 @@ static Node *parse_expr(Parser *p, Power mbp) {
 }
 
 static void consume_eols(Parser *p) {
-    while (lexer_read(&p->lexer, TOKEN_EOL));
+    while (parser_read(p, TOKEN_EOL));
 }
 
-static void local_assert(Parser *p, Token token, bool local) {
+static void local_assert(Parser *p, size_t token, bool local) {
     if (p->local != local) {
-        fprintf(
-            stderr,
-            PosFmt "ERROR: Unexpected %s in %s scope\n",
-            PosArg(token.pos),
-            token_kind_to_cstr(token.kind),
+        parser_fail(
+            p,
+            p->tokens.offsets[token],
+            "Unexpected %s in %s scope",
+            token_kind_to_cstr(p->tokens.kinds[token]),
             p->local ? "local" : "global");
-
-        exit(1);
     }
 }
 
-static_assert(COUNT_TOKENS == 21, "");
-static Node *parse_stmt(Parser *p) {
-    Node *node = NULL;
+static NodeId parse_stmt(Parser *p);
 
-    Token token = lexer_next(&p->lexer);
-    switch (token.kind) {
-    case TOKEN_LBRACE: {
-        local_assert(p, token, true);
-        NodeBlock *block = node_alloc(p, NODE_BLOCK, token);
-        while (!lexer_read(&p->lexer, TOKEN_RBRACE)) {
-            nodes_push(&block->body, parse_stmt(p));
+// Each 'else if' of a ladder is linked in place rather than parsed by recursing, so generated code can chain any
+// number of them
+static NodeId parse_if(Parser *p, size_t token) {
+    const NodeId node = node_alloc(p, NODE_IF, token);
+
+    NodeId iff = node;
+    while (true) {
+        const NodeId condition = parse_expr(p, POWER_SET);
+
+        // The brace is only checked here, parse_stmt() consumes it
+        p->index = parser_expect(p, TOKEN_LBRACE);
+        const NodeId consequence = parse_stmt(p);
+
+        NodeIf *it = ast_if(p->ast, iff);
+        it->condition = condition;
+        it->consequence = consequence;
+
+        if (!parser_read(p, TOKEN_ELSE)) {
+            break;
         }
 
-        assert(p->lexer.buffer.kind == TOKEN_RBRACE);
-        block->node.token = p->lexer.buffer;
+        const size_t next = parser_expect(p, TOKEN_LBRACE, TOKEN_IF);
+        if (p->tokens.kinds[next] == TOKEN_LBRACE) {
+            p->index = next;
+            const NodeId antecedence = parse_stmt(p);
+            ast_if(p->ast, iff)->antecedence = antecedence;
+            break;
+        }
 
-        node = (Node *) block;
-    } break;
+        const NodeId antecedence = node_alloc(p, NODE_IF, next);
+        ast_if(p->ast, iff)->antecedence = antecedence;
+        iff = antecedence;
+    }
 
-    case TOKEN_IF: {
-        local_assert(p, token, true);
+    return node;
+}
 
-        NodeIf *iff = node_alloc(p, NODE_IF, token);
-        iff->condition = parse_expr(p, POWER_SET);
+static_assert(COUNT_TOKENS == 22, "");
+static NodeId parse_stmt(Parser *p) {
+    NodeId node = 0;
 
-        lexer_buffer(&p->lexer, lexer_expect(&p->lexer, TOKEN_LBRACE));
-        iff->consequence = parse_stmt(p);
+    const size_t token = parser_next(p);
+    switch (p->tokens.kinds[token]) {
+    case TOKEN_LBRACE: {
+        local_assert(p, token, true);
+        node = node_alloc(p, NODE_BLOCK, token);
 
-        if (lexer_read(&p->lexer, TOKEN_ELSE)) {
-            lexer_buffer(&p->lexer, lexer_expect(&p->lexer, TOKEN_LBRACE, TOKEN_IF));
-            iff->antecedence = parse_stmt(p);
+        const size_t base = p->stack.count;
+        while (!parser_read(p, TOKEN_RBRACE)) {
+            const NodeId stmt = parse_stmt(p);
+            da_push(&p->stack, stmt);
         }
+        ast_block(p->ast, node)->body = parser_list(p, base);
 
-        node = (Node *) iff;
+        // Blocks are located at their closing brace
+        Node *header = ast_node(p->ast, node);
+        header->token = p->tokens.kinds[p->index - 1];
+        header->offset = p->tokens.offsets[p->index - 1];
     } break;
 
+    case TOKEN_IF:
+        local_assert(p, token, true);
+        node = parse_if(p, token);
+        break;
+
     case TOKEN_RETURN: {
-        NodeReturn *ret = node_alloc(p, NODE_RETURN, token);
+        local_assert(p, token, true);
+        node = node_alloc(p, NODE_RETURN, token);
 
-        token = lexer_peek(&p->lexer);
-        if (!token.newline && token.kind != TOKEN_EOL && token.kind != TOKEN_RBRACE) {
-            ret->value = parse_expr(p, POWER_SET);
+        const TokenKind next = parser_peek(p);
+        if (!parser_peek_newline(p) && next != TOKEN_EOL && next != TOKEN_RBRACE) {
+            const NodeId value = parse_expr(p, POWER_SET);
+            ast_return(p->ast, node)->value = value;
         }
-
-        node = (Node *) ret;
     } break;
 
     case TOKEN_FN:
-        node = parse_fn(p, lexer_expect(&p->lexer, TOKEN_IDENT));
+        node = parse_fn(p, parser_expect(p, TOKEN_IDENT));
         break;
 
     case TOKEN_VAR: {
-        NodeVar *var = node_alloc(p, NODE_VAR, lexer_expect(&p->lexer, TOKEN_IDENT));
-        token = lexer_peek(&p->lexer);
-        if (token.kind != TOKEN_SET) {
-            var->type = parse_type(p);
+        const size_t name = parser_expect(p, TOKEN_IDENT);
+        node = node_alloc(p, NODE_VAR, name);
+
+        NodeId type = 0;
+        if (parser_peek(p) != TOKEN_SET) {
+            type = parse_type(p);
         }
 
-        if (lexer_read(&p->lexer, TOKEN_SET)) {
-            var->expr = parse_expr(p, POWER_SET);
+        NodeId expr = 0;
+        if (parser_read(p, TOKEN_SET)) {
+            expr = parse_expr(p, POWER_SET);
         }
 
+        NodeVar *var = ast_var(p->ast, node);
+        var->name = p->tokens.values[name].symbol;
+        var->type = type;
+        var->expr = expr;
         if (p->local) {
             var->kind = NODE_VAR_LOCAL;
         } else {
             var->kind = NODE_VAR_GLOBAL;
         }
-        node = (Node *) var;
     } break;
 
     case TOKEN_PRINT: {
         local_assert(p, token, true);
-        NodePrint *print = node_alloc(p, NODE_PRINT, token);
-        print->operand = parse_expr(p, POWER_SET);
-        node = (Node *) print;
+        node = node_alloc(p, NODE_PRINT, token);
+        const NodeId operand = parse_expr(p, POWER_SET);
+        ast_print(p->ast, node)->operand = operand;
     } break;
 
     default:
         local_assert(p, token, true);
-        lexer_buffer(&p->lexer, token);
+        p->index = token;
         node = parse_expr(p, POWER_NIL);
         break;
     }
@@ -308,50 +404,328 @@ static Node *parse_stmt(Parser *p) {
     return node;
 }
 
-static Node *parse_fn(Parser *p, Token token) {
-    NodeFn *fn = node_alloc(p, NODE_FN, token);
-    fn->local = p->local;
-    lexer_expect(&p->lexer, TOKEN_LPAREN);
+static NodeId parse_fn(Parser *p, size_t name) {
+    const NodeId node = node_alloc(p, NODE_FN, name);
+    parser_expect(p, TOKEN_LPAREN);
 
-    const bool local_save = p->local;
+    const bool local = p->local;
     p->local = true;
 
-    while (!lexer_read(&p->lexer, TOKEN_RPAREN)) {
-        NodeVar *arg = node_alloc(p, NODE_VAR, lexer_expect(&p->lexer, TOKEN_IDENT));
-        arg->kind = NODE_VAR_ARG;
-        arg->type = parse_type(p);
+    const size_t base = p->stack.count;
+    while (!parser_read(p, TOKEN_RPAREN)) {
+        const size_t arg_name = parser_expect(p, TOKEN_IDENT);
+        const NodeId arg = node_alloc(p, NODE_VAR, arg_name);
+        const NodeId type = parse_type(p);
 
-        nodes_push(&fn->args, (Node *) arg);
-        fn->arity++;
+        NodeVar *var = ast_var(p->ast, arg);
+        var->name = p->tokens.values[arg_name].symbol;
+        var->kind = NODE_VAR_ARG;
+        var->type = type;
+        da_push(&p->stack, arg);
 
-        token = lexer_expect(&p->lexer, TOKEN_COMMA, TOKEN_RPAREN);
-        if (token.kind != TOKEN_COMMA) {
+        if (p->tokens.kinds[parser_expect(p, TOKEN_COMMA, TOKEN_RPAREN)] != TOKEN_COMMA) {
             break;
         }
     }
+    const NodeList args = parser_list(p, base);
 
-    token = lexer_peek(&p->lexer);
-    if (!token.newline && token_kind_is_start_of_type(token.kind)) {
-        fn->ret = parse_type(p);
+    NodeId ret = 0;
+    if (!parser_peek_newline(p) && token_kind_is_start_of_type(parser_peek(p))) {
+        ret = parse_type(p);
     }
 
-    lexer_buffer(&p->lexer, lexer_expect(&p->lexer, TOKEN_LBRACE));
-    fn->body = parse_stmt(p);
+    p->index = parser_expect(p, TOKEN_LBRACE);
+    const NodeId body = parse_stmt(p);
+
+    p->local = local;
 
-    p->local = local_save;
-    return (Node *) fn;
+    // Function literals are left without a name, so any number of them can share a scope
+    NodeFn *fn = ast_fn(p->ast, node);
+    fn->name = p->tokens.kinds[name] == TOKEN_IDENT ? p->tokens.values[name].symbol : SYMBOL_NONE;
+    fn->args = args;
+    fn->ret = ret;
+    fn->body = body;
+    fn->local = local;
+    return node;
 }
 
-void parse_file(Parser *p, Lexer lexer) {
-    assert(p->arena);
+static void parse_import(Parser *p) {
+    const size_t token = parser_next(p);
+    if (p->declared) {
+        parser_fail(p, p->tokens.offsets[token], "Imports must come before every declaration");
+    }
 
-    p->lexer = lexer;
-    while (true) {
+    if (!p->modules) {
+        parser_fail(p, p->tokens.offsets[token], "Imports are only supported when building or checking a file");
+    }
+
+    const size_t name = parser_expect(p, TOKEN_IDENT);
+    const Import it = {.name = p->tokens.values[name].symbol, .offset = p->tokens.offsets[name]};
+    da_push(&p->imports, it);
+}
+
+static NodeId parse_top(Parser *p) {
+    consume_eols(p);
+    while (parser_peek(p) == TOKEN_IMPORT) {
+        parse_import(p);
         consume_eols(p);
-        if (lexer_read(&p->lexer, TOKEN_EOF)) {
+    }
+
+    if (parser_read(p, TOKEN_EOF)) {
+        return 0;
+    }
+
+    // Nothing refers back to earlier statements' tokens
+    if (p->streaming) {
+        tokens_drop(&p->tokens, p->index);
+        p->index = 0;
+    }
+
+    p->declared = true;
+    return parse_stmt(p);
+}
+
+static void parse_all(Parser *p, Tokens tokens) {
+    assert(p->ast);
+
+    p->tokens = tokens;
+    p->index = 0;
+
+    const size_t base = p->stack.count;
+    while (true) {
+        const NodeId stmt = parse_top(p);
+        if (!stmt) {
+            break;
+        }
+        da_push(&p->stack, stmt);
+    }
+    p->nodes = parser_list(p, base);
+}
+
+#define PARSE_CHUNK_MIN (1 << 20)
+
+typedef struct {
+    Lexer  lexer; // Covers only the chunk
+    Ast    ast;
+    Parser parser;
+    bool   failed;
+} Chunk;
+
+static bool is_declaration(const char *data, const char *end) {
+    static const char *const keywords[] = {"fn", "var"};
+    for (size_t i = 0; i < len(keywords); i++) {
+        const size_t n = strlen(keywords[i]);
+        if (end - data > (ptrdiff_t) n && !memcmp(data, keywords[i], n) && (data[n] == ' ' || data[n] == '\t')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Chunks start at an 'fn' or 'var' at the start of a line outside any braces, as near to an even split as possible.
+// Only braces and comments are looked at, so this is a guess. A wrong one makes a chunk fail, and the file is parsed
+// again as a whole.
+static size_t split_chunks(SV sv, size_t *starts, size_t count) {
+    const char *data = sv.data;
+    const char *end = sv.data + sv.count;
+
+    size_t found = 1;
+    size_t depth = 0;
+    starts[0] = 0;
+
+    while (data < end && found < count) {
+        switch (*data) {
+        case '{':
+            depth++;
             break;
+
+        case '}':
+            depth -= depth > 0;
+            break;
+
+        case '/':
+            if (data + 1 < end && data[1] == '/') {
+                data = memchr(data, '\n', end - data);
+                if (!data) {
+                    return found;
+                }
+                continue;
+            }
+            break;
+
+        case '\n':
+            if (!depth && (size_t) (data + 1 - sv.data) >= found * sv.count / count && is_declaration(data + 1, end)) {
+                starts[found++] = data + 1 - sv.data;
+            }
+            break;
+        }
+        data++;
+    }
+
+    return found;
+}
+
+static void *parse_chunk(void *arg) {
+    Chunk *c = arg;
+
+    Tokens tokens = {0};
+    lexer_tokenize(&c->lexer, &tokens);
+
+    // A chunk only needs to know that it failed. The file is then parsed again as a whole, which reports the first
+    // error in source order.
+    if (!parse_tokens(&c->parser, tokens)) {
+        c->failed = true;
+        diagnostics_free(c->parser.error);
+    }
+
+    tokens_free(&c->parser.tokens);
+    return NULL;
+}
+
+// Threads of their own release their scratch arena, the calling thread keeps it
+static void *parse_chunk_thread(void *arg) {
+    parse_chunk(arg);
+    temp_free();
+    return NULL;
+}
+
+static void parse_chunks(Chunk *chunks, size_t count) {
+    pthread_t *threads = malloc(count * sizeof(*threads));
+    assert(threads);
+
+    // Chunks that could not get a thread of their own are parsed here
+    size_t started = 1;
+    while (started < count && !pthread_create(&threads[started], NULL, parse_chunk_thread, &chunks[started])) {
+        started++;
+    }
+
+    for (size_t i = started; i < count; i++) {
+        parse_chunk(&chunks[i]);
+    }
+    parse_chunk(&chunks[0]);
+
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+// Each chunk is lexed and parsed into an Ast of its own, which are then appended in source order
+static bool parse_file_parallel(Parser *p, Lexer lexer) {
+    size_t count = lexer.sv.count / PARSE_CHUNK_MIN;
+
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && count > (size_t) cpus) {
+        count = cpus;
+    }
+
+    if (count <= 1) {
+        return false;
+    }
+
+    size_t *starts = malloc(count * sizeof(*starts));
+    assert(starts);
+
+    count = split_chunks(lexer.sv, starts, count);
+    if (count <= 1) {
+        free(starts);
+        return false;
+    }
+
+    Chunk *chunks = calloc(count, sizeof(*chunks));
+    assert(chunks);
+
+    for (size_t i = 0; i < count; i++) {
+        const size_t end = i + 1 < count ? starts[i + 1] : lexer.sv.count;
+
+        Chunk *it = &chunks[i];
+        it->lexer = lexer;
+        it->lexer.sv = (SV) {.data = lexer.sv.data + starts[i], .count = end - starts[i]};
+        it->parser.ast = &it->ast;
+        it->parser.modules = p->modules;
+        it->parser.declared = i > 0; // Imports can only be in the first chunk
+    }
+    free(starts);
+
+    parse_chunks(chunks, count);
+
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        ok = ok && !chunks[i].failed;
+    }
+
+    const size_t base = p->stack.count;
+    for (size_t i = 0; i < count; i++) {
+        Chunk *it = &chunks[i];
+        if (ok) {
+            da_push_many(&p->imports, it->parser.imports.data, it->parser.imports.count);
+
+            const uint32_t shift = ast_append(p->ast, &it->ast);
+            const NodeId  *nodes = ast_list(&it->ast, it->parser.nodes);
+            for (size_t j = 0; j < it->parser.nodes.count; j++) {
+                da_push(&p->stack, nodes[j] + shift);
+            }
         }
 
-        nodes_push(&p->nodes, parse_stmt(p));
+        ast_free(&it->ast);
+        da_free(&it->parser.stack);
+        da_free(&it->parser.imports);
+    }
+    free(chunks);
+
+    if (ok) {
+        p->nodes = parser_list(p, base);
     }
+    return ok;
+}
+
+bool parse_file(Parser *p, Lexer lexer) {
+    if (parse_file_parallel(p, lexer)) {
+        return true;
+    }
+
+    Tokens tokens = {0};
+    lexer_tokenize(&lexer, &tokens);
+    return parse_tokens(p, tokens);
+}
+
+bool parse_tokens(Parser *p, Tokens tokens) {
+    jmp_buf bail;
+    p->bail = &bail;
+    if (setjmp(bail)) {
+        p->bail = NULL;
+        return false;
+    }
+
+    parse_all(p, tokens);
+    p->bail = NULL;
+    return true;
+}
+
+void parser_free(Parser *p) {
+    tokens_free(&p->tokens);
+    da_free(&p->stack);
+    da_free(&p->imports);
+}
+
+void parse_begin(Parser *p, Lexer lexer) {
+    assert(p->ast);
+
+    p->lexer = lexer;
+    p->streaming = true;
+    p->tokens = (Tokens) {0};
+    p->index = 0;
+}
+
+NodeId parse_next(Parser *p) {
+    jmp_buf bail;
+    p->bail = &bail;
+    if (setjmp(bail)) {
+        p->bail = NULL;
+        return 0;
+    }
+
+    const NodeId id = parse_top(p);
+    p->bail = NULL;
+    return id;
 }
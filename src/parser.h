@@ -1,17 +1,62 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <setjmp.h>
+
+#include "diagnostic.h"
 #include "lexer.h"
 #include "node.h"
 
 typedef struct {
-    Arena *arena;
-    Lexer  lexer;
-    bool   local;
+    Symbol   name;
+    uint32_t offset;
+} Import;
+
+typedef struct {
+    Import *data;
+    size_t  count;
+    size_t  capacity;
+} Imports;
+
+typedef struct {
+    Ast *ast;
+    bool local;
+
+    Tokens tokens;
+    size_t index;
 
-    Nodes nodes;
+    // Set when streaming, tokens are then lexed on demand and dropped between top-level statements
+    Lexer lexer;
+    bool  streaming;
+
+    // Children of the lists still being parsed, moved into Ast.lists once complete
+    struct {
+        NodeId *data;
+        size_t  count;
+        size_t  capacity;
+    } stack;
+
+    NodeList nodes;
+
+    // Modules named by 'import', which comes before every declaration. Finding them is up to the caller, so imports
+    // are an error unless 'modules' is set.
+    bool    modules;
+    bool    declared;
+    Imports imports;
+
+    // Errors unwind to 'bail', which the entry points below set. They return failure with the error in 'error'.
+    jmp_buf     *bail;
+    Diagnostics *error;
 } Parser;
 
-void parse_file(Parser *p, Lexer lexer);
+void parser_free(Parser *p);
+
+// Large files are split at top-level declarations and parsed on several threads
+bool parse_file(Parser *p, Lexer lexer);
+bool parse_tokens(Parser *p, Tokens tokens);
+
+// Parses one top-level statement at a time, returning zero at the end of the file or on an error
+void   parse_begin(Parser *p, Lexer lexer);
+NodeId parse_next(Parser *p);
 
 #endif // PARSER_H
@@ -0,0 +1,359 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "checker.h"
+#include "compiler.h"
+#include "parser.h"
+#include "server.h"
+
+// Messages are strings, each a 32-bit length in host order followed by the bytes. A request is the working directory
+// of the client, the input and the output. The response is the diagnostics of the build, empty if it succeeded.
+static bool write_all(int fd, const void *data, size_t count) {
+    while (count) {
+        const ssize_t n = write(fd, data, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        data = (const char *) data + n;
+        count -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *data, size_t count) {
+    while (count) {
+        const ssize_t n = read(fd, data, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        data = (char *) data + n;
+        count -= n;
+    }
+    return true;
+}
+
+static bool send_str(int fd, const char *s) {
+    const uint32_t n = strlen(s);
+    return write_all(fd, &n, sizeof(n)) && write_all(fd, s, n);
+}
+
+static char *recv_str(int fd, uint32_t max) {
+    uint32_t n = 0;
+    if (!read_all(fd, &n, sizeof(n)) || n > max) {
+        return NULL;
+    }
+
+    char *s = malloc((size_t) n + 1);
+    assert(s);
+    if (!read_all(fd, s, n)) {
+        free(s);
+        return NULL;
+    }
+
+    s[n] = '\0';
+    return s;
+}
+
+const char *server_socket(void) {
+    const char *path = getenv("GLOS_SOCKET");
+    if (path) {
+        return path;
+    }
+
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir) {
+        return temp_sprintf("%s/glos.sock", dir);
+    }
+    return temp_sprintf("/tmp/glos-%d.sock", (int) getuid());
+}
+
+static bool socket_addr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        return false;
+    }
+
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+static int socket_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (!socket_addr(&addr, path)) {
+        return -1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Server
+typedef struct {
+    char *path;  // Resolved path of the input
+    char *label; // Path as the client wrote it, which is how diagnostics name the file
+
+    bool        loaded;
+    struct stat st;
+
+    char        *source;
+    uint32_t     base;
+    Ast          ast;
+    Context      context;
+    Diagnostics *error; // Of the front end, NULL if it succeeded
+
+    pthread_mutex_t lock;
+} Unit;
+
+static struct {
+    Unit **data;
+    size_t count;
+    size_t capacity;
+} units;
+
+static pthread_mutex_t units_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Unit *unit_get(const char *path) {
+    pthread_mutex_lock(&units_lock);
+
+    Unit *u = NULL;
+    for (size_t i = 0; i < units.count && !u; i++) {
+        if (!strcmp(units.data[i]->path, path)) {
+            u = units.data[i];
+        }
+    }
+
+    if (!u) {
+        u = calloc(1, sizeof(*u));
+        assert(u);
+        u->path = strdup(path);
+        pthread_mutex_init(&u->lock, NULL);
+        da_push(&units, u);
+    }
+
+    pthread_mutex_unlock(&units_lock);
+    return u;
+}
+
+static void unit_unload(Unit *u) {
+    if (!u->loaded) {
+        return;
+    }
+
+    context_free(&u->context);
+    ast_free(&u->ast);
+    source_remove(u->base);
+
+    free(u->source);
+    free(u->label);
+    diagnostics_free(u->error);
+
+    u->loaded = false;
+    u->source = NULL;
+    u->label = NULL;
+    u->error = NULL;
+    u->ast = (Ast) {0};
+    u->context = (Context) {0};
+}
+
+static bool stat_same(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           stat_mtime(a).tv_sec == stat_mtime(b).tv_sec && stat_mtime(a).tv_nsec == stat_mtime(b).tv_nsec;
+}
+
+// The source is copied rather than mapped, since an editor truncating the file would otherwise pull pages from under
+// a tree that stays cached. Returns an error only when the file could not be read.
+static char *unit_load(Unit *u, const char *label) {
+    struct stat st;
+    if (stat(u->path, &st) < 0) {
+        unit_unload(u);
+        return strdup(temp_sprintf("ERROR: Could not read file '%s'\n", label));
+    }
+
+    if (u->loaded && stat_same(&st, &u->st) && !strcmp(u->label, label)) {
+        return NULL;
+    }
+    unit_unload(u);
+
+    File file = {0};
+    if (!read_file(&file, u->path)) {
+        return strdup(temp_sprintf("ERROR: Could not read file '%s'\n", label));
+    }
+
+    const size_t count = file.sv.count;
+    u->source = malloc(count + 1);
+    assert(u->source);
+    memcpy(u->source, file.sv.data, count);
+    free_file(&file);
+
+    u->loaded = true;
+    u->st = st;
+    u->label = strdup(label);
+
+    Lexer l = {0};
+    lexer_init(&l, label, (SV) {u->source, count});
+    u->base = l.base;
+
+    Parser p = {.ast = &u->ast};
+    u->context.ast = &u->ast;
+    if (!parse_file(&p, l)) {
+        u->error = p.error;
+    } else if (!check_nodes(&u->context, p.nodes)) {
+        u->error = u->context.error;
+        u->context.error = NULL;
+    }
+    parser_free(&p);
+    return NULL;
+}
+
+static char *serve_build(const char *cwd, const char *input, const char *output) {
+    const char *path = *input == '/' ? input : temp_sprintf("%s/%s", cwd, input);
+    if (*output != '/') {
+        output = temp_sprintf("%s/%s", cwd, output);
+    }
+
+    char  resolved[PATH_MAX];
+    Unit *u = unit_get(realpath(path, resolved) ? resolved : path);
+    pthread_mutex_lock(&u->lock);
+
+    char *error = unit_load(u, input);
+    if (!error && u->error) {
+        error = diagnostics_format(u->error);
+    } else if (!error && !compile_nodes(&u->context, output)) {
+        error = diagnostics_format(u->context.error);
+        diagnostics_free(u->context.error);
+        u->context.error = NULL;
+    }
+
+    pthread_mutex_unlock(&u->lock);
+    return error;
+}
+
+static void *serve_client(void *arg) {
+    const int fd = (int) (intptr_t) arg;
+
+    char *cwd = recv_str(fd, PATH_MAX);
+    char *input = cwd ? recv_str(fd, PATH_MAX) : NULL;
+    char *output = input ? recv_str(fd, PATH_MAX) : NULL;
+    if (output) {
+        const ArenaMark temp = temp_save();
+        char           *error = serve_build(cwd, input, output);
+        send_str(fd, error ? error : "");
+        free(error);
+        temp_restore(temp);
+    }
+
+    free(cwd);
+    free(input);
+    free(output);
+    close(fd);
+    temp_free();
+    return NULL;
+}
+
+bool server_serve(const char *path) {
+    struct sockaddr_un addr;
+    if (!socket_addr(&addr, path)) {
+        fprintf(stderr, "ERROR: Socket path '%s' is too long\n", path);
+        return false;
+    }
+
+    // A socket nobody answers on was left behind by a server that was killed
+    const int probe = socket_connect(path);
+    if (probe >= 0) {
+        close(probe);
+        fprintf(stderr, "ERROR: A server is already listening on '%s'\n", path);
+        return false;
+    }
+    unlink(path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Could not create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Only the user may connect, since clients choose which files get read and written
+    const mode_t mask = umask(0077);
+    const int    bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+
+    if (bound < 0 || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "ERROR: Could not listen on '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // A client going away mid response must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Listening on '%s'\n", path);
+    fflush(stdout);
+
+    while (true) {
+        const int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_client, (void *) (intptr_t) client)) {
+            serve_client((void *) (intptr_t) client);
+        } else {
+            pthread_detach(thread);
+        }
+    }
+}
+
+// Client
+char *server_build(const char *path, const char *input, const char *output) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return strdup("ERROR: Could not get the working directory\n");
+    }
+
+    const int fd = socket_connect(path);
+    if (fd < 0) {
+        return strdup(temp_sprintf("ERROR: Could not connect to the compile server at '%s'\n", path));
+    }
+
+    char *error = NULL;
+    if (send_str(fd, cwd) && send_str(fd, input) && send_str(fd, output)) {
+        error = recv_str(fd, UINT32_MAX);
+    }
+    close(fd);
+
+    if (!error) {
+        return strdup(temp_sprintf("ERROR: Lost connection to the compile server at '%s'\n", path));
+    }
+
+    if (!*error) {
+        free(error);
+        return NULL;
+    }
+    return error;
+}
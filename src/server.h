@@ -0,0 +1,17 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "basic.h"
+
+// $GLOS_SOCKET if set, otherwise a socket private to the user
+const char *server_socket(void);
+
+// Builds programs for clients until killed, keeping the checked tree of every input around so an unchanged file is
+// only compiled again. Returns only if the socket could not be set up.
+bool server_serve(const char *socket);
+
+// Has the server build 'input' into 'output', both relative to the working directory of the client. Returns the
+// diagnostics of a failed build, NULL if it succeeded.
+char *server_build(const char *socket, const char *input, const char *output);
+
+#endif // SERVER_H
@@ -0,0 +1,158 @@
+#include <pthread.h>
+
+#include "source.h"
+
+typedef struct {
+    uint32_t *data;
+    size_t    count;
+    size_t    capacity;
+} Lines;
+
+typedef struct {
+    const char *path;
+    SV          sv;
+    uint32_t    base;
+    Lines       lines;
+} Source;
+
+static struct {
+    Source *data;
+    size_t  count;
+    size_t  capacity;
+} sources;
+
+// Line tables are built on first use, possibly by several checker threads reporting at once
+static pthread_mutex_t sources_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Sources are kept sorted by base. A new one goes into the first gap large enough, so the ranges of removed sources
+// are used again and a long running process never runs out of offsets.
+uint32_t source_add(const char *path, SV sv) {
+    pthread_mutex_lock(&sources_lock);
+
+    // The extra byte keeps the end of file offset of one source apart from the start of the next
+    size_t   index = 0;
+    uint32_t base = 0;
+    for (; index < sources.count; index++) {
+        const Source *it = &sources.data[index];
+        if (it->base - base > sv.count) {
+            break;
+        }
+        base = it->base + it->sv.count + 1;
+    }
+    assert(sv.count < UINT32_MAX - base);
+
+    const Source source = {
+        .path = strdup(path),
+        .sv = sv,
+        .base = base,
+    };
+
+    da_grow(&sources, 1);
+    memmove(&sources.data[index + 1], &sources.data[index], (sources.count - index) * sizeof(*sources.data));
+    sources.data[index] = source;
+    sources.count++;
+
+    pthread_mutex_unlock(&sources_lock);
+    return base;
+}
+
+void source_remove(uint32_t base) {
+    pthread_mutex_lock(&sources_lock);
+
+    size_t index = 0;
+    while (index < sources.count && sources.data[index].base != base) {
+        index++;
+    }
+    assert(index < sources.count);
+
+    Source *s = &sources.data[index];
+    free((char *) s->path);
+    da_free(&s->lines);
+
+    sources.count--;
+    memmove(&sources.data[index], &sources.data[index + 1], (sources.count - index) * sizeof(*sources.data));
+    pthread_mutex_unlock(&sources_lock);
+}
+
+static void source_index_lines(Source *s) {
+    da_push(&s->lines, 0);
+
+    const char *data = s->sv.data;
+    const char *end = data + s->sv.count;
+    while ((data = memchr(data, '\n', end - data))) {
+        // A newline which ends the file does not start a new line
+        if (++data == end) {
+            break;
+        }
+        da_push(&s->lines, data - s->sv.data);
+    }
+}
+
+// Called with the lock held. The line table is built on first use.
+static Source *source_find(uint32_t offset) {
+    assert(sources.count);
+
+    size_t lo = 0;
+    size_t hi = sources.count;
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (sources.data[mid].base <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    Source *s = &sources.data[lo];
+    if (!s->lines.count) {
+        source_index_lines(s);
+    }
+
+    assert(offset - s->base <= s->sv.count);
+    return s;
+}
+
+static size_t lines_row(const uint32_t *starts, size_t count, uint32_t offset) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (starts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+Pos source_pos(uint32_t offset) {
+    pthread_mutex_lock(&sources_lock);
+
+    const Source *s = source_find(offset);
+    offset -= s->base;
+
+    // The end of a file with a trailing newline is reported on that newline, not on a line of its own
+    if (offset == s->sv.count && offset && s->sv.data[offset - 1] == '\n') {
+        offset--;
+    }
+
+    const size_t row = lines_row(s->lines.data, s->lines.count, offset);
+    const Pos    pos = {.path = s->path, .row = row, .col = offset - s->lines.data[row]};
+    pthread_mutex_unlock(&sources_lock);
+    return pos;
+}
+
+SourceLines source_lines(uint32_t offset) {
+    pthread_mutex_lock(&sources_lock);
+
+    const Source     *s = source_find(offset);
+    const SourceLines ls = {.path = s->path, .base = s->base, .starts = s->lines.data, .count = s->lines.count};
+    pthread_mutex_unlock(&sources_lock);
+    return ls;
+}
+
+size_t source_lines_row(const SourceLines *ls, uint32_t offset) {
+    assert(offset >= ls->base);
+    return lines_row(ls->starts, ls->count, offset - ls->base);
+}
@@ -0,0 +1,35 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include "basic.h"
+
+typedef struct {
+    const char *path;
+    size_t      row;
+    size_t      col;
+} Pos;
+
+#define PosFmt    "%s:%zu:%zu: "
+#define PosArg(p) ((p).path), ((p).row + 1), ((p).col + 1)
+
+// Every registered source occupies its own range of one offset space, so a single 32-bit offset identifies both the
+// file and the byte inside it. Rows and columns are only computed when a position is actually printed.
+uint32_t source_add(const char *path, SV sv);
+Pos      source_pos(uint32_t offset);
+
+// Line table of the source holding an offset, for callers which look up many rows in a row. It stays valid until the
+// source is removed, and reading it takes no lock.
+typedef struct {
+    const char     *path;
+    uint32_t        base;
+    const uint32_t *starts; // Offset of each line, relative to the base
+    size_t          count;
+} SourceLines;
+
+SourceLines source_lines(uint32_t offset);
+size_t      source_lines_row(const SourceLines *ls, uint32_t offset);
+
+// Frees the range of a source once nothing will ask for positions inside it again
+void source_remove(uint32_t base);
+
+#endif // SOURCE_H
@@ -0,0 +1,136 @@
+#include <pthread.h>
+
+#include "symbol.h"
+
+typedef struct {
+    SV       sv;
+    uint32_t hash;
+} SymbolEntry;
+
+static struct {
+    SymbolEntry *data;
+    size_t       count;
+    size_t       capacity;
+} symbols;
+
+// Open addressing over symbol IDs, zero marks an empty slot
+static struct {
+    Symbol *data;
+    size_t  capacity;
+} table;
+
+static Arena arena;
+
+// Chunks of one file are lexed on several threads. Names seen before, by far the common case, only take the lock
+// shared.
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static_assert(COUNT_BUILTIN_SYMBOLS == 4, "");
+static const char *builtins[COUNT_BUILTIN_SYMBOLS] = {
+    [SYMBOL_NONE] = "",
+    [SYMBOL_BOOL] = "bool",
+    [SYMBOL_I64] = "i64",
+    [SYMBOL_MAIN] = "main",
+};
+
+static void table_insert(Symbol s) {
+    const size_t mask = table.capacity - 1;
+    for (size_t i = symbols.data[s].hash & mask;; i = (i + 1) & mask) {
+        if (!table.data[i]) {
+            table.data[i] = s;
+            return;
+        }
+    }
+}
+
+static void table_grow(void) {
+    free(table.data);
+    table.capacity = table.capacity ? table.capacity * 2 : DA_INIT_CAP;
+    table.data = calloc(table.capacity, sizeof(*table.data));
+    assert(table.data);
+
+    for (Symbol s = 1; s < symbols.count; s++) {
+        table_insert(s);
+    }
+}
+
+static Symbol symbol_push(SV sv, uint32_t hash) {
+    char *data = arena_alloc(&arena, sv.count);
+    memcpy(data, sv.data, sv.count);
+
+    const Symbol s = symbols.count;
+    da_push(&symbols, ((SymbolEntry) {.sv = {.data = data, .count = sv.count}, .hash = hash}));
+
+    // Keep the load factor at or below one half
+    if (symbols.count * 2 > table.capacity) {
+        table_grow();
+    } else {
+        table_insert(s);
+    }
+
+    return s;
+}
+
+static void symbol_init(void) {
+    for (size_t i = 0; i < COUNT_BUILTIN_SYMBOLS; i++) {
+        const SV sv = sv_from_cstr(builtins[i]);
+        symbol_push(sv, hash_bytes(sv.data, sv.count));
+    }
+}
+
+static Symbol symbol_find(SV sv, uint32_t hash) {
+    if (!table.capacity) {
+        return 0;
+    }
+
+    const size_t mask = table.capacity - 1;
+    for (size_t i = hash & mask; table.data[i]; i = (i + 1) & mask) {
+        const SymbolEntry *it = &symbols.data[table.data[i]];
+        if (it->hash == hash && it->sv.count == sv.count && !memcmp(it->sv.data, sv.data, sv.count)) {
+            return table.data[i];
+        }
+    }
+    return 0;
+}
+
+Symbol symbol_intern(SV sv) {
+    const uint32_t hash = hash_bytes(sv.data, sv.count);
+
+    pthread_rwlock_rdlock(&lock);
+    Symbol s = symbol_find(sv, hash);
+    pthread_rwlock_unlock(&lock);
+    if (s) {
+        return s;
+    }
+
+    // Another thread may have added the name in between
+    pthread_rwlock_wrlock(&lock);
+    if (!symbols.count) {
+        symbol_init();
+    }
+
+    s = symbol_find(sv, hash);
+    if (!s) {
+        s = symbol_push(sv, hash);
+    }
+    pthread_rwlock_unlock(&lock);
+    return s;
+}
+
+size_t symbol_count(void) {
+    pthread_rwlock_wrlock(&lock);
+    if (!symbols.count) {
+        symbol_init();
+    }
+    const size_t count = symbols.count;
+    pthread_rwlock_unlock(&lock);
+    return count;
+}
+
+SV symbol_sv(Symbol s) {
+    pthread_rwlock_rdlock(&lock);
+    assert(s < symbols.count);
+    const SV sv = symbols.data[s].sv;
+    pthread_rwlock_unlock(&lock);
+    return sv;
+}
@@ -0,0 +1,23 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include "basic.h"
+
+// Interned identifier, equal names always map to the same dense ID
+typedef uint32_t Symbol;
+
+typedef enum {
+    SYMBOL_NONE,
+    SYMBOL_BOOL,
+    SYMBOL_I64,
+    SYMBOL_MAIN,
+    COUNT_BUILTIN_SYMBOLS
+} BuiltinSymbol;
+
+Symbol symbol_intern(SV sv);
+SV     symbol_sv(Symbol s);
+
+// Every ID below this has been handed out, in order
+size_t symbol_count(void);
+
+#endif // SYMBOL_H
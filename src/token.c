@@ -1,6 +1,6 @@
 #include "token.h"
 
-static_assert(COUNT_TOKENS == 21, "");
+static_assert(COUNT_TOKENS == 22, "");
 const char *token_kind_to_cstr(TokenKind kind) {
     switch (kind) {
     case TOKEN_EOF:
@@ -63,6 +63,9 @@ const char *token_kind_to_cstr(TokenKind kind) {
     case TOKEN_VAR:
         return "'var'";
 
+    case TOKEN_IMPORT:
+        return "'import'";
+
     case TOKEN_PRINT:
         return "'print'";
 
@@ -70,3 +73,57 @@ const char *token_kind_to_cstr(TokenKind kind) {
         unreachable();
     }
 }
+
+void tokens_push(Tokens *t, Token token) {
+    if (t->count >= t->capacity) {
+        t->capacity = t->capacity == 0 ? DA_INIT_CAP : t->capacity * 2;
+        t->kinds = realloc(t->kinds, t->capacity * sizeof(*t->kinds));
+        t->offsets = realloc(t->offsets, t->capacity * sizeof(*t->offsets));
+        t->lengths = realloc(t->lengths, t->capacity * sizeof(*t->lengths));
+        t->flags = realloc(t->flags, t->capacity * sizeof(*t->flags));
+        t->values = realloc(t->values, t->capacity * sizeof(*t->values));
+        assert(t->kinds && t->offsets && t->lengths && t->flags && t->values);
+    }
+
+    t->kinds[t->count] = token.kind;
+    t->offsets[t->count] = token.offset;
+    t->lengths[t->count] = token.sv.count;
+    t->flags[t->count] = token.newline ? TOKEN_FLAG_NEWLINE : 0;
+    t->values[t->count] = token.as;
+    t->count++;
+}
+
+Token tokens_get(const Tokens *t, size_t index) {
+    assert(index < t->count);
+
+    const uint32_t offset = t->offsets[index];
+    return (Token) {
+        .kind = t->kinds[index],
+        .sv = {.data = t->start + (offset - t->base), .count = t->lengths[index]},
+        .offset = offset,
+        .newline = t->flags[index] & TOKEN_FLAG_NEWLINE,
+        .as = t->values[index],
+    };
+}
+
+// Forgets the first 'count' tokens, moving the rest to the front
+void tokens_drop(Tokens *t, size_t count) {
+    assert(count <= t->count);
+    const size_t rest = t->count - count;
+
+    memmove(t->kinds, t->kinds + count, rest * sizeof(*t->kinds));
+    memmove(t->offsets, t->offsets + count, rest * sizeof(*t->offsets));
+    memmove(t->lengths, t->lengths + count, rest * sizeof(*t->lengths));
+    memmove(t->flags, t->flags + count, rest * sizeof(*t->flags));
+    memmove(t->values, t->values + count, rest * sizeof(*t->values));
+    t->count = rest;
+}
+
+void tokens_free(Tokens *t) {
+    free(t->kinds);
+    free(t->offsets);
+    free(t->lengths);
+    free(t->flags);
+    free(t->values);
+    memset(t, 0, sizeof(*t));
+}
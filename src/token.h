@@ -1,16 +1,8 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
-#include "basic.h"
-
-typedef struct {
-    const char *path;
-    size_t      row;
-    size_t      col;
-} Pos;
-
-#define PosFmt    "%s:%zu:%zu: "
-#define PosArg(p) ((p).path), ((p).row + 1), ((p).col + 1)
+#include "source.h"
+#include "symbol.h"
 
 typedef enum {
     TOKEN_EOF,
@@ -40,6 +32,7 @@ typedef enum {
 
     TOKEN_FN,
     TOKEN_VAR,
+    TOKEN_IMPORT,
 
     TOKEN_PRINT,
     COUNT_TOKENS
@@ -47,17 +40,46 @@ typedef enum {
 
 const char *token_kind_to_cstr(TokenKind kind);
 
+typedef union {
+    bool   boolean;
+    size_t integer;
+    Symbol symbol;
+} TokenValue;
+
 typedef struct {
     TokenKind kind;
 
-    SV   sv;
-    Pos  pos;
-    bool newline;
+    SV       sv;
+    uint32_t offset;
+    bool     newline;
 
-    union {
-        bool   boolean;
-        size_t integer;
-    } as;
+    TokenValue as;
 } Token;
 
+typedef enum {
+    TOKEN_FLAG_NEWLINE = 1 << 0,
+} TokenFlag;
+
+// Token stream of a single source, stored as parallel arrays
+typedef struct {
+    const char *start;
+    uint32_t    base;
+    const char *error;
+    uint32_t    error_offset;
+
+    uint8_t    *kinds;
+    uint32_t   *offsets;
+    uint32_t   *lengths;
+    uint8_t    *flags;
+    TokenValue *values;
+
+    size_t count;
+    size_t capacity;
+} Tokens;
+
+void  tokens_push(Tokens *t, Token token);
+Token tokens_get(const Tokens *t, size_t index);
+void  tokens_drop(Tokens *t, size_t count);
+void  tokens_free(Tokens *t);
+
 #endif // TOKEN_H
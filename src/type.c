@@ -0,0 +1,202 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "type.h"
+
+typedef struct {
+    TypeKind kind;
+    uint32_t hash;
+
+    const Type *args; // Allocated in 'arena'
+    uint32_t    arity;
+    Type        ret;
+
+    const char *cstr; // Rendered on first use
+} TypeEntry;
+
+// Entries never move once written, so they can be read without the lock. Bucket 'b' holds the TYPES_FIRST << b
+// entries after the ones of every bucket before it, which makes the first bucket small enough to be static.
+#define TYPES_FIRST   64
+#define TYPES_BUCKETS 32
+
+static_assert(COUNT_BUILTIN_TYPES == 3, "");
+static TypeEntry types_first[TYPES_FIRST] = {
+    [TYPE_ID_UNIT] = {.kind = TYPE_UNIT, .cstr = "()"},
+    [TYPE_ID_BOOL] = {.kind = TYPE_BOOL, .cstr = "bool"},
+    [TYPE_ID_I64] = {.kind = TYPE_I64, .cstr = "i64"},
+};
+
+static TypeEntry *types[TYPES_BUCKETS] = {types_first};
+
+// Published with release once an entry is complete, so a reader which sees the count sees the entries below it
+static atomic_size_t types_count = COUNT_BUILTIN_TYPES;
+
+// Open addressing over function type IDs, zero marks an empty slot
+static struct {
+    Type  *data;
+    size_t capacity;
+} table;
+
+static Arena arena;
+
+// Function bodies are checked in parallel, and any of them can intern a new signature. Only adding and rendering
+// types takes the lock.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t types_bucket(size_t index) {
+    const unsigned long long group = index / TYPES_FIRST + 1;
+    return sizeof(group) * 8 - 1 - __builtin_clzll(group);
+}
+
+static TypeEntry *types_at(size_t index) {
+    const size_t bucket = types_bucket(index);
+    return &types[bucket][index - TYPES_FIRST * ((1ull << bucket) - 1)];
+}
+
+static void table_insert(Type t) {
+    const size_t mask = table.capacity - 1;
+    for (size_t i = types_at(t)->hash & mask;; i = (i + 1) & mask) {
+        if (!table.data[i]) {
+            table.data[i] = t;
+            return;
+        }
+    }
+}
+
+static void table_grow(size_t count) {
+    free(table.data);
+    table.capacity = table.capacity ? table.capacity * 2 : DA_INIT_CAP;
+    table.data = calloc(table.capacity, sizeof(*table.data));
+    assert(table.data);
+
+    for (Type t = COUNT_BUILTIN_TYPES; t < count; t++) {
+        table_insert(t);
+    }
+}
+
+static const TypeEntry *type_entry(Type type) {
+    assert(type < atomic_load_explicit(&types_count, memory_order_acquire));
+    return types_at(type);
+}
+
+Type type_fn(const Type *fn_args, size_t arity, Type ret) {
+    pthread_mutex_lock(&lock);
+
+    const size_t   count = atomic_load_explicit(&types_count, memory_order_relaxed);
+    const uint32_t hash = hash_bytes(fn_args, arity * sizeof(*fn_args)) ^ (ret * 0x9e3779b9);
+    if (table.capacity) {
+        const size_t mask = table.capacity - 1;
+        for (size_t i = hash & mask; table.data[i]; i = (i + 1) & mask) {
+            const TypeEntry *it = types_at(table.data[i]);
+            if (it->hash == hash && it->arity == arity && it->ret == ret &&
+                (!arity || !memcmp(it->args, fn_args, arity * sizeof(*fn_args)))) {
+                const Type t = table.data[i];
+                pthread_mutex_unlock(&lock);
+                return t;
+            }
+        }
+    }
+
+    Type *entry_args = NULL;
+    if (arity) {
+        entry_args = memcpy(arena_alloc(&arena, arity * sizeof(*fn_args)), fn_args, arity * sizeof(*fn_args));
+    }
+
+    assert(count < UINT32_MAX);
+    const Type t = count;
+
+    // Whoever adds the first entry of a bucket allocates it
+    const size_t bucket = types_bucket(t);
+    if (t == TYPES_FIRST * ((1ull << bucket) - 1)) {
+        assert(bucket < TYPES_BUCKETS);
+        types[bucket] = malloc((TYPES_FIRST << bucket) * sizeof(**types));
+        assert(types[bucket]);
+    }
+
+    *types_at(t) = (TypeEntry) {
+        .kind = TYPE_FN,
+        .hash = hash,
+        .args = entry_args,
+        .arity = arity,
+        .ret = ret,
+    };
+    atomic_store_explicit(&types_count, count + 1, memory_order_release);
+
+    // Keep the load factor at or below one half
+    if ((count + 1 - COUNT_BUILTIN_TYPES) * 2 > table.capacity) {
+        table_grow(count + 1);
+    } else {
+        table_insert(t);
+    }
+
+    pthread_mutex_unlock(&lock);
+    return t;
+}
+
+size_t type_count(void) {
+    return atomic_load_explicit(&types_count, memory_order_acquire);
+}
+
+TypeKind type_kind(Type type) {
+    // Scalar IDs are their kinds, which keeps the most common query off the table
+    if (type < COUNT_BUILTIN_TYPES) {
+        return (TypeKind) type;
+    }
+    return type_entry(type)->kind;
+}
+
+size_t type_arity(Type type) {
+    const TypeEntry *it = type_entry(type);
+    assert(it->kind == TYPE_FN);
+    return it->arity;
+}
+
+Type type_arg(Type type, size_t index) {
+    const TypeEntry *it = type_entry(type);
+    assert(it->kind == TYPE_FN && index < it->arity);
+    return it->args[index];
+}
+
+Type type_ret(Type type) {
+    const TypeEntry *it = type_entry(type);
+    assert(it->kind == TYPE_FN);
+    return it->ret;
+}
+
+static const char *type_to_cstr_locked(Type type) {
+    const TypeEntry *it = type_entry(type);
+    if (it->cstr) {
+        return it->cstr;
+    }
+
+    assert(it->kind == TYPE_FN);
+    const ArenaMark temp = temp_save();
+
+    const char *s = "fn (";
+    for (size_t i = 0; i < it->arity; i++) {
+        s = temp_sprintf("%s%s%s", s, i ? ", " : "", type_to_cstr_locked(type_arg(type, i)));
+    }
+    s = temp_sprintf("%s)", s);
+
+    if (it->ret != TYPE_ID_UNIT) {
+        s = temp_sprintf("%s %s", s, type_to_cstr_locked(it->ret));
+    }
+
+    const size_t count = strlen(s) + 1;
+    char        *cstr = memcpy(arena_alloc(&arena, count), s, count);
+    temp_restore(temp);
+
+    types_at(type)->cstr = cstr;
+    return cstr;
+}
+
+const char *type_to_cstr(Type type) {
+    pthread_mutex_lock(&lock);
+    const char *cstr = type_to_cstr_locked(type);
+    pthread_mutex_unlock(&lock);
+    return cstr;
+}
+
+bool type_is_integer(Type type) {
+    return type == TYPE_ID_I64;
+}
@@ -0,0 +1,40 @@
+#ifndef TYPE_H
+#define TYPE_H
+
+#include "basic.h"
+
+typedef enum {
+    TYPE_UNIT,
+    TYPE_BOOL,
+    TYPE_I64,
+
+    TYPE_FN,
+
+    COUNT_TYPES
+} TypeKind;
+
+// Interned type, structurally equal types always map to the same dense ID
+typedef uint32_t Type;
+
+// Scalar types are seeded first, so their IDs match their kinds
+typedef enum {
+    TYPE_ID_UNIT = TYPE_UNIT,
+    TYPE_ID_BOOL = TYPE_BOOL,
+    TYPE_ID_I64 = TYPE_I64,
+    COUNT_BUILTIN_TYPES
+} BuiltinType;
+
+Type type_fn(const Type *args, size_t arity, Type ret);
+
+// Every ID below this has been handed out, in order
+size_t type_count(void);
+
+TypeKind type_kind(Type type);
+size_t   type_arity(Type type);
+Type     type_arg(Type type, size_t index);
+Type     type_ret(Type type);
+
+const char *type_to_cstr(Type type);
+bool        type_is_integer(Type type);
+
+#endif // TYPE_H
@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "document.h"
+#include "watch.h"
+
+#ifdef __linux__
+#    include <sys/inotify.h>
+#endif
+
+// Editors save with a burst of events, so a build waits until none arrived for this long
+#define WATCH_SETTLE_MS 30
+
+typedef struct {
+    uint64_t *data;
+    size_t    count;
+    size_t    capacity;
+} Keys;
+
+typedef struct {
+    const char *input;
+    const char *output;
+
+    Document document;
+
+    // compile_piece_hash() of each declaration
+    Keys hashes;
+
+    // The program is built in pieces, the entry piece first and then every function, each assembled into an object
+    // named after its key in a directory of its own. Only pieces whose key is not there yet go through the backend.
+    char dir[32];
+    Keys keys;
+    Keys objects; // Keys of the objects in the directory, sorted
+
+    // Of the pieces in 'keys', zero for the entry piece
+    struct {
+        NodeId *data;
+        size_t  count;
+        size_t  capacity;
+    } nodes;
+
+    // Saves that leave the program as it was, like most edits to comments, skip the linker as well
+    bool            built;
+    uint64_t        hash;
+    struct timespec output_mtime;
+} Watch;
+
+// The entry piece defines the global variables. It also checks 'main', so it is lowered again whenever 'main' changes.
+static void watch_keys(Watch *w) {
+    const Document *d = &w->document;
+    for (size_t i = w->hashes.count; i < d->decls.count; i++) {
+        da_push(&w->hashes, compile_piece_hash(&d->ast, d->decls.data[i].node));
+    }
+
+    // The key of the entry piece is known once every variable was seen
+    w->keys.count = 0;
+    w->nodes.count = 0;
+    da_push(&w->keys, 0);
+    da_push(&w->nodes, 0);
+
+    Keys entry = {0};
+    for (size_t i = 0; i < d->decls.count; i++) {
+        const NodeId id = d->decls.data[i].node;
+        if (ast_node(&d->ast, id)->kind == NODE_VAR) {
+            da_push(&entry, w->hashes.data[i]);
+        } else {
+            da_push(&w->keys, w->hashes.data[i]);
+            da_push(&w->nodes, id);
+        }
+    }
+
+    const NodeId main = scope_find(&d->context.globals, SYMBOL_MAIN);
+    da_push(&entry, main ? compile_piece_hash(&d->ast, main) : 0);
+    w->keys.data[0] = hash_bytes(entry.data, entry.count * sizeof(*entry.data));
+    da_free(&entry);
+}
+
+static const char *object_path(const Watch *w, uint64_t key) {
+    return temp_sprintf("%s/%016" PRIx64 ".o", w->dir, key);
+}
+
+static int key_compare(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static bool keys_have(const Keys *ks, uint64_t key) {
+    return bsearch(&key, ks->data, ks->count, sizeof(*ks->data), key_compare);
+}
+
+// Objects of pieces the program no longer has are removed, the rest are linked in the order of the pieces
+static bool watch_link(Watch *w, size_t *lowered) {
+    Context        *context = &w->document.context;
+    const ArenaMark temp = temp_save();
+
+    Keys objects = {0};
+    bool ok = true;
+
+    Compiler c;
+    compile_split_begin(&c, context);
+    for (size_t i = 0; i < w->keys.count; i++) {
+        const uint64_t key = w->keys.data[i];
+        if (!keys_have(&w->objects, key)) {
+            const char *path = object_path(w, key);
+            if (!compile_piece(&c, w->nodes.data[i], path)) {
+                unlink(path);
+                ok = false;
+                continue;
+            }
+            (*lowered)++;
+        }
+        da_push(&objects, key);
+    }
+    compile_split_end(&c);
+
+    qsort(objects.data, objects.count, sizeof(*objects.data), key_compare);
+    for (size_t i = 0; i < w->objects.count; i++) {
+        if (!keys_have(&objects, w->objects.data[i])) {
+            unlink(object_path(w, w->objects.data[i]));
+        }
+    }
+    da_free(&w->objects);
+    w->objects = objects;
+
+    if (ok) {
+        const char **paths = temp_alloc(w->keys.count * sizeof(*paths));
+        for (size_t i = 0; i < w->keys.count; i++) {
+            paths[i] = object_path(w, w->keys.data[i]);
+        }
+        ok = compile_link(context, paths, w->keys.count, w->output);
+    }
+
+    temp_restore(temp);
+    return ok;
+}
+
+// The output has to be the one built last as well, since something else may have replaced it since
+static bool watch_up_to_date(Watch *w) {
+    const uint64_t hash = hash_bytes(w->keys.data, w->keys.count * sizeof(*w->keys.data));
+    const bool     same = w->built && hash == w->hash;
+    w->hash = hash;
+
+    struct stat st;
+    return same && !stat(w->output, &st) && stat_mtime(&st).tv_sec == w->output_mtime.tv_sec &&
+           stat_mtime(&st).tv_nsec == w->output_mtime.tv_nsec;
+}
+
+static double elapsed_ms(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static void watch_build(Watch *w) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    File file = {0};
+    if (!read_file(&file, w->input)) {
+        fprintf(stderr, "ERROR: Could not read file '%s'\n", w->input);
+        return;
+    }
+
+    Document  *d = &w->document;
+    const bool ok = document_update(d, file.sv);
+    free_file(&file);
+
+    // Declarations the update left in place keep their hashes
+    if (w->hashes.count > d->kept) {
+        w->hashes.count = d->kept;
+    }
+
+    if (ok) {
+        watch_keys(w);
+    }
+
+    const size_t reused = d->decls.count - d->parsed;
+    size_t       lowered = 0;
+    if (ok && watch_up_to_date(w)) {
+        printf("Up to date '%s' in %.1fms, reused %zu of %zu declarations\n", w->output, elapsed_ms(start), reused,
+               d->decls.count);
+    } else if (ok && watch_link(w, &lowered)) {
+        struct stat st;
+        w->built = !stat(w->output, &st);
+        if (w->built) {
+            w->output_mtime = stat_mtime(&st);
+        }
+        printf("Built '%s' in %.1fms, reused %zu of %zu declarations, lowered %zu of %zu pieces\n", w->output,
+               elapsed_ms(start), reused, d->decls.count, lowered, w->keys.count);
+    } else {
+        w->built = false;
+
+        char *error = diagnostics_format(ok ? d->context.error : d->error);
+        fputs(error, stderr);
+        free(error);
+
+        diagnostics_free(d->context.error);
+        d->context.error = NULL;
+    }
+    fflush(stdout);
+}
+
+// SIGINT and SIGTERM stop waiting for the next save, so the pieces are removed before the signal is raised again
+static volatile sig_atomic_t watch_signal;
+
+static void watch_stop(int signal) {
+    watch_signal = signal;
+}
+
+static bool watch_init(Watch *w, const char *input, const char *output) {
+    memset(w, 0, sizeof(*w));
+    w->input = input;
+    w->output = output;
+
+    strcpy(w->dir, "/tmp/glos_watch_XXXXXX");
+    if (!mkdtemp(w->dir)) {
+        fprintf(stderr, "ERROR: Could not create a directory for the pieces of '%s': %s\n", input, strerror(errno));
+        return false;
+    }
+
+    // Without SA_RESTART, so the signal interrupts the wait
+    const struct sigaction sa = {.sa_handler = watch_stop};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    document_init(&w->document, input);
+    return true;
+}
+
+static bool watch_free(Watch *w, bool ok) {
+    for (size_t i = 0; i < w->objects.count; i++) {
+        unlink(object_path(w, w->objects.data[i]));
+    }
+    rmdir(w->dir);
+
+    document_free(&w->document);
+    da_free(&w->hashes);
+    da_free(&w->keys);
+    da_free(&w->objects);
+    da_free(&w->nodes);
+
+    if (watch_signal) {
+        signal(watch_signal, SIG_DFL);
+        raise(watch_signal);
+    }
+    return ok;
+}
+
+#ifdef __linux__
+static bool events_match(const char *buffer, size_t count, const char *name) {
+    bool match = false;
+    for (size_t i = 0; i < count;) {
+        const struct inotify_event *e = (const struct inotify_event *) (buffer + i);
+        if (e->len && !strcmp(e->name, name)) {
+            match = true;
+        }
+        i += sizeof(*e) + e->len;
+    }
+    return match;
+}
+
+// The directory is watched rather than the file, since editors often save by renaming a new file over the old one
+bool watch_file(const char *input, const char *output) {
+    const char *slash = strrchr(input, '/');
+    const char *dir = slash ? temp_sv_to_cstr((SV) {input, slash - input + 1}) : ".";
+    const char *name = slash ? slash + 1 : input;
+
+    const int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "ERROR: Could not watch '%s': %s\n", input, strerror(errno));
+        return false;
+    }
+
+    Watch w;
+    if (!watch_init(&w, input, output)) {
+        return false;
+    }
+    watch_build(&w);
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!watch_signal) {
+        const ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            fprintf(stderr, "ERROR: Could not watch '%s': %s\n", input, strerror(errno));
+            return watch_free(&w, false);
+        }
+
+        bool changed = events_match(buffer, n, name);
+
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0) {
+            const ssize_t more = read(fd, buffer, sizeof(buffer));
+            if (more > 0) {
+                changed |= events_match(buffer, more, name);
+            }
+        }
+
+        if (changed && !watch_signal) {
+            watch_build(&w);
+        }
+    }
+    return watch_free(&w, true);
+}
+#else
+// Elsewhere the file is polled, and a save shows up as a new inode, size or modification time
+#    define WATCH_POLL_MS 100
+
+static bool stat_same(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           stat_mtime(a).tv_sec == stat_mtime(b).tv_sec && stat_mtime(a).tv_nsec == stat_mtime(b).tv_nsec;
+}
+
+bool watch_file(const char *input, const char *output) {
+    struct stat last;
+    if (stat(input, &last) < 0) {
+        fprintf(stderr, "ERROR: Could not watch '%s': %s\n", input, strerror(errno));
+        return false;
+    }
+
+    Watch w;
+    if (!watch_init(&w, input, output)) {
+        return false;
+    }
+    watch_build(&w);
+
+    while (!watch_signal) {
+        poll(NULL, 0, WATCH_POLL_MS);
+
+        // A file being replaced may be missing for a moment
+        struct stat st;
+        if (watch_signal || stat(input, &st) < 0 || stat_same(&st, &last)) {
+            continue;
+        }
+
+        // The save is over once the file stops changing
+        do {
+            last = st;
+            poll(NULL, 0, WATCH_SETTLE_MS);
+        } while (!watch_signal && !stat(input, &st) && !stat_same(&st, &last));
+
+        if (!watch_signal) {
+            watch_build(&w);
+        }
+    }
+    return watch_free(&w, true);
+}
+#endif
@@ -0,0 +1,10 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "basic.h"
+
+// Builds 'input' into 'output', then again whenever it is saved, until killed. Returns only if the file cannot be
+// watched.
+bool watch_file(const char *input, const char *output);
+
+#endif // WATCH_H
@@ -0,0 +1,62 @@
+// Embeds the compiler through libglos.a the way an outside program would
+//
+// $ make tests/libglos
+// $ cd tests && ./libglos
+#include <stdio.h>
+#include <string.h>
+
+#include "glos.h"
+
+static void print_result(const char *name, const GlosResult *r) {
+    printf("%s: %s\n", name, r->ok ? "ok" : "failed");
+    for (size_t i = 0; i < r->diagnostics.count; i++) {
+        const GlosDiagnostic *it = &r->diagnostics.data[i];
+        printf(
+            "%s:%zu:%zu: %s: %s\n",
+            name,
+            it->row,
+            it->col,
+            it->severity == GLOS_NOTE ? "NOTE" : "ERROR",
+            it->message);
+    }
+}
+
+static bool check(const char *name, const char *source) {
+    GlosResult r;
+    const bool ok = glos_check(name, source, strlen(source), &r);
+    print_result(name, &r);
+    glos_result_free(&r);
+    return ok;
+}
+
+static bool emit_memory(const char *name, const char *source) {
+    GlosResult r;
+    const bool ok = glos_emit_memory(name, source, strlen(source), &r);
+    print_result(name, &r);
+
+    // The program text depends on the backend, so only its presence is reported
+    printf("%s: %s\n", name, r.program && r.program_size ? "emitted" : "nothing emitted");
+    glos_result_free(&r);
+    return ok;
+}
+
+int main(void) {
+    const char *good = "fn main() {\n"
+                       "    var x = 34 + 35\n"
+                       "    print x\n"
+                       "}\n";
+
+    const char *undefined = "fn main() {\n"
+                            "    print y\n"
+                            "}\n";
+
+    const char *redefined = "fn f() {}\n"
+                            "fn f() {}\n";
+
+    bool ok = check("good.glos", good);
+    ok &= !check("undefined.glos", undefined);
+    ok &= !check("redefined.glos", redefined);
+    ok &= emit_memory("good.glos", good);
+    ok &= !emit_memory("undefined.glos", undefined);
+    return !ok;
+}
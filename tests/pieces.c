@@ -0,0 +1,173 @@
+// Checks that the pieces of a program are keyed by their structure, then builds a program from its pieces
+//
+// $ make tests/pieces
+// $ cd tests && ./pieces
+#include <unistd.h>
+
+#include "checker.h"
+#include "compiler.h"
+#include "parser.h"
+
+// Every version has the same name and the same globals on the same rows, so only what is said to differ may change
+// their keys
+static const char *base = "var g = 34\n"
+                          "\n"
+                          "fn f(x i64) i64 {\n"
+                          "    return x + g\n"
+                          "}\n"
+                          "\n"
+                          "fn h() {\n"
+                          "    print f(35)\n"
+                          "}\n"
+                          "\n"
+                          "fn main() {\n"
+                          "    h()\n"
+                          "    print g * 10 + 80\n"
+                          "}\n";
+
+static const struct {
+    const char *name;
+    const char *source;
+} versions[] = {
+    // More nodes in 'f' move the nodes and lists of everything after it
+    {
+        "edited body of f",
+        "var g = 34\n"
+        "\n"
+        "fn f(x i64) i64 {\n"
+        "    return x + g + 0 * x\n"
+        "}\n"
+        "\n"
+        "fn h() {\n"
+        "    print f(35)\n"
+        "}\n"
+        "\n"
+        "fn main() {\n"
+        "    h()\n"
+        "    print g * 10 + 80\n"
+        "}\n",
+    },
+
+    // The text of 'h' is the same, but the signature of the function it calls is not
+    {
+        "changed signature of f",
+        "var g = 34\n"
+        "\n"
+        "fn f(x i64) bool {\n"
+        "    return true\n"
+        "}\n"
+        "\n"
+        "fn h() {\n"
+        "    print f(35)\n"
+        "}\n"
+        "\n"
+        "fn main() {\n"
+        "    h()\n"
+        "    print g * 10 + 80\n"
+        "}\n",
+    },
+};
+
+#define GLOBALS_MAX 8
+
+typedef struct {
+    Lexer   lexer;
+    Ast     ast;
+    Parser  parser;
+    Context context;
+} Program;
+
+static void program_load(Program *p, const char *name, const char *source) {
+    memset(p, 0, sizeof(*p));
+    lexer_init(&p->lexer, name, sv_from_cstr(source));
+    p->parser.ast = &p->ast;
+    p->context.ast = &p->ast;
+
+    if (!parse_file(&p->parser, p->lexer) || !check_nodes(&p->context, p->parser.nodes)) {
+        fprintf(stderr, "ERROR: Could not check '%s'\n", name);
+        exit(1);
+    }
+    assert(p->context.globals.count <= GLOBALS_MAX);
+}
+
+static void program_free(Program *p) {
+    parser_free(&p->parser);
+    context_free(&p->context);
+    ast_free(&p->ast);
+    source_remove(p->lexer.base);
+}
+
+static void program_keys(const Program *p, uint64_t *keys) {
+    for (size_t i = 0; i < p->context.globals.count; i++) {
+        keys[i] = compile_piece_hash(&p->ast, p->context.globals.data[i].node);
+    }
+}
+
+// The entry piece is built first, then every function, and their objects are linked into the program
+static bool program_build(Program *p, const char *dir, const char *output) {
+    const Scope *globals = &p->context.globals;
+
+    const char *objects[GLOBALS_MAX + 1];
+    size_t      count = 0;
+
+    Compiler c;
+    compile_split_begin(&c, &p->context);
+
+    bool ok = compile_piece(&c, 0, objects[count++] = temp_sprintf("%s/entry.o", dir));
+    for (size_t i = 0; ok && i < globals->count; i++) {
+        const NodeId id = globals->data[i].node;
+        if (ast_node(&p->ast, id)->kind == NODE_FN) {
+            objects[count] = temp_sprintf("%s/" SVFmt ".o", dir, SVArg(symbol_sv(globals->data[i].name)));
+            ok = compile_piece(&c, id, objects[count++]);
+        }
+    }
+    compile_split_end(&c);
+
+    ok = ok && compile_link(&p->context, objects, count, output);
+    for (size_t i = 0; i < count; i++) {
+        unlink(objects[i]);
+    }
+    return ok;
+}
+
+int main(void) {
+    Program  p;
+    uint64_t keys[GLOBALS_MAX];
+    program_load(&p, "base.glos", base);
+    program_keys(&p, keys);
+
+    for (size_t i = 0; i < len(versions); i++) {
+        Program  q;
+        uint64_t other[GLOBALS_MAX];
+        program_load(&q, "base.glos", versions[i].source);
+        program_keys(&q, other);
+
+        printf("%s:\n", versions[i].name);
+        for (size_t j = 0; j < q.context.globals.count; j++) {
+            printf("    " SVFmt ": %s\n", SVArg(symbol_sv(q.context.globals.data[j].name)),
+                   keys[j] == other[j] ? "same key" : "new key");
+        }
+        program_free(&q);
+    }
+
+    char dir[] = "/tmp/glos_pieces_XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "ERROR: Could not create a directory for the pieces\n");
+        exit(1);
+    }
+
+    const char *output = temp_sprintf("%s/program", dir);
+    const bool  built = program_build(&p, dir, output);
+    printf("built from pieces: %s\n", built ? "ok" : "failed");
+    fflush(stdout);
+
+    int status = !built;
+    if (built) {
+        status = system(output) != 0;
+        unlink(output);
+    }
+    rmdir(dir);
+
+    program_free(&p);
+    return status;
+}
@@ -20,6 +20,7 @@
 # OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
 # WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+import os
 import sys
 import subprocess
 from difflib import unified_diff
@@ -54,7 +55,27 @@ def capture(testcase: str, debug=True) -> dict:
     if debug:
         print(f"CAPTURING: {testcase}")
 
-    process = subprocess.run(['../glos', 'run', testcase], capture_output=True)
+    # A test case with spaces, or starting with './', is a command line. Leading NAME=VALUE words are set in the
+    # environment, a trailing '< FILE' is fed to stdin, and the rest are the arguments of the compiler, or a test
+    # program when they start with './'. A lone file is run.
+    args = testcase.split() if ' ' in testcase or testcase.startswith('./') else ['run', testcase]
+
+    env = dict(os.environ)
+    while args and '=' in args[0]:
+        name, value = args.pop(0).split('=', 1)
+        env[name] = value
+
+    stdin = subprocess.DEVNULL
+    if len(args) >= 2 and args[-2] == '<':
+        stdin = open(args[-1], 'rb')
+        args = args[:-2]
+
+    if not args[0].startswith('./'):
+        args = ['../glos', *args]
+
+    process = subprocess.run(args, capture_output=True, env=env, stdin=stdin)
+    if stdin != subprocess.DEVNULL:
+        stdin.close()
     return {
         'testcase': testcase,
         'returncode': process.returncode,
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Builds through a compile server started for the test, then runs what it built
+dir=$(mktemp -d)
+export GLOS_SOCKET="$dir/glos.sock"
+
+../glos serve > /dev/null &
+server=$!
+trap 'kill $server; rm -rf "$dir"' EXIT
+
+tries=0
+while [ ! -S "$GLOS_SOCKET" ] && [ $tries -lt 100 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+
+../glos build --server 003-variables/main.glos && ./003-variables/main
+rm -f 003-variables/main
+
+../glos build --server 003-variables/error-undefined.glos
+echo "Exited with $?"